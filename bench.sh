@@ -0,0 +1,42 @@
+#!/bin/bash
+# Times the evaluation engines against each other on the INPUTS corpus.
+# Build first with "run", then: ./bench.sh [repetitions] [engines...]
+# The corpus is every expression in INPUTS/task_1..3 (minus quit lines)
+# repeated the given number of times, redirected from a file on stdin.
+# Also totals the AST sizes and pruning counts logged to bison_flex.log,
+# and times a memo recurrence with an INT and with a DOUBLE argument,
+# whose kept results have to hash equally well.
+
+REPS=${1:-2000}
+shift 2>/dev/null
+ENGINES=${*:-"--engine=tree --engine=vm"}
+CORPUS=$(mktemp)
+
+for f in INPUTS/task_1/*.cilisp INPUTS/task_2.cilisp INPUTS/task_3.cilisp; do
+    grep -v '^quit' "$f" | grep -v '^[[:space:]]*$'
+done > "$CORPUS.one"
+
+i=0
+while [ $i -lt "$REPS" ]; do
+    cat "$CORPUS.one"
+    i=$((i + 1))
+done > "$CORPUS"
+echo quit >> "$CORPUS"
+
+echo "$(wc -l < "$CORPUS") expressions"
+for engine in $ENGINES; do
+    echo "$engine"
+    time (./cilisp $engine < "$CORPUS" > /dev/null)
+    awk '/^AST:/ { nodes += $2; bytes += $4 } END { if (nodes) printf "AST: %d nodes, %d bytes, %.1f bytes/node\n", nodes, bytes, bytes / nodes }' bison_flex.log
+    awk '/^PRUNE:/ { removed += $2; inlined += $5; merged += $7; before += $10; after += $12; n++ } END { if (n) printf "PRUNE: %d bindings removed, %d inlined, %d scopes merged, %d -> %d nodes\n", removed, inlined, merged, before, after }' bison_flex.log
+done
+
+for n in 90 90.0; do
+    echo "((let (fib memo lambda (n) (cond (less n 2) n (add (fib (sub n 1)) (fib (sub n 2)))))) (fib $n))" > "$CORPUS"
+    for engine in $ENGINES; do
+        echo "memo fib $n $engine"
+        time (./cilisp $engine < "$CORPUS" > /dev/null)
+    done
+done
+
+rm -f "$CORPUS" "$CORPUS.one"
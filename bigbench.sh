@@ -0,0 +1,33 @@
+#!/bin/bash
+# Times bignum multiplication on the evaluation engines.
+# Build first with "run", then: ./bigbench.sh [multiplications] [digits] [engines...]
+# Two random integers of the given number of digits are bound once, and
+# one expression multiplies them that many times, each time with its
+# own second operand, taking the product modulo a prime so only the
+# multiplications are big. Compare with 0 multiplications for the cost
+# of reading the literals.
+
+MULTS=${1:-200}
+DIGITS=${2:-10000}
+shift 2 2>/dev/null
+ENGINES=${*:-"--engine=tree --engine=vm"}
+PROGRAM=$(mktemp)
+
+awk -v mults="$MULTS" -v digits="$DIGITS" 'BEGIN {
+    srand(1)
+    for (n = 0; n < 2; n++) {
+        number[n] = int(1 + rand() * 9)
+        for (i = 1; i < digits; i++) number[n] = number[n] int(rand() * 10)
+    }
+    printf "((let (a %s) (b %s)) (add 0", number[0], number[1]
+    for (i = 0; i < mults; i++) printf " (remainder (mult a (add b %d)) 1000000007)", i
+    printf "))\nquit\n"
+}' > "$PROGRAM"
+
+echo "$MULTS multiplications of $DIGITS-digit integers"
+for engine in $ENGINES; do
+    echo "$engine"
+    time (./cilisp $engine < "$PROGRAM" > /dev/null)
+done
+
+rm -f "$PROGRAM"
@@ -0,0 +1,765 @@
+#include "cilisp.h"
+
+// Arbitrary-precision integers, for INTs beyond int64 (RET_VAL tag 4).
+//
+// The integer kernels work on int64_t and come here when a step would
+// overflow, so add, sub, mult, pow, neg and abs of integers stay exact
+// at any size, and so do remainder and a div that leaves no remainder.
+// Integer literals beyond int64 are read into bignums too. INTs made
+// from doubles (casts, exp2, ...) are still doubles. A result that fits
+// in int64 is always given back as one, so a bignum is never in int64
+// range and comparing tags is enough to tell the two apart.
+//
+// A bignum is a sign and a magnitude in 32-bit limbs. Results are boxed
+// in the arena with their limbs and live until the program is done.
+// Scratch space (Karatsuba's partial products, the running sum or
+// product of add and mult, division and printing) comes from a pool of
+// limb buffers in power-of-two sizes, kept for the next program.
+// Products are schoolbook below KARATSUBA_THRESHOLD limbs and Karatsuba
+// above, and nothing grows past BIG_MAX_LIMBS: such results are left to
+// the doubles, as every overflowing INT used to be.
+
+#define KARATSUBA_THRESHOLD 32
+#define BIG_MAX_LIMBS (UINT32_C(1) << 20)   // 2^25 bits, about 10 million digits
+#define BIG_POOL_CLASSES 32
+#define BIG_CHUNK 1000000000                // 10^9, the decimal digits read and printed per limb
+#define BIG_CHUNK_DIGITS 9
+
+// Free limb buffers by size class; each one holds the next in its first bytes.
+static uint32_t *pool[BIG_POOL_CLASSES];
+
+static unsigned poolClass(uint32_t count)
+{
+    unsigned class = 2;     // room for the link
+    while ((UINT32_C(1) << class) < count)
+    {
+        class++;
+    }
+    return class;
+}
+
+// A buffer of at least count limbs; *capacity is set to its real size.
+static uint32_t *poolTake(uint32_t count, uint32_t *capacity)
+{
+    unsigned class = poolClass(count);
+    uint32_t *limbs = pool[class];
+    if (limbs != NULL)
+    {
+        pool[class] = *(uint32_t **) limbs;
+    }
+    else if ((limbs = malloc(sizeof(uint32_t) << class)) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    *capacity = UINT32_C(1) << class;
+    return limbs;
+}
+
+static void poolGive(uint32_t *limbs, uint32_t capacity)
+{
+    unsigned class = poolClass(capacity);
+    *(uint32_t **) limbs = pool[class];
+    pool[class] = limbs;
+}
+
+// Magnitudes. Lengths may count leading zero limbs unless said otherwise.
+
+static uint32_t trim(const uint32_t *a, uint32_t n)
+{
+    while (n > 0 && a[n - 1] == 0)
+    {
+        n--;
+    }
+    return n;
+}
+
+static int magCompare(const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    na = trim(a, na);
+    nb = trim(b, nb);
+    if (na != nb)
+    {
+        return na < nb ? -1 : 1;
+    }
+    while (na-- > 0)
+    {
+        if (a[na] != b[na])
+        {
+            return a[na] < b[na] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// r = a + b for na >= nb, in na + 1 limbs. r may be a or b.
+static void magAdd(uint32_t *r, const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    uint64_t carry = 0;
+    uint32_t i = 0;
+    for (; i < nb; i++)
+    {
+        carry += (uint64_t) a[i] + b[i];
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    for (; i < na; i++)
+    {
+        carry += a[i];
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    r[na] = (uint32_t) carry;
+}
+
+// r = a - b for a >= b and na >= nb, in na limbs. r may be a or b.
+static void magSub(uint32_t *r, const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    uint64_t borrow = 0;
+    uint32_t i = 0;
+    for (; i < nb; i++)
+    {
+        uint64_t difference = (uint64_t) a[i] - b[i] - borrow;
+        r[i] = (uint32_t) difference;
+        borrow = (difference >> 32) & 1;
+    }
+    for (; i < na; i++)
+    {
+        uint64_t difference = (uint64_t) a[i] - borrow;
+        r[i] = (uint32_t) difference;
+        borrow = (difference >> 32) & 1;
+    }
+}
+
+// r += a, where the sum fits in nr >= na limbs.
+static void magAddInto(uint32_t *r, uint32_t nr, const uint32_t *a, uint32_t na)
+{
+    uint64_t carry = 0;
+    uint32_t i = 0;
+    for (; i < na; i++)
+    {
+        carry += (uint64_t) r[i] + a[i];
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    for (; carry != 0 && i < nr; i++)
+    {
+        carry += r[i];
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+}
+
+// r -= a, where r >= a and nr >= na.
+static void magSubInto(uint32_t *r, uint32_t nr, const uint32_t *a, uint32_t na)
+{
+    uint64_t borrow = 0;
+    uint32_t i = 0;
+    for (; i < na; i++)
+    {
+        uint64_t difference = (uint64_t) r[i] - a[i] - borrow;
+        r[i] = (uint32_t) difference;
+        borrow = (difference >> 32) & 1;
+    }
+    for (; borrow != 0 && i < nr; i++)
+    {
+        uint64_t difference = (uint64_t) r[i] - borrow;
+        r[i] = (uint32_t) difference;
+        borrow = (difference >> 32) & 1;
+    }
+}
+
+// a = a * factor + addend, in place; a has room for one more limb.
+// Returns the new length.
+static uint32_t magMulAddSmall(uint32_t *a, uint32_t na, uint32_t factor, uint32_t addend)
+{
+    uint64_t carry = addend;
+    for (uint32_t i = 0; i < na; i++)
+    {
+        carry += (uint64_t) a[i] * factor;
+        a[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    a[na] = (uint32_t) carry;
+    return trim(a, na + 1);
+}
+
+// a /= divisor, in place. Returns the remainder.
+static uint32_t magDivSmall(uint32_t *a, uint32_t na, uint32_t divisor)
+{
+    uint64_t remainder = 0;
+    for (uint32_t i = na; i-- > 0;)
+    {
+        uint64_t current = (remainder << 32) | a[i];
+        a[i] = (uint32_t) (current / divisor);
+        remainder = current % divisor;
+    }
+    return (uint32_t) remainder;
+}
+
+static void magMulSchool(uint32_t *r, const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    memset(r, 0, (size_t) (na + nb) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < na; i++)
+    {
+        uint64_t ai = a[i];
+        uint64_t carry = 0;
+        if (ai == 0)
+        {
+            continue;
+        }
+        for (uint32_t j = 0; j < nb; j++)
+        {
+            // at most (2^32 - 1)^2 + 2 (2^32 - 1), which is 2^64 - 1
+            carry += ai * b[j] + r[i + j];
+            r[i + j] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        r[i + nb] = (uint32_t) carry;
+    }
+}
+
+// r = a * b in na + nb limbs; r overlaps neither operand.
+static void magMul(uint32_t *r, const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    if (na < nb)
+    {
+        const uint32_t *swap = a;
+        a = b;
+        b = swap;
+        uint32_t swapCount = na;
+        na = nb;
+        nb = swapCount;
+    }
+    if (nb < KARATSUBA_THRESHOLD)
+    {
+        magMulSchool(r, a, na, b, nb);
+        return;
+    }
+
+    uint32_t m = (na + 1) / 2;
+    uint32_t capacity;
+    if (nb <= m)
+    {
+        // b is no longer than a's halves: a0 b + a1 b B^m
+        uint32_t *high = poolTake(na - m + nb, &capacity);
+        magMul(r, a, m, b, nb);
+        memset(r + m + nb, 0, (size_t) (na - m) * sizeof(uint32_t));
+        magMul(high, a + m, na - m, b, nb);
+        magAddInto(r + m, na + nb - m, high, na - m + nb);
+        poolGive(high, capacity);
+        return;
+    }
+
+    // a = a1 B^m + a0 and b = b1 B^m + b0 give
+    // a b = z2 B^2m + (z1 - z2 - z0) B^m + z0, with z1 = (a0 + a1)(b0 + b1)
+    uint32_t *scratch = poolTake(4 * (m + 1), &capacity);
+    uint32_t *sumA = scratch;
+    uint32_t *sumB = scratch + (m + 1);
+    uint32_t *z1 = scratch + 2 * (m + 1);
+
+    magMul(r, a, m, b, m);
+    magMul(r + 2 * m, a + m, na - m, b + m, nb - m);
+    magAdd(sumA, a, m, a + m, na - m);
+    magAdd(sumB, b, m, b + m, nb - m);
+    magMul(z1, sumA, m + 1, sumB, m + 1);
+    magSubInto(z1, 2 * (m + 1), r, 2 * m);
+    magSubInto(z1, 2 * (m + 1), r + 2 * m, na + nb - 2 * m);
+    magAddInto(r + m, na + nb - m, z1, trim(z1, 2 * (m + 1)));
+    poolGive(scratch, capacity);
+}
+
+// q = a / b and rem = a % b (Knuth's algorithm D), for na >= nb and a
+// trimmed b of at least two limbs. q has room for na - nb + 1 limbs and
+// rem for nb.
+static void magDivMod(uint32_t *q, uint32_t *rem, const uint32_t *a, uint32_t na, const uint32_t *b, uint32_t nb)
+{
+    uint32_t divisorCapacity, dividendCapacity;
+    uint32_t *v = poolTake(nb, &divisorCapacity);
+    uint32_t *u = poolTake(na + 1, &dividendCapacity);
+
+    // shift both so the divisor's top bit is set, which keeps each
+    // quotient estimate at most two too big
+    int shift = __builtin_clz(b[nb - 1]);
+    for (uint32_t i = nb - 1; i > 0; i--)
+    {
+        v[i] = (uint32_t) (((uint64_t) b[i] << shift) | ((uint64_t) b[i - 1] >> (32 - shift)));
+    }
+    v[0] = b[0] << shift;
+    u[na] = (uint32_t) ((uint64_t) a[na - 1] >> (32 - shift));
+    for (uint32_t i = na - 1; i > 0; i--)
+    {
+        u[i] = (uint32_t) (((uint64_t) a[i] << shift) | ((uint64_t) a[i - 1] >> (32 - shift)));
+    }
+    u[0] = a[0] << shift;
+
+    for (uint32_t j = na - nb + 1; j-- > 0;)
+    {
+        uint64_t top = ((uint64_t) u[j + nb] << 32) | u[j + nb - 1];
+        uint64_t qhat = top / v[nb - 1];
+        uint64_t rhat = top % v[nb - 1];
+        while (qhat >> 32 != 0 || qhat * v[nb - 2] > ((rhat << 32) | u[j + nb - 2]))
+        {
+            qhat--;
+            rhat += v[nb - 1];
+            if (rhat >> 32 != 0)
+            {
+                break;
+            }
+        }
+
+        // u -= qhat v, shifted by j limbs
+        int64_t borrow = 0;
+        int64_t difference;
+        for (uint32_t i = 0; i < nb; i++)
+        {
+            uint64_t product = qhat * v[i];
+            difference = (int64_t) u[i + j] - borrow - (int64_t) (product & 0xFFFFFFFF);
+            u[i + j] = (uint32_t) difference;
+            borrow = (int64_t) (product >> 32) - (difference >> 32);
+        }
+        difference = (int64_t) u[j + nb] - borrow;
+        u[j + nb] = (uint32_t) difference;
+
+        q[j] = (uint32_t) qhat;
+        if (difference < 0)
+        {
+            // qhat was one too big: add v back
+            q[j]--;
+            uint64_t carry = 0;
+            for (uint32_t i = 0; i < nb; i++)
+            {
+                carry += (uint64_t) u[i + j] + v[i];
+                u[i + j] = (uint32_t) carry;
+                carry >>= 32;
+            }
+            u[j + nb] += (uint32_t) carry;
+        }
+    }
+
+    for (uint32_t i = 0; i < nb - 1; i++)
+    {
+        rem[i] = (uint32_t) (((uint64_t) u[i] >> shift) | ((uint64_t) u[i + 1] << (32 - shift)));
+    }
+    rem[nb - 1] = u[nb - 1] >> shift;
+
+    poolGive(u, dividendCapacity);
+    poolGive(v, divisorCapacity);
+}
+
+// The double nearest the magnitude, rounded once: the top 64 bits, with
+// any lower ones folded into the last, convert as the whole would.
+static double magToDouble(const uint32_t *a, uint32_t na)
+{
+    na = trim(a, na);
+    if (na <= 2)
+    {
+        return (double) (na == 0 ? 0 : na == 1 ? a[0] : a[0] | (uint64_t) a[1] << 32);
+    }
+
+    uint32_t bits = 32 * na - (uint32_t) __builtin_clz(a[na - 1]);
+    uint32_t shift = bits - 64;
+    uint32_t word = shift / 32, bit = shift % 32;
+    uint64_t low = a[word] | (uint64_t) a[word + 1] << 32;
+    uint64_t high = word + 2 < na ? a[word + 2] : 0;
+    uint64_t top = bit == 0 ? low : (low >> bit) | (high << (64 - bit));
+
+    bool sticky = bit != 0 && (a[word] & ((UINT32_C(1) << bit) - 1)) != 0;
+    for (uint32_t i = 0; i < word && !sticky; i++)
+    {
+        sticky = a[i] != 0;
+    }
+    return ldexp((double) (top | sticky), (int) shift);
+}
+
+// Signs and magnitudes of RET_VALs.
+
+static BIGNUM *bigBox(RET_VAL val)
+{
+    return (BIGNUM *) (uintptr_t) (val & RET_PAYLOAD);
+}
+
+// An integer RET_VAL as a BIGNUM; an int64 is put in space.
+static BIGNUM bigView(RET_VAL val, uint32_t space[2])
+{
+    if (retIsBig(val))
+    {
+        return *bigBox(val);
+    }
+
+    int64_t i = retInt64Of(val);
+    uint64_t magnitude = i < 0 ? -(uint64_t) i : (uint64_t) i;
+    space[0] = (uint32_t) magnitude;
+    space[1] = (uint32_t) (magnitude >> 32);
+    BIGNUM view = { space, trim(space, 2), 2, i < 0 };
+    return view;
+}
+
+// The INT with the given sign and magnitude: an int64 if it fits, else
+// a bignum boxed in the arena.
+static RET_VAL bigResult(bool negative, const uint32_t *limbs, uint32_t count)
+{
+    count = trim(limbs, count);
+    if (count <= 2)
+    {
+        uint64_t magnitude = count == 0 ? 0 : count == 1 ? limbs[0] : limbs[0] | (uint64_t) limbs[1] << 32;
+        if (magnitude <= INT64_MAX)
+        {
+            return retFromInt(negative ? -(int64_t) magnitude : (int64_t) magnitude);
+        }
+        if (negative && magnitude == UINT64_C(1) << 63)
+        {
+            return retFromInt(INT64_MIN);
+        }
+    }
+
+    BIGNUM *box = arenaAlloc(sizeof(BIGNUM) + count * sizeof(uint32_t));
+    box->limbs = (uint32_t *) (box + 1);
+    box->count = box->capacity = count;
+    box->negative = negative;
+    memcpy(box->limbs, limbs, count * sizeof(uint32_t));
+    return RET_BIG_TAG | ((uint64_t) (uintptr_t) box & RET_PAYLOAD);
+}
+
+double bigToDouble(RET_VAL val)
+{
+    BIGNUM *big = bigBox(val);
+    double magnitude = magToDouble(big->limbs, big->count);
+    return big->negative ? -magnitude : magnitude;
+}
+
+int bigCompare(RET_VAL a, RET_VAL b)
+{
+    uint32_t spaceA[2], spaceB[2];
+    BIGNUM x = bigView(a, spaceA), y = bigView(b, spaceB);
+    if (x.negative != y.negative)
+    {
+        return x.negative ? -1 : 1;
+    }
+    int order = magCompare(x.limbs, x.count, y.limbs, y.count);
+    return x.negative ? -order : order;
+}
+
+// Reads the digits of an integer literal with an optional sign.
+RET_VAL bigLiteral(char *text)
+{
+    bool negative = *text == '-';
+    if (*text == '-' || *text == '+')
+    {
+        text++;
+    }
+    size_t digits = strspn(text, "0123456789");
+    if (digits / BIG_CHUNK_DIGITS + 2 > BIG_MAX_LIMBS)
+    {
+        return retInt(negative ? -INFINITY : INFINITY);
+    }
+
+    uint32_t capacity;
+    uint32_t *limbs = poolTake((uint32_t) (digits / BIG_CHUNK_DIGITS + 2), &capacity);
+    uint32_t count = 0;
+
+    // the first chunk takes what is left over by the full ones after it
+    size_t length = digits % BIG_CHUNK_DIGITS == 0 ? BIG_CHUNK_DIGITS : digits % BIG_CHUNK_DIGITS;
+    for (size_t start = 0; start < digits; start += length, length = BIG_CHUNK_DIGITS)
+    {
+        uint32_t chunk = 0, scale = 1;
+        for (size_t i = start; i < start + length; i++)
+        {
+            chunk = chunk * 10 + (uint32_t) (text[i] - '0');
+            scale *= 10;
+        }
+        count = magMulAddSmall(limbs, count, scale, chunk);
+    }
+
+    RET_VAL result = bigResult(negative, limbs, count);
+    poolGive(limbs, capacity);
+    return result;
+}
+
+RET_VAL bigNeg(RET_VAL a)
+{
+    uint32_t space[2];
+    BIGNUM x = bigView(a, space);
+    return bigResult(!x.negative && x.count > 0, x.limbs, x.count);
+}
+
+// a + b, or a - b when subtract is set
+static RET_VAL bigSum(RET_VAL a, RET_VAL b, bool subtract)
+{
+    uint32_t spaceA[2], spaceB[2];
+    BIGNUM x = bigView(a, spaceA), y = bigView(b, spaceB);
+    y.negative ^= subtract;
+
+    uint32_t capacity;
+    uint32_t *limbs = poolTake((x.count > y.count ? x.count : y.count) + 1, &capacity);
+    RET_VAL result;
+    if (x.negative == y.negative)
+    {
+        if (x.count >= y.count)
+        {
+            magAdd(limbs, x.limbs, x.count, y.limbs, y.count);
+        }
+        else
+        {
+            magAdd(limbs, y.limbs, y.count, x.limbs, x.count);
+        }
+        result = bigResult(x.negative, limbs, (x.count > y.count ? x.count : y.count) + 1);
+    }
+    else if (magCompare(x.limbs, x.count, y.limbs, y.count) >= 0)
+    {
+        magSub(limbs, x.limbs, x.count, y.limbs, y.count);
+        result = bigResult(x.negative, limbs, x.count);
+    }
+    else
+    {
+        magSub(limbs, y.limbs, y.count, x.limbs, x.count);
+        result = bigResult(y.negative, limbs, y.count);
+    }
+    poolGive(limbs, capacity);
+    return result;
+}
+
+RET_VAL bigSub(RET_VAL a, RET_VAL b)
+{
+    return bigSum(a, b, true);
+}
+
+// a / b, if b divides a. 0 over a negative number is -0, and dividing
+// by zero gives inf or nan: those are left to the doubles.
+bool bigDiv(RET_VAL a, RET_VAL b, RET_VAL *result)
+{
+    uint32_t spaceA[2], spaceB[2];
+    BIGNUM x = bigView(a, spaceA), y = bigView(b, spaceB);
+    if (y.count == 0 || (x.count == 0 && y.negative))
+    {
+        return false;
+    }
+    if (x.count < y.count)
+    {
+        // only 0 is divisible by something bigger
+        *result = retFromInt(0);
+        return x.count == 0;
+    }
+
+    uint32_t quotientCapacity, remainderCapacity;
+    uint32_t *quotient = poolTake(x.count - y.count + 1, &quotientCapacity);
+    uint32_t *remainder = poolTake(y.count, &remainderCapacity);
+    uint32_t remainderCount;
+    if (y.count == 1)
+    {
+        memcpy(quotient, x.limbs, x.count * sizeof(uint32_t));
+        remainder[0] = magDivSmall(quotient, x.count, y.limbs[0]);
+        remainderCount = trim(remainder, 1);
+    }
+    else
+    {
+        magDivMod(quotient, remainder, x.limbs, x.count, y.limbs, y.count);
+        remainderCount = trim(remainder, y.count);
+    }
+
+    bool exact = remainderCount == 0;
+    if (exact)
+    {
+        *result = bigResult(x.negative != y.negative, quotient, y.count == 1 ? x.count : x.count - y.count + 1);
+    }
+    poolGive(remainder, remainderCapacity);
+    poolGive(quotient, quotientCapacity);
+    return exact;
+}
+
+// |a % b|, for a nonzero b.
+RET_VAL bigRemainder(RET_VAL a, RET_VAL b)
+{
+    uint32_t spaceA[2], spaceB[2];
+    BIGNUM x = bigView(a, spaceA), y = bigView(b, spaceB);
+    if (x.count < y.count)
+    {
+        return bigResult(false, x.limbs, x.count);
+    }
+
+    uint32_t quotientCapacity, remainderCapacity;
+    uint32_t *quotient = poolTake(x.count, &quotientCapacity);
+    uint32_t *remainder = poolTake(y.count, &remainderCapacity);
+    if (y.count == 1)
+    {
+        memcpy(quotient, x.limbs, x.count * sizeof(uint32_t));
+        remainder[0] = magDivSmall(quotient, x.count, y.limbs[0]);
+    }
+    else
+    {
+        magDivMod(quotient, remainder, x.limbs, x.count, y.limbs, y.count);
+    }
+
+    RET_VAL result = bigResult(false, remainder, y.count);
+    poolGive(remainder, remainderCapacity);
+    poolGive(quotient, quotientCapacity);
+    return result;
+}
+
+static void swapLimbs(uint32_t **a, uint32_t **b)
+{
+    uint32_t *swap = *a;
+    *a = *b;
+    *b = swap;
+}
+
+// base ** exponent by squaring, for a non-negative exponent.
+bool bigPow(RET_VAL base, int64_t exponent, RET_VAL *result)
+{
+    uint32_t space[2];
+    BIGNUM x = bigView(base, space);
+    if (x.count == 0 || exponent == 0)
+    {
+        *result = retFromInt(x.count == 0 && exponent > 0 ? 0 : 1);
+        return true;
+    }
+
+    uint64_t baseBits = 32 * (uint64_t) x.count - (uint64_t) __builtin_clz(x.limbs[x.count - 1]);
+    if ((uint64_t) exponent > 32 * (uint64_t) BIG_MAX_LIMBS / baseBits)
+    {
+        return false;
+    }
+
+    // no partial result is bigger than the final one, which takes at
+    // most baseBits * exponent bits
+    uint32_t size = (uint32_t) (baseBits * (uint64_t) exponent / 32) + 4;
+    uint32_t powerCapacity, scratchCapacity;
+    uint32_t *power = poolTake(size, &powerCapacity);
+    uint32_t *scratch = poolTake(size, &scratchCapacity);
+    uint32_t count = 1;
+    power[0] = 1;
+
+    for (int bit = 63 - __builtin_clzll((uint64_t) exponent); bit >= 0; bit--)
+    {
+        magMul(scratch, power, count, power, count);
+        count = trim(scratch, 2 * count);
+        swapLimbs(&power, &scratch);
+        if ((exponent >> bit) & 1)
+        {
+            magMul(scratch, power, count, x.limbs, x.count);
+            count = trim(scratch, count + x.count);
+            swapLimbs(&power, &scratch);
+        }
+    }
+
+    *result = bigResult(x.negative && (exponent & 1), power, count);
+    poolGive(power, powerCapacity);
+    poolGive(scratch, scratchCapacity);
+    return true;
+}
+
+// Prints the decimal digits, nine at a time from a copy divided down by 10^9.
+void bigPrint(RET_VAL val)
+{
+    BIGNUM *big = bigBox(val);
+    uint32_t copyCapacity, chunkCapacity;
+    uint32_t *copy = poolTake(big->count, &copyCapacity);
+    uint32_t *chunks = poolTake(big->count * 32 / 29 + 1, &chunkCapacity);
+    uint32_t count = big->count, chunkCount = 0;
+
+    memcpy(copy, big->limbs, count * sizeof(uint32_t));
+    while (count > 0)
+    {
+        chunks[chunkCount++] = magDivSmall(copy, count, BIG_CHUNK);
+        count = trim(copy, count);
+    }
+
+    printf("%s%u", big->negative ? "-" : "", chunks[chunkCount - 1]);
+    for (uint32_t i = chunkCount - 1; i-- > 0;)
+    {
+        printf("%09u", chunks[i]);
+    }
+    poolGive(chunks, chunkCapacity);
+    poolGive(copy, copyCapacity);
+}
+
+// Accumulators.
+
+static void bigAccReserve(BIGNUM *acc, uint32_t count)
+{
+    if (count > acc->capacity)
+    {
+        uint32_t capacity;
+        uint32_t *limbs = poolTake(count, &capacity);
+        memcpy(limbs, acc->limbs, acc->count * sizeof(uint32_t));
+        poolGive(acc->limbs, acc->capacity);
+        acc->limbs = limbs;
+        acc->capacity = capacity;
+    }
+}
+
+void bigAccStart(BIGNUM *acc, int64_t value)
+{
+    uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    acc->limbs = poolTake(4, &acc->capacity);
+    acc->limbs[0] = (uint32_t) magnitude;
+    acc->limbs[1] = (uint32_t) (magnitude >> 32);
+    acc->count = trim(acc->limbs, 2);
+    acc->negative = value < 0;
+}
+
+void bigAccAdd(BIGNUM *acc, RET_VAL val)
+{
+    uint32_t space[2];
+    BIGNUM y = bigView(val, space);
+    uint32_t longer = acc->count > y.count ? acc->count : y.count;
+    bigAccReserve(acc, longer + 1);
+
+    if (acc->negative == y.negative)
+    {
+        if (acc->count >= y.count)
+        {
+            magAdd(acc->limbs, acc->limbs, acc->count, y.limbs, y.count);
+        }
+        else
+        {
+            magAdd(acc->limbs, y.limbs, y.count, acc->limbs, acc->count);
+        }
+        acc->count = trim(acc->limbs, longer + 1);
+    }
+    else if (magCompare(acc->limbs, acc->count, y.limbs, y.count) >= 0)
+    {
+        magSub(acc->limbs, acc->limbs, acc->count, y.limbs, y.count);
+        acc->count = trim(acc->limbs, acc->count);
+    }
+    else
+    {
+        magSub(acc->limbs, y.limbs, y.count, acc->limbs, acc->count);
+        acc->count = trim(acc->limbs, y.count);
+        acc->negative = y.negative;
+    }
+    acc->negative &= acc->count > 0;
+}
+
+bool bigAccMult(BIGNUM *acc, RET_VAL val)
+{
+    uint32_t space[2];
+    BIGNUM y = bigView(val, space);
+    if (y.count == 0 || acc->count + y.count > BIG_MAX_LIMBS)
+    {
+        return false;
+    }
+
+    uint32_t capacity;
+    uint32_t *product = poolTake(acc->count + y.count, &capacity);
+    magMul(product, acc->limbs, acc->count, y.limbs, y.count);
+    poolGive(acc->limbs, acc->capacity);
+    acc->limbs = product;
+    acc->capacity = capacity;
+    acc->count = trim(product, acc->count + y.count);
+    acc->negative ^= y.negative;
+    return true;
+}
+
+RET_VAL bigAccFinish(BIGNUM *acc)
+{
+    RET_VAL result = bigResult(acc->negative, acc->limbs, acc->count);
+    poolGive(acc->limbs, acc->capacity);
+    return result;
+}
+
+double bigAccDouble(BIGNUM *acc)
+{
+    double magnitude = magToDouble(acc->limbs, acc->count);
+    poolGive(acc->limbs, acc->capacity);
+    return acc->negative ? -magnitude : magnitude;
+}
@@ -0,0 +1,84 @@
+#!/bin/bash
+# Checks that engine and pass flags never change what a program prints.
+# Build first with "run", then:
+# ./check.sh [-r "reference flags"] "flags"... [-- programs...]
+# Each program, every one under INPUTS by default plus the cases below,
+# is run with the reference flags (none by default) and with each set of
+# flags given, and the outputs, warnings included, must match line for
+# line. A set with --emit-c compiles the program to C with the rest of
+# its flags, builds that with gcc -O3 -Wall -Werror and runs it. The sign
+# of a nan is not compared: gcc inlines fmod at -O2 and above, and the
+# inlined one can give the other sign, as two interpreter builds at
+# different optimisation levels already do. Exits non-zero on any
+# difference. emitcheck.sh, infercheck.sh and jitcheck.sh run it with
+# the flags for --emit-c, type inference and the JIT.
+
+set -o pipefail
+
+REFERENCE=
+if [ "$1" = -r ]; then
+    REFERENCE=$2
+    shift 2
+fi
+FLAGS=()
+while [ $# -gt 0 ] && [ "$1" != -- ]; do
+    FLAGS+=("$1")
+    shift
+done
+shift
+
+WORK=$(mktemp -d)
+
+# bindings defined in terms of themselves are dynamic, whatever their cast
+cat > "$WORK/self.cilisp" <<'END'
+((let (int a a)) (pow a 0))
+((let (double a a)) (add a 1))
+((let (int a (add a 1))) (mult a 2))
+((let (int a b) (b a)) (div a 1))
+quit
+END
+
+# tail calls carrying INTs beyond 48 bits, which --emit-c compiles to
+# nested functions that jump back to their start
+cat > "$WORK/tail.cilisp" <<'END'
+((let (loop lambda (n acc) (cond (equal n 0) acc (loop (sub n 1) (add acc 1))))) (loop 3000000 1000000000000000))
+((let (swap lambda (n a b) (cond (equal n 0) (sub a b) (swap (sub n 1) b a)))) (swap 11 1000000000000001 2000000000000003))
+((let (sq lambda (x) (mult x 2)) (loop lambda (n acc) (cond (equal n 0) acc ((let (x (add acc (sq n)))) (loop (sub n 1) x))))) (loop 100000 1000000000000000))
+((let (even lambda (n a) (cond (equal n 0) a (odd (sub n 1) (add a 3)))) (odd lambda (n a) (cond (equal n 0) (neg a) (even (sub n 1) (mult a 1))))) (even 1001 140737488355328))
+quit
+END
+
+PROGRAMS=${*:-"$(find INPUTS -name '*.cilisp' | sort) $WORK/self.cilisp $WORK/tail.cilisp"}
+
+# run flags program: what the program prints, on stdout and stderr
+run()
+{
+    case " $1 " in
+        *" --emit-c "*)
+            ./cilisp $1 "$2" < /dev/null > "$WORK/t.c" 2> /dev/null \
+                && gcc -O3 -Wall -Werror "$WORK/t.c" -lm -o "$WORK/t" \
+                && "$WORK/t" 2>&1
+            ;;
+        *)
+            ./cilisp $1 "$2" < /dev/null 2>&1
+            ;;
+    esac
+}
+
+status=0
+for program in $PROGRAMS; do
+    run "$REFERENCE" "$program" | sed 's/-nan/nan/g' > "$WORK/want"
+    for flags in "${FLAGS[@]}"; do
+        if run "$flags" "$program" | sed 's/-nan/nan/g' > "$WORK/got" \
+            && diff "$WORK/want" "$WORK/got" > "$WORK/diff"; then
+            echo "ok      $flags $program"
+            continue
+        fi
+        echo "FAILED  $flags $program"
+        head -20 "$WORK/diff"
+        status=1
+    done
+done
+
+rm -rf "$WORK"
+exit $status
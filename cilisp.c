@@ -1,9 +1,28 @@
 #include "cilisp.h"
 #include <math.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #define RED             "\033[31m"
 #define RESET_COLOR     "\033[0m"
 
+FILE* read_target;
+FILE* flex_bison_log_file;
+
+CILISP_OPTIONS options = {
+    .engine = VM_ENGINE,
+    .jit = JIT_AUTO,
+    .emitC = false,
+    .fold = true,
+    .prune = true,
+    .infer = true,
+    .dumpAst = false,
+    .hexDoubles = false,
+    .math = &libmMath,
+    .memoSize = 1 << 16
+};
+
 
 // yyerror:
 // Something went so wrong that the whole program should crash.
@@ -19,8 +38,13 @@ void yyerror(char *format, ...)
     va_start (args, format);
     vsnprintf (buffer, 255, format, args);
 
-    printf(RED "\nERROR: %s\nExiting...\n" RESET_COLOR, buffer);
-    fflush(stdout);
+    if (options.emitC) {
+        // the compiled program reports the error when it gets this far
+        emitCError(buffer);
+    } else {
+        printf(RED "\nERROR: %s\nExiting...\n" RESET_COLOR, buffer);
+        fflush(stdout);
+    }
 
     va_end (args);
     exit(1);
@@ -36,184 +60,601 @@ void yyerror(char *format, ...)
 //      invalid arguments, let them know and return NAN
 //      many more uses to be added as we progress...
 // This is basically printf, but red, and with "\nWARNING: " prepended and "\n" appended.
+size_t warningCount = 0;
+
 void warning(char *format, ...)
 {
     char buffer[256];
+    warningCount++;
     va_list args;
     va_start (args, format);
     vsnprintf (buffer, 255, format, args);
 
-    printf(RED "WARNING: %s\n" RESET_COLOR, buffer);
-    fflush(stdout);
+    if (options.emitC) {
+        emitCWarning(buffer);
+    } else {
+        printf(RED "WARNING: %s\n" RESET_COLOR, buffer);
+        fflush(stdout);
+    }
 
     va_end (args);
 }
 
-void setParent(AST_NODE *list, AST_NODE *parent) {
-    while(list != NULL) {
-        list->parent = parent;
-        list = list->next;
+// Arena for the small things built for one top-level program: let
+// lists being parsed, scope indexes and compiler messages. Allocation
+// is a pointer bump; arenaReset rewinds to the first block in O(1) and
+// keeps the blocks around for the next program.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} ARENA_BLOCK;
+
+static struct {
+    ARENA_BLOCK *head;
+    ARENA_BLOCK *current;
+    size_t bytes;           // bytes handed out since the last reset
+    size_t allocations;     // allocations since the last reset
+    size_t highWater;       // largest single program seen
+} arena;
+
+void *arenaAlloc(size_t size)
+{
+    ARENA_BLOCK *block = arena.current;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    // move along the retained blocks until one fits, appending a new one at the end
+    while (block == NULL || block->used + size > block->size)
+    {
+        if (block != NULL && block->next != NULL)
+        {
+            block = block->next;
+            block->used = 0;
+            continue;
+        }
+
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ARENA_BLOCK *fresh;
+        if ((fresh = malloc(sizeof(ARENA_BLOCK) + blockSize)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        fresh->next = NULL;
+        fresh->size = blockSize;
+        fresh->used = 0;
+        if (block == NULL)
+        {
+            arena.head = fresh;
+        }
+        else
+        {
+            // splice in after the current block so retained blocks are kept
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        block = fresh;
+    }
+    arena.current = block;
+
+    void *mem = (char *) block->data + block->used;
+    block->used += size;
+    arena.bytes += size;
+    arena.allocations++;
+
+    memset(mem, 0, size);
+    return mem;
+}
+
+char *arenaStrdup(char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arenaAlloc(len);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+// Releases everything allocated for the current program and logs how much it took.
+void arenaReset(void)
+{
+    if (arena.bytes > arena.highWater)
+    {
+        arena.highWater = arena.bytes;
+    }
+    if (flex_bison_log_file != NULL)
+    {
+        fprintf(flex_bison_log_file, "ARENA: %zu bytes in %zu allocations (high water %zu bytes)\n",
+                arena.bytes, arena.allocations, arena.highWater);
+        fflush(flex_bison_log_file);
+    }
+
+    arena.current = arena.head;
+    if (arena.head != NULL)
+    {
+        arena.head->used = 0;
+    }
+    arena.bytes = 0;
+    arena.allocations = 0;
+}
+
+// Where the arena is up to. Rewinding to a mark drops everything
+// allocated since, keeping the blocks, as arenaReset does.
+typedef struct {
+    ARENA_BLOCK *block;
+    size_t used;
+    size_t bytes;
+    size_t allocations;
+} ARENA_MARK;
+
+static ARENA_MARK arenaMark(void)
+{
+    return (ARENA_MARK) { arena.current, arena.current != NULL ? arena.current->used : 0, arena.bytes, arena.allocations };
+}
+
+static void arenaRewind(ARENA_MARK mark)
+{
+    arena.current = mark.block != NULL ? mark.block : arena.head;
+    if (arena.current != NULL)
+    {
+        arena.current->used = mark.used;
+    }
+    arena.bytes = mark.bytes;
+    arena.allocations = mark.allocations;
+}
+
+// Slow path of makeRetVal: the number goes in the arena and the
+// RET_VAL points at it, so it lives until the program is done.
+RET_VAL boxRetVal(NUM_TYPE type, double value)
+{
+    AST_NUMBER *box = arenaAlloc(sizeof(AST_NUMBER));
+    box->type = type;
+    box->value = value;
+    return RET_BOX_TAG | ((uint64_t) (uintptr_t) box & RET_PAYLOAD);
+}
+
+// Slow path of retFromInt, for integers that need more than 48 bits.
+RET_VAL boxInt64(int64_t value)
+{
+    int64_t *box = arenaAlloc(sizeof(int64_t));
+    *box = value;
+    return RET_INT64_TAG | ((uint64_t) (uintptr_t) box & RET_PAYLOAD);
+}
+
+// The INT an integer literal stands for. Literals beyond int64 are read
+// into bignums, and -0 is kept as a double, as all INTs used to be.
+RET_VAL intLiteral(char *text)
+{
+    errno = 0;
+    long long value = strtoll(text, NULL, 10);
+    if (errno == ERANGE)
+    {
+        return bigLiteral(text);
+    }
+    if (value == 0 && text[0] == '-')
+    {
+        return retInt(strtod(text, NULL));
+    }
+    return retFromInt(value);
+}
+
+// Intern table shared by the lexer, parser and evaluator.
+// Each distinct identifier is copied once into a string pool that lives
+// as long as the process, and is known everywhere else by its SYMBOL_ID,
+// its position in names (0 is never handed out). Lookups go through an
+// open-addressing table of ids kept at most half full. The lock lets
+// several parsers intern concurrently.
+#define INTERN_POOL_SIZE (64 * 1024)
+
+static struct {
+    pthread_mutex_t lock;
+    char **names;           // indexed by SYMBOL_ID
+    uint32_t *hashes;
+    size_t count;
+    size_t capacity;
+    SYMBOL_ID *buckets;     // 0 marks an empty bucket
+    size_t bucketCount;
+    char *pool;             // free space in the current pool block
+    size_t poolLeft;
+} interned = { .lock = PTHREAD_MUTEX_INITIALIZER, .count = 1 };
+
+// FNV-1a over the name
+static uint32_t hashName(char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void internBucket(SYMBOL_ID id)
+{
+    size_t bucket = interned.hashes[id] & (interned.bucketCount - 1);
+    while (interned.buckets[bucket] != 0)
+    {
+        bucket = (bucket + 1) & (interned.bucketCount - 1);
     }
+    interned.buckets[bucket] = id;
 }
 
-SYMBOL_TABLE_NODE *findSymbol(char *id, SYMBOL_TABLE_NODE *symbolTable) {
-    if(id == NULL) {
-        return NULL;
+// Makes room for one more name, doubling the id arrays and the buckets as needed.
+static void growInterned(void)
+{
+    if (interned.count >= interned.capacity)
+    {
+        interned.capacity = interned.capacity ? 2 * interned.capacity : 256;
+        if ((interned.names = realloc(interned.names, interned.capacity * sizeof(char *))) == NULL
+            || (interned.hashes = realloc(interned.hashes, interned.capacity * sizeof(uint32_t))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
     }
-    SYMBOL_TABLE_NODE *current = symbolTable;
 
-    while (current != NULL) {
-        if(strcmp(id, symbolTable->id) == 0) {
-            return current;
+    if (2 * interned.count >= interned.bucketCount)
+    {
+        interned.bucketCount = interned.bucketCount ? 2 * interned.bucketCount : 512;
+        free(interned.buckets);
+        if ((interned.buckets = calloc(interned.bucketCount, sizeof(SYMBOL_ID))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        for (SYMBOL_ID id = 1; id < interned.count; id++)
+        {
+            internBucket(id);
         }
-        current = current->next;
     }
-    return NULL;
 }
 
-FUNC_TYPE resolveFunc(char *funcName)
+static char *poolCopy(char *name, size_t length)
 {
-    // Array of string values for function names.
-    // Must be in sync with members of the FUNC_TYPE enum in order for resolveFunc to work.
-    // For example, funcNames[NEG_FUNC] should be "neg"
-    char *funcNames[] = {
-            "neg",
-            "abs",
-            "add",
-            "sub",
-            "mult",
-            "div",
-            "remainder",
-            "exp",
-            "exp2",
-            "pow",
-            "log",
-            "sqrt",
-            "cbrt",
-            "hypot",
-            "max",
-            "min",
-            ""
-    };
-    int i = 0;
-    while (funcNames[i][0] != '\0')
+    if (interned.poolLeft < length + 1)
     {
-        if (strcmp(funcNames[i], funcName) == 0)
+        interned.poolLeft = length + 1 > INTERN_POOL_SIZE ? length + 1 : INTERN_POOL_SIZE;
+        if ((interned.pool = malloc(interned.poolLeft)) == NULL)
         {
-            return i;
+            yyerror("Memory allocation failed!");
         }
-        i++;
     }
-    return CUSTOM_FUNC;
+
+    char *copy = interned.pool;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    interned.pool += length + 1;
+    interned.poolLeft -= length + 1;
+    return copy;
 }
 
-AST_NODE *createNumberNode(double value, NUM_TYPE type)
+// Returns the handle for the first length bytes of name, adding it on first sight.
+SYMBOL_ID internSymbol(char *name, size_t length)
 {
-    AST_NODE *node;
-    size_t nodeSize;
+    uint32_t hash = hashName(name, length);
 
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    pthread_mutex_lock(&interned.lock);
+    growInterned();
+
+    size_t bucket = hash & (interned.bucketCount - 1);
+    SYMBOL_ID id;
+    while ((id = interned.buckets[bucket]) != 0)
     {
-        yyerror("Memory allocation failed!");
-        exit(1);
+        if (interned.hashes[id] == hash && strncmp(interned.names[id], name, length) == 0
+            && interned.names[id][length] == '\0')
+        {
+            pthread_mutex_unlock(&interned.lock);
+            return id;
+        }
+        bucket = (bucket + 1) & (interned.bucketCount - 1);
     }
-    // Populate "node", the AST_NODE * created above with the argument data.
-    node->data.number.value = value;
-    node->data.number.type = type;
-    node->type = NUM_NODE_TYPE;
-    // node is a generic AST_NODE, don't forget to specify it is of type NUMBER_NODE
-    return node;
+
+    id = (SYMBOL_ID) interned.count++;
+    interned.names[id] = poolCopy(name, length);
+    interned.hashes[id] = hash;
+    interned.buckets[bucket] = id;
+
+    pthread_mutex_unlock(&interned.lock);
+    return id;
 }
 
-// Creates a node with id
-AST_NODE *createSymbolNode(char *id){
-    AST_NODE *node;
-    size_t nodeSize;
+char *symbolName(SYMBOL_ID id)
+{
+    pthread_mutex_lock(&interned.lock);
+    char *name = id > 0 && id < interned.count ? interned.names[id] : "";
+    pthread_mutex_unlock(&interned.lock);
+    return name;
+}
 
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+AST ast = { .count = 1 };
+
+#define AST_GROW(array, count, capacity, extra) \
+    if ((count) + (extra) > (capacity)) { \
+        (capacity) = 2 * ((count) + (extra)); \
+        if (((array) = realloc((array), (capacity) * sizeof(*(array)))) == NULL) \
+            yyerror("Memory allocation failed!"); \
+    }
+
+// Appends a node of the given type; the caller fills in NODE(id).
+AST_ID newNode(AST_NODE_TYPE type) {
+    if (ast.count >= ast.capacity) {
+        ast.capacity = ast.capacity ? 2 * ast.capacity : 1024;
+        if ((ast.types = realloc(ast.types, ast.capacity * sizeof(uint8_t))) == NULL
+            || (ast.numTypes = realloc(ast.numTypes, ast.capacity * sizeof(uint8_t))) == NULL
+            || (ast.depths = realloc(ast.depths, ast.capacity * sizeof(uint32_t))) == NULL
+            || (ast.data = realloc(ast.data, ast.capacity * sizeof(AST_DATA))) == NULL) {
+            yyerror("Memory allocation failed!");
+        }
+    }
+    ast.types[ast.count] = (uint8_t) type;
+    ast.numTypes[ast.count] = NO_TYPE;
+    ast.depths[ast.count] = 1;
+    return (AST_ID) ast.count++;
+}
+
+// Spreads consecutive SYMBOL_IDs over a scope's index buckets.
+static uint32_t hashSymbol(SYMBOL_ID id) {
+    return id * 2654435761u;
+}
+
+// Position of id among a table's or scope's bindings, or -1.
+// Narrow tables (no index) are scanned; wide ones are probed.
+long lookupSlot(SYMBOL_TABLE_NODE *items, size_t count, uint32_t *index, size_t indexSize, SYMBOL_ID id) {
+    if(index == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            if(items[i].id == id) {
+                return (long) i;
+            }
+        }
+        return -1;
+    }
+
+    for (size_t bucket = hashSymbol(id) & (indexSize - 1); index[bucket] != 0; bucket = (bucket + 1) & (indexSize - 1)) {
+        if(items[index[bucket] - 1].id == id) {
+            return (long) index[bucket] - 1;
+        }
+    }
+    return -1;
+}
+
+void indexSymbol(SYMBOL_TABLE *table, size_t position) {
+    size_t bucket = hashSymbol(ast.pendingBindings[table->start + position].id) & (table->indexSize - 1);
+    while (table->index[bucket] != 0) {
+        bucket = (bucket + 1) & (table->indexSize - 1);
+    }
+    table->index[bucket] = (uint32_t) position + 1;
+}
+
+// Keeps a wide table's index at most half full, rebuilding it at twice
+// the size when it fills up. Old indexes stay in the arena.
+void growSymbolIndex(SYMBOL_TABLE *table) {
+    if(table->count <= SCOPE_HASH_THRESHOLD || 2 * table->count <= table->indexSize) {
+        return;
+    }
+
+    size_t size = table->indexSize ? 2 * table->indexSize : 4 * SCOPE_HASH_THRESHOLD;
+    if ((table->index = arenaAlloc(size * sizeof(uint32_t))) == NULL)
     {
         yyerror("Memory allocation failed!");
         exit(1);
     }
+    table->indexSize = size;
+    for (size_t i = 0; i < table->count; i++) {
+        indexSymbol(table, i);
+    }
+}
 
-    node->type = SYM_NODE_TYPE;
-    node->data.symbol.id = malloc(sizeof(id) + 1);
-    strcpy(node->data.symbol.id, id);
+SYMBOL_TABLE_NODE *findSymbol(SYMBOL_ID id, SYMBOL_TABLE *symbolTable) {
+    SYMBOL_TABLE_NODE *items = ast.pendingBindings + symbolTable->start;
+    long slot = lookupSlot(items, symbolTable->count, symbolTable->index, symbolTable->indexSize, id);
+    return slot < 0 ? NULL : &items[slot];
+}
 
-    return node;
+// Array of string values for function names.
+// Must be in sync with members of the FUNC_TYPE enum in order for resolveFunc to work.
+// For example, funcNames[NEG_FUNC] should be "neg"
+static char *funcNames[] = {
+    "neg",
+    "abs",
+    "add",
+    "sub",
+    "mult",
+    "div",
+    "remainder",
+    "exp",
+    "exp2",
+    "pow",
+    "log",
+    "sqrt",
+    "cbrt",
+    "hypot",
+    "max",
+    "min",
+    "less",
+    "greater",
+    "equal",
+    "cond",
+    "and",
+    "or",
+    "vec",
+    ""
+};
+
+char *funcName(FUNC_TYPE func)
+{
+    return func < CUSTOM_FUNC ? funcNames[func] : "custom";
 }
 
-AST_NODE *createScopeNode(SYMBOL_TABLE_NODE *symbolTable, AST_NODE *child){
-    AST_NODE *node;
-    size_t nodeSize;
+// True if a call with count operands evaluates without printing a
+// warning of its own: its operands may still warn.
+bool callIsSilent(FUNC_TYPE func, size_t count)
+{
+    switch (func)
+    {
+        case NEG_FUNC:
+        case ABS_FUNC:
+        case EXP_FUNC:
+        case EXP2_FUNC:
+        case LOG_FUNC:
+        case SQRT_FUNC:
+        case CBRT_FUNC:
+            return count == 1;
+        case SUB_FUNC:
+        case DIV_FUNC:
+        case REMAINDER_FUNC:
+        case POW_FUNC:
+        case LESS_FUNC:
+        case GREATER_FUNC:
+        case EQUAL_FUNC:
+            return count == 2;
+        case COND_FUNC:
+            return count == 3;
+        case ADD_FUNC:
+        case MULT_FUNC:
+        case HYPOT_FUNC:
+        case MIN_FUNC:
+        case MAX_FUNC:
+            return count >= 1;
+        case AND_FUNC:
+        case OR_FUNC:
+        case VEC_FUNC:
+            return true;
+        default:
+            return false;
+    }
+}
 
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+// True if the program makes vectors: it calls vec, or has a vector that
+// folding made of a call of it.
+bool astMakesVectors(void)
+{
+    for (AST_ID node = 1; node < ast.count; node++)
     {
-        yyerror("Memory allocation failed!");
-        exit(1);
+        if (NODE_TYPE(node) == NUM_NODE_TYPE ? retIsVector(NODE(node).number)
+            : NODE_TYPE(node) == FUNC_NODE_TYPE && NODE(node).function.func == VEC_FUNC)
+        {
+            return true;
+        }
     }
+    return false;
+}
 
-    node->type = SCOPE_NODE_TYPE;
-    node->data.scope.child = child;
-    node->symbolTable = symbolTable;
-    while(symbolTable != NULL) {
-        setParent(symbolTable->value, node);
-        symbolTable = symbolTable->next;
+FUNC_TYPE resolveFunc(char *funcName)
+{
+    int i = 0;
+    while (funcNames[i][0] != '\0')
+    {
+        if (strcmp(funcNames[i], funcName) == 0)
+        {
+            return i;
+        }
+        i++;
     }
-    setParent(child, node);
+    return CUSTOM_FUNC;
+}
+
+AST_ID createNumberNode(double value, NUM_TYPE type)
+{
+    AST_ID node = newNode(NUM_NODE_TYPE);
+    NODE(node).number = makeRetVal(type, value);
+    return node;
+}
 
+// Creates a node for an INT literal, as intLiteral read it
+AST_ID createIntNode(RET_VAL value)
+{
+    AST_ID node = newNode(NUM_NODE_TYPE);
+    NODE(node).number = value;
+    return node;
+}
 
+// Creates a node with id
+AST_ID createSymbolNode(SYMBOL_ID id){
+    AST_ID node = newNode(SYM_NODE_TYPE);
+    NODE(node).symbol.id = id;
+    NODE(node).symbol.depth = -1;
+    NODE(node).symbol.slot = 0;
+    NODE(node).symbol.lambda = 0;
     return node;
+}
+
+// Moves the finished let list off the pending stacks into ast.bindings
+// and ast.lambdas. A reference can lead the passes through one binding's
+// value into the next, so the scope's depth counts all of them.
+AST_ID createScopeNode(SYMBOL_TABLE *symbolTable, AST_ID child){
+    uint32_t depth = 1 + ast.depths[child];
+    for (size_t i = 0; i < symbolTable->count; i++) {
+        depth += ast.depths[ast.pendingBindings[symbolTable->start + i].value];
+    }
+    for (size_t i = 0; i < symbolTable->lambdaCount; i++) {
+        depth += ast.depths[ast.pendingLambdas[symbolTable->lambdaStart + i].params];
+    }
 
+    AST_GROW(ast.scopes, ast.scopeCount, ast.scopeCapacity, 1);
+    AST_GROW(ast.bindings, ast.bindingCount, ast.bindingCapacity, symbolTable->count);
+    AST_GROW(ast.lambdas, ast.lambdaCount, ast.lambdaCapacity, symbolTable->lambdaCount);
+
+    AST_SCOPE *scope = &ast.scopes[ast.scopeCount];
+    scope->child = child;
+    scope->outer = 0;
+    scope->firstSlot = (uint32_t) ast.bindingCount;
+    scope->slotCount = (int) symbolTable->count;
+    scope->index = symbolTable->index;
+    scope->indexSize = symbolTable->indexSize;
+
+    memcpy(ast.bindings + ast.bindingCount, ast.pendingBindings + symbolTable->start,
+           symbolTable->count * sizeof(SYMBOL_TABLE_NODE));
+    ast.bindingCount += symbolTable->count;
+    ast.pendingBindingCount = symbolTable->start;
+
+    scope->firstLambda = (uint32_t) ast.lambdaCount;
+    scope->lambdaCount = (int) symbolTable->lambdaCount;
+    scope->lambda = -1;
+    for (size_t i = 0; i < symbolTable->lambdaCount; i++) {
+        ast.lambdas[ast.lambdaCount] = ast.pendingLambdas[symbolTable->lambdaStart + i];
+        NODE_SCOPE(ast.lambdas[ast.lambdaCount].params)->lambda = (int) ast.lambdaCount;
+        ast.lambdaCount++;
+    }
+    ast.pendingLambdaCount = symbolTable->lambdaStart;
+
+    AST_ID node = newNode(SCOPE_NODE_TYPE);
+    NODE(node).scope = (uint32_t) ast.scopeCount++;
+    ast.depths[node] = depth;
+    return node;
 }
 
-SYMBOL_TABLE_NODE *createSymbol(char *id, AST_NODE *value) {
+SYMBOL_TABLE_NODE *createSymbol(SYMBOL_ID id, AST_ID value) {
     SYMBOL_TABLE_NODE *node;
     size_t nodeSize;
 
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    nodeSize = sizeof(SYMBOL_TABLE_NODE);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
     {
         yyerror("Memory allocation failed!");
         exit(1);
     }
 
-    if(id != NULL) {
-        node->id = strdup(id);
-        free(id);
-    }
-    else
-        node->id = NULL;
+    node->id = id;
     node->value = value;
-    node->next = NULL;
 
     node->type = NO_TYPE;
 
     return node;
 }
 
-SYMBOL_TABLE_NODE *createTypedSymbol(char *id, AST_NODE *value, bool type) {
+SYMBOL_TABLE_NODE *createTypedSymbol(SYMBOL_ID id, AST_ID value, bool type) {
     SYMBOL_TABLE_NODE *node;
     size_t nodeSize;
 
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    nodeSize = sizeof(SYMBOL_TABLE_NODE);
+    if ((node = arenaAlloc(nodeSize)) == NULL)
     {
         yyerror("Memory allocation failed!");
         exit(1);
     }
 
-    if(id != NULL) {
-        node->id = strdup(id);
-        free(id);
-    }
-    else
-        node->id = NULL;
+    node->id = id;
     node->value = value;
-    node->next = NULL;
 
     if (type) {
         node->type = INT_TYPE;
@@ -225,570 +666,1962 @@ SYMBOL_TABLE_NODE *createTypedSymbol(char *id, AST_NODE *value, bool type) {
     return node;
 }
 
-SYMBOL_TABLE_NODE *addSymbolToTable(SYMBOL_TABLE_NODE *new, SYMBOL_TABLE_NODE *table) {
-    if(new != NULL) {
-        SYMBOL_TABLE_NODE *old = findSymbol(new->id, table);
-        if(old != NULL) {
-            warning("Duplicate assignment to symbol");
-            free(new->id);
-            free(old->value);
-            old->value = new->value;
-            return table;
-        }
-        new->next = table;
+// A let element binding a function; params is the scope node of its
+// parameters, whose child is the body.
+AST_LAMBDA *createLambda(SYMBOL_ID id, AST_ID params, NUM_TYPE type, bool memo) {
+    AST_LAMBDA *lambda;
+
+    if ((lambda = arenaAlloc(sizeof(AST_LAMBDA))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+        exit(1);
     }
-    return new;
+    lambda->id = id;
+    lambda->type = type;
+    lambda->params = params;
+    lambda->captures = NULL;
+    lambda->captureCount = 0;
+    lambda->captureCapacity = 0;
+    lambda->memo = memo;
+    return lambda;
 }
 
-AST_NODE *createFunctionNode(FUNC_TYPE func, AST_NODE *opList)
-{
-    AST_NODE *node;
-    size_t nodeSize;
+SYMBOL_TABLE *createSymbolTable(SYMBOL_TABLE_NODE *symbol) {
+    SYMBOL_TABLE *table;
 
-    nodeSize = sizeof(AST_NODE);
-    if ((node = calloc(nodeSize, 1)) == NULL)
+    if ((table = arenaAlloc(sizeof(SYMBOL_TABLE))) == NULL)
     {
         yyerror("Memory allocation failed!");
         exit(1);
     }
-    // Populate the allocated AST_NODE *node's data
-    node->type = FUNC_NODE_TYPE;
-    node->data.function.func = func;
-    if(opList != NULL) {
-        node->data.function.opList = opList;
-    }
-    node->next = NULL;
-    setParent(opList, node);
-    return node;
+    table->start = ast.pendingBindingCount;
+    table->count = 0;
+    table->index = NULL;
+    table->indexSize = 0;
+    table->lambdaStart = ast.pendingLambdaCount;
+    table->lambdaCount = 0;
+
+    return addSymbolToTable(table, symbol);
 }
 
-AST_NODE *addExpressionToList(AST_NODE *newExpr, AST_NODE *exprList)
-{
-    newExpr->next = exprList;
-    return newExpr;
+// Functions have a name space of their own, so a function and a
+// variable can share a name. A duplicate function keeps the earlier one.
+SYMBOL_TABLE *addLambdaToTable(SYMBOL_TABLE *table, AST_LAMBDA *new) {
+    for (size_t i = 0; i < table->lambdaCount; i++) {
+        if (ast.pendingLambdas[table->lambdaStart + i].id == new->id) {
+            warning("Duplicate assignment to function %s", symbolName(new->id));
+            return table;
+        }
+    }
+    AST_GROW(ast.pendingLambdas, ast.pendingLambdaCount, ast.pendingLambdaCapacity, 1);
+    ast.pendingLambdas[ast.pendingLambdaCount++] = *new;
+    table->lambdaCount++;
+    return table;
 }
 
-RET_VAL evalNeg(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    if(oplist == NULL) {
-        warning("neg called with no operands, NAN returned");
-        return NAN_RET_VAL;
-    }
-    if(oplist->next != NULL) {
-        warning("neg called with extra operands");
+// Bindings arrive in source order. A duplicate keeps the slot's
+// earlier value and takes the later binding's type cast.
+SYMBOL_TABLE *addSymbolToTable(SYMBOL_TABLE *table, SYMBOL_TABLE_NODE *new) {
+    if(new != NULL) {
+        SYMBOL_TABLE_NODE *old = findSymbol(new->id, table);
+        if(old != NULL) {
+            warning("Duplicate assignment to symbol");
+            old->type = new->type;
+            return table;
+        }
+        AST_GROW(ast.pendingBindings, ast.pendingBindingCount, ast.pendingBindingCapacity, 1);
+        ast.pendingBindings[ast.pendingBindingCount++] = *new;
+        table->count++;
+        if(table->index != NULL && 2 * table->count <= table->indexSize) {
+            indexSymbol(table, table->count - 1);
+        } else {
+            growSymbolIndex(table);
+        }
     }
-
-    num = eval(oplist);
-
-    result.type = num.type;
-    result.value = -(num.value);
-    return result;
+    return table;
 }
 
-RET_VAL evalAdd(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    result.value = 0;
-
-    bool trackDouble = false;
+#define CALL_INDEX_MIN 1024
 
-    if(oplist == NULL) {
-        warning("add called with no operands, 0 returned");
-        return ZERO_RET_VAL;
+// Numbers and symbols are compared by value, so that they never need
+// an index of their own; other operands by node.
+static uint64_t hashOperand(AST_ID op) {
+    switch (NODE_TYPE(op)) {
+        case NUM_NODE_TYPE:
+            return NODE(op).number;
+        case SYM_NODE_TYPE:
+            return ((uint64_t) SYM_NODE_TYPE << 32) | NODE(op).symbol.id;
+        default:
+            return ((uint64_t) FUNC_NODE_TYPE << 32) | op;
     }
+}
 
-    while(oplist != NULL) {
-        num = eval(oplist);
-        result.type = num.type; // wrong type
-        if (num.type == DOUBLE_TYPE) {
-            trackDouble = true;
-        }
-        result.value += num.value;
-        oplist = oplist->next;
+static bool sameOperand(AST_ID a, AST_ID b) {
+    if (a == b) {
+        return true;
     }
-
-    if (trackDouble) {
-        result.type = DOUBLE_TYPE;
+    if (NODE_TYPE(a) != NODE_TYPE(b)) {
+        return false;
     }
-
-    return result;
+    if (NODE_TYPE(a) == NUM_NODE_TYPE) {
+        return NODE(a).number == NODE(b).number;
+    }
+    return NODE_TYPE(a) == SYM_NODE_TYPE && NODE(a).symbol.id == NODE(b).symbol.id;
 }
 
-RET_VAL evalAbs(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    if(oplist == NULL) {
-        warning("abs called with no operands, NAN returned");
-        return NAN_RET_VAL;
+static uint64_t hashCall(FUNC_TYPE func, AST_ID *ops, size_t count) {
+    uint64_t hash = 14695981039346656037ULL ^ func;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t word = hashOperand(ops[i]);
+        hash = (hash ^ word ^ (word >> 32)) * 1099511628211ULL;
     }
+    return hash ^ (hash >> 32);
+}
 
-    if(oplist->next != NULL) {
-        warning("abs called with extra operands");
+// Bucket of the node matching the call, or of the empty bucket it would go in.
+static size_t findCall(uint64_t hash, FUNC_TYPE func, AST_ID *ops, size_t count) {
+    size_t bucket = hash & (ast.callIndexSize - 1);
+    for (AST_ID node; (node = ast.callIndex[bucket]) != 0; bucket = (bucket + 1) & (ast.callIndexSize - 1)) {
+        if (NODE(node).function.func != func || NODE(node).function.count != count) {
+            continue;
+        }
+        size_t i = 0;
+        while (i < count && sameOperand(NODE_OPS(node)[i], ops[i])) {
+            i++;
+        }
+        if (i == count) {
+            break;
+        }
     }
-
-    num = eval(oplist);
-
-    result.type = num.type;
-    result.value = fabs(num.value);
-
-    return result;
-
+    return bucket;
 }
 
-RET_VAL evalSub(AST_NODE *oplist) {
-    RET_VAL result;
-    result.value = 0;
-
-    if(oplist == NULL) {
-        warning("sub called with no operands, 0 returned");
-        return ZERO_RET_VAL;
-    } else if(oplist->next == NULL) {
-        warning("sub called with 1 operand, NAN returned");
-        return NAN_RET_VAL;
+// Keeps the call index at most half full.
+static void growCallIndex(void) {
+    if (2 * (ast.callCount + 1) <= ast.callIndexSize) {
+        return;
     }
 
-    RET_VAL firstOp = eval(oplist);
-    RET_VAL secondOP = eval(oplist->next);
-
-    if(oplist->next->next != NULL){
-        warning("sub called with too many operands, ignoring extra");
+    AST_ID *old = ast.callIndex;
+    size_t oldSize = ast.callIndexSize;
+    ast.callIndexSize = oldSize ? 2 * oldSize : CALL_INDEX_MIN;
+    if ((ast.callIndex = calloc(ast.callIndexSize, sizeof(AST_ID))) == NULL) {
+        yyerror("Memory allocation failed!");
     }
-
-    if(firstOp.type == DOUBLE_TYPE || secondOP.type == DOUBLE_TYPE)
-        result.type = DOUBLE_TYPE;
-    else
-        result.type = INT_TYPE;
-
-    result.value = firstOp.value - secondOP.value;
-
-    return result;
+    for (size_t i = 0; i < oldSize; i++) {
+        AST_ID node = old[i];
+        if (node != 0) {
+            size_t bucket = hashCall(NODE(node).function.func, NODE_OPS(node), NODE(node).function.count)
+                            & (ast.callIndexSize - 1);
+            while (ast.callIndex[bucket] != 0) {
+                bucket = (bucket + 1) & (ast.callIndexSize - 1);
+            }
+            ast.callIndex[bucket] = node;
+        }
+    }
+    free(old);
 }
 
-RET_VAL evalMult(AST_NODE *oplist){
-    RET_VAL num;
-    RET_VAL result;
-    result.value = 1;
-
-    bool trackDouble = false;
-
-    if(oplist == NULL) {
-        warning("mult called with no operands, 0 returned");
-        return ZERO_RET_VAL;
+// Moves the operands from opList up off the pending stack into ast.children.
+// A call that warns or is custom is always a new node. Any other call
+// that repeats one made earlier in the program (same function, operands
+// that are the same nodes, numbers or symbol names) reuses that node;
+// the number and symbol nodes just made for its operands are dropped.
+// resolveSymbols decides which of the reuses can really be shared.
+AST_ID createFunctionNode(FUNC_TYPE func, uint32_t opList)
+{
+    size_t count = ast.pendingOpCount - opList;
+    AST_ID *ops = ast.pendingOps + opList;
+    bool indexed = callIsSilent(func, count);
+    size_t bucket = 0;
+
+    if (indexed) {
+        growCallIndex();
+        bucket = findCall(hashCall(func, ops, count), func, ops, count);
+        AST_ID match = ast.callIndex[bucket];
+        if (match != 0) {
+            for (size_t i = count; i-- > 0;) {
+                if (ops[i] == ast.count - 1 && NODE_TYPE(ops[i]) != FUNC_NODE_TYPE) {
+                    ast.count--;
+                }
+            }
+            ast.pendingOpCount = opList;
+            ast.reuseCount++;
+            return match;
+        }
     }
 
-    while(oplist != NULL) {
-        num = eval(oplist);
-        result.type = num.type;
-        if (num.type == DOUBLE_TYPE) {
-            trackDouble = true;
+    AST_GROW(ast.children, ast.childCount, ast.childCapacity, count);
+    memcpy(ast.children + ast.childCount, ops, count * sizeof(AST_ID));
+    ast.pendingOpCount = opList;
+
+    AST_ID node = newNode(FUNC_NODE_TYPE);
+    NODE(node).function.func = func;
+    NODE(node).function.start = (uint32_t) ast.childCount;
+    NODE(node).function.count = (uint32_t) count;
+    NODE(node).function.memo = 0;
+    ast.childCount += count;
+    for (size_t i = 0; i < count; i++) {
+        if (ast.depths[ops[i]] >= ast.depths[node]) {
+            ast.depths[node] = ast.depths[ops[i]] + 1;
         }
-        result.value = result.value * num.value;
-        oplist = oplist->next;
     }
 
-    if (trackDouble) {
-        result.type = DOUBLE_TYPE;
+    if (indexed) {
+        ast.callIndex[bucket] = node;
+        ast.callCount++;
     }
+    return node;
+}
 
-    return result;
+// A call of a let-bound function: a CUSTOM_FUNC call whose operands are
+// followed by a symbol node naming the function.
+AST_ID createCallNode(SYMBOL_ID id, uint32_t opList)
+{
+    AST_ID callee = createSymbolNode(id);
+    AST_ID node = createFunctionNode(CUSTOM_FUNC, opList);
+    AST_GROW(ast.children, ast.childCount, ast.childCapacity, 1);
+    ast.children[ast.childCount++] = callee;
+    return node;
 }
 
-RET_VAL evalDiv(AST_NODE *oplist) {
-    RET_VAL result;
-    result.value = 0;
+// An operand list is named by where it starts on the pending stack.
+uint32_t createExpressionList(AST_ID expr)
+{
+    return addExpressionToList((uint32_t) ast.pendingOpCount, expr);
+}
 
-    if(oplist == NULL) {
-        warning("div called with no operands, 0 returned");
-        return ZERO_RET_VAL;
-    } else if(oplist->next == NULL) {
-        warning("div called with 1 operand, NAN returned");
-        return NAN_RET_VAL;
+uint32_t addExpressionToList(uint32_t exprList, AST_ID newExpr)
+{
+    if(newExpr != 0) {
+        AST_GROW(ast.pendingOps, ast.pendingOpCount, ast.pendingOpCapacity, 1);
+        ast.pendingOps[ast.pendingOpCount++] = newExpr;
     }
+    return exprList;
+}
 
-    RET_VAL firstOp = eval(oplist);
-    RET_VAL secondOP = eval(oplist->next);
-
-    if(oplist->next->next != NULL){
-        warning("div called with too many operands, ignoring extra");
+// Forgets the current program's nodes, keeping the arrays for the next
+// one, and logs how big it was.
+void astReset(void)
+{
+    if (flex_bison_log_file != NULL)
+    {
+        size_t bytes = (ast.count - 1) * (2 * sizeof(uint8_t) + sizeof(AST_DATA))
+                       + ast.childCount * sizeof(AST_ID)
+                       + ast.bindingCount * sizeof(SYMBOL_TABLE_NODE)
+                       + ast.scopeCount * sizeof(AST_SCOPE)
+                       + ast.lambdaCount * sizeof(AST_LAMBDA);
+        fprintf(flex_bison_log_file, "AST: %zu nodes, %zu bytes\n", ast.count - 1, bytes);
     }
 
-    if(firstOp.type == DOUBLE_TYPE || secondOP.type == DOUBLE_TYPE)
-        result.type = DOUBLE_TYPE;
-    else
-        result.type = INT_TYPE;
-
-    result.value = firstOp.value / secondOP.value;
-
-    return result;
+    ast.count = 1;
+    ast.childCount = 0;
+    ast.bindingCount = 0;
+    ast.scopeCount = 0;
+    ast.lambdaCount = 0;
+    ast.pendingOpCount = 0;
+    ast.pendingBindingCount = 0;
+    ast.pendingLambdaCount = 0;
+
+    // a big index is cheaper to drop than to clear line after line
+    if (ast.callIndexSize > CALL_INDEX_MIN) {
+        free(ast.callIndex);
+        ast.callIndex = NULL;
+        ast.callIndexSize = 0;
+    } else if (ast.callCount > 0) {
+        memset(ast.callIndex, 0, ast.callIndexSize * sizeof(AST_ID));
+    }
+    ast.callCount = 0;
+    ast.reuseCount = 0;
+    ast.memoCount = 0;
 }
 
-RET_VAL evalRemainder(AST_NODE *oplist) {
-    RET_VAL result;
-    result.value = 0;
+// Finds the variable or function id from scope out, as a (depth, slot)
+// pair relative to scope, and for a function, which one it is. The
+// search stops at a function's parameters: a name from further out is
+// captured, and found in the capture's slot after the parameters.
+static bool resolveName(SYMBOL_ID id, bool function, AST_ID scope, int *depth, int *slot, uint32_t *lambda) {
+    for (*depth = 0; scope != 0; ++*depth) {
+        AST_SCOPE *current = NODE_SCOPE(scope);
+        if (!function) {
+            long found = lookupSlot(SCOPE_SLOT(current, 0), (size_t) current->slotCount, current->index, current->indexSize, id);
+            if (found >= 0) {
+                *slot = (int) found;
+                return true;
+            }
+        }
+        if (current->lambda >= 0) {
+            AST_LAMBDA *closure = &ast.lambdas[current->lambda];
+            uint32_t i;
+            for (i = 0; i < closure->captureCount; i++) {
+                if (closure->captures[i].id == id && closure->captures[i].function == function) {
+                    break;
+                }
+            }
+            if (i == closure->captureCount) {
+                AST_CAPTURE capture = { .id = id, .function = function, .lambda = 0 };
+                if (!resolveName(id, function, current->outer, &capture.depth, &capture.slot, &capture.lambda)) {
+                    return false;
+                }
+                if (closure->captureCount == closure->captureCapacity) {
+                    AST_CAPTURE *old = closure->captures;
+                    closure->captureCapacity = closure->captureCapacity ? 2 * closure->captureCapacity : 4;
+                    closure->captures = arenaAlloc(closure->captureCapacity * sizeof(AST_CAPTURE));
+                    if (closure->captureCount > 0) {
+                        memcpy(closure->captures, old, closure->captureCount * sizeof(AST_CAPTURE));
+                    }
+                }
+                closure->captures[closure->captureCount++] = capture;
+            }
+            *slot = current->slotCount + (int) i;
+            *lambda = closure->captures[i].lambda;
+            return true;
+        }
+        if (function) {
+            for (int i = 0; i < current->lambdaCount; i++) {
+                if (ast.lambdas[current->firstLambda + i].id == id) {
+                    *slot = current->slotCount + i;
+                    *lambda = current->firstLambda + (uint32_t) i;
+                    return true;
+                }
+            }
+        }
+        scope = current->outer;
+    }
+    return false;
+}
 
-    if(oplist == NULL) {
-        warning("remainder called with no operands, 0 returned");
-        return ZERO_RET_VAL;
-    } else if(oplist->next == NULL) {
-        warning("remainder called with 1 operand, NAN returned");
-        return NAN_RET_VAL;
+// Turns a symbol reference into a (depth, slot) pair relative to the
+// innermost enclosing scope, so evaluation never compares names.
+void resolveSymbolNode(AST_ID node, AST_ID scope) {
+    if (!resolveName(NODE(node).symbol.id, false, scope, &NODE(node).symbol.depth,
+                     &NODE(node).symbol.slot, &NODE(node).symbol.lambda)) {
+        warning("undefined symbol, nan returned");
+        NODE(node).symbol.depth = -1;
+    }
+}
+
+// The same for the function a call names: the slot of its closure.
+static void resolveCallee(AST_ID node, AST_ID scope) {
+    AST_ID callee = NODE_CALLEE(node);
+    if (!resolveName(NODE(callee).symbol.id, true, scope, &NODE(callee).symbol.depth,
+                     &NODE(callee).symbol.slot, &NODE(callee).symbol.lambda)) {
+        warning("undefined function %s, nan returned", symbolName(NODE(callee).symbol.id));
+        NODE(callee).symbol.depth = -1;
+    }
+}
+
+// For programs that reuse nodes: the context each node was resolved in,
+// 0 for nodes not reached yet. A context is the innermost scope and
+// whether the node is part of a let binding; MARK_UNDEFINED is added if
+// the node refers to an undefined symbol.
+#define MARK_UNDEFINED 0x80000000u
+
+static struct {
+    uint32_t *marks;
+    size_t count, capacity;
+    bool active;
+} resolution;
+
+static uint32_t markOf(AST_ID node) {
+    return node < resolution.count ? resolution.marks[node] : 0;
+}
+
+static void setMark(AST_ID node, uint32_t mark) {
+    if (node >= resolution.count) {
+        AST_GROW(resolution.marks, resolution.count, resolution.capacity, node + 1 - resolution.count);
+        memset(resolution.marks + resolution.count, 0, (node + 1 - resolution.count) * sizeof(uint32_t));
+        resolution.count = node + 1;
+    }
+    resolution.marks[node] = mark;
+}
+
+// A private copy of a node that is reached from more than one place,
+// for one place to change. Operands stay shared.
+AST_ID copyNode(AST_ID node) {
+    AST_ID copy = newNode(NODE_TYPE(node));
+    NODE(copy) = NODE(node);
+    ast.depths[copy] = ast.depths[node];
+    if (NODE_TYPE(node) == FUNC_NODE_TYPE) {
+        size_t count = NODE(node).function.count + (NODE(node).function.func == CUSTOM_FUNC);
+        AST_GROW(ast.children, ast.childCount, ast.childCapacity, count);
+        memcpy(ast.children + ast.childCount, NODE_OPS(node), count * sizeof(AST_ID));
+        NODE(copy).function.start = (uint32_t) ast.childCount;
+        NODE(copy).function.memo = 0;
+        ast.childCount += count;
     }
+    return copy;
+}
 
-    RET_VAL firstOp = eval(oplist);
-    RET_VAL secondOP = eval(oplist->next);
+static AST_ID resolveNode(AST_ID node, AST_ID scope, bool inBinding) {
+    if (!node || NODE_TYPE(node) == NUM_NODE_TYPE) {
+        return node;
+    }
 
-    if(oplist->next->next != NULL){
-        warning("remainder called with too many operands, ignoring extra");
+    uint32_t context = 2 * scope + inBinding + 1;
+    if (resolution.active && markOf(node) != 0) {
+        // A second use in the same context means the same values, so a
+        // call can be shared and evaluated once: unless it is in a let
+        // binding, where a half-evaluated symbol can read differently
+        // from one use to the next, or reports undefined symbols, which
+        // have to be reported again.
+        if (markOf(node) == context) {
+            if (NODE_TYPE(node) == FUNC_NODE_TYPE && !inBinding && NODE(node).function.memo == 0) {
+                NODE(node).function.memo = (uint32_t) ++ast.memoCount;
+            }
+            return node;
+        }
+        node = copyNode(node);
     }
 
-    if(firstOp.type == DOUBLE_TYPE || secondOP.type == DOUBLE_TYPE)
-        result.type = DOUBLE_TYPE;
+    uint32_t mark = context;
+    switch (NODE_TYPE(node)) {
+        case SYM_NODE_TYPE:
+            resolveSymbolNode(node, scope);
+            if (NODE(node).symbol.depth < 0) {
+                mark |= MARK_UNDEFINED;
+            }
+            break;
+        case FUNC_NODE_TYPE:
+        {
+            // the operands of cond, and and or after the first may be
+            // skipped, so like a binding they share nothing: a call they
+            // share could be evaluated first where it is skipped
+            FUNC_TYPE func = NODE(node).function.func;
+            bool lazy = func == COND_FUNC || func == AND_FUNC || func == OR_FUNC;
+            for (size_t i = 0; i < NODE(node).function.count; i++) {
+                AST_ID op = resolveNode(NODE_OPS(node)[i], scope, inBinding || (lazy && i > 0));
+                NODE_OPS(node)[i] = op;
+                mark |= markOf(op) & MARK_UNDEFINED;
+            }
+            if (func == CUSTOM_FUNC) {
+                resolveCallee(node, scope);
+            }
+            break;
+        }
+        case SCOPE_NODE_TYPE:
+            NODE_SCOPE(node)->outer = scope;
+            for (int slot = 0; slot < NODE_SCOPE(node)->slotCount; slot++) {
+                SYMBOL_TABLE_NODE *binding = SCOPE_SLOT(NODE_SCOPE(node), slot);
+                binding->value = resolveNode(binding->value, node, true);
+            }
+            // a body runs once per call, so like a binding it shares nothing
+            for (int i = 0; i < NODE_SCOPE(node)->lambdaCount; i++) {
+                AST_ID params = ast.lambdas[NODE_SCOPE(node)->firstLambda + i].params;
+                NODE_SCOPE(params)->outer = node;
+                NODE_SCOPE(params)->child = resolveNode(NODE_SCOPE(params)->child, params, true);
+            }
+            NODE_SCOPE(node)->child = resolveNode(NODE_SCOPE(node)->child, node, inBinding);
+            break;
+        default:
+            break;
+    }
+
+    if (resolution.active) {
+        setMark(node, mark);
+    }
+    return node;
+}
+
+// Whether evaluating node could print a warning whatever its values:
+// it calls a builtin or a function with the wrong number of operands, or
+// a function whose body could. Nodes already stamped with stamp were
+// looked at, so shared nodes and function bodies are walked once.
+static struct {
+    uint32_t *stamps;
+    size_t capacity;
+    uint32_t stamp;     // the last check's
+} printCheck;
+
+static bool nodePrints(AST_ID node, uint32_t stamp) {
+    if (printCheck.stamps[node] == stamp) {
+        return false;
+    }
+    printCheck.stamps[node] = stamp;
+
+    switch (NODE_TYPE(node)) {
+        case FUNC_NODE_TYPE:
+        {
+            FUNC_TYPE func = NODE(node).function.func;
+            size_t count = NODE(node).function.count;
+            if (func == CUSTOM_FUNC) {
+                AST_ID callee = NODE_CALLEE(node);
+                if (NODE(callee).symbol.depth >= 0) {
+                    AST_ID params = ast.lambdas[NODE(callee).symbol.lambda].params;
+                    if (count != (size_t) NODE_SCOPE(params)->slotCount || nodePrints(params, stamp)) {
+                        return true;
+                    }
+                }
+            } else if (!callIsSilent(func, count)) {
+                return true;
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (nodePrints(NODE_OPS(node)[i], stamp)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        case SCOPE_NODE_TYPE:
+            for (int slot = 0; slot < NODE_SCOPE(node)->slotCount; slot++) {
+                if (nodePrints(SCOPE_SLOT(NODE_SCOPE(node), slot)->value, stamp)) {
+                    return true;
+                }
+            }
+            return nodePrints(NODE_SCOPE(node)->child, stamp);
+        default:
+            return false;
+    }
+}
+
+// A memo function has to give the same value whenever it is called with
+// the same arguments, so its results can be kept. That rules out bodies
+// that print, whose warnings would only print the first time. It also
+// rules out functions bound inside another function's body, whose
+// captures can differ from one call of that function to the next.
+// Either is reported and the function is called as a plain one.
+static void checkMemos(void) {
+    for (uint32_t i = 0; i < ast.lambdaCount; i++) {
+        AST_LAMBDA *lambda = &ast.lambdas[i];
+        if (!lambda->memo) {
+            continue;
+        }
+        AST_ID scope = NODE_SCOPE(lambda->params)->outer;
+        while (scope != 0 && NODE_SCOPE(scope)->lambda < 0) {
+            scope = NODE_SCOPE(scope)->outer;
+        }
+        if (scope != 0) {
+            warning("%s is bound inside a function, so it is not memoized", symbolName(lambda->id));
+            lambda->memo = false;
+            continue;
+        }
+
+        if (printCheck.capacity < ast.count) {
+            AST_GROW(printCheck.stamps, 0, printCheck.capacity, ast.count);
+            for (size_t node = 0; node < printCheck.capacity; node++) {
+                printCheck.stamps[node] = 0;
+            }
+        }
+        if (nodePrints(lambda->params, ++printCheck.stamp)) {
+            warning("%s prints warnings, so it is not memoized", symbolName(lambda->id));
+            lambda->memo = false;
+        }
+    }
+}
+
+// Resolution pass run once per program before eval. Returns the node to
+// use in place of node. scope is the innermost scope enclosing node (0 at
+// the top level).
+//
+// A node that createFunctionNode reused is reached once per use. Uses in
+// the same context stay shared; a use elsewhere gets its own copy, since
+// its symbols may be bound by other scopes.
+AST_ID resolveSymbols(AST_ID node, AST_ID scope) {
+    resolution.active = ast.reuseCount > 0;
+    resolution.count = 0;
+    node = resolveNode(node, scope, false);
+    checkMemos();
+    return node;
+}
+
+// Arithmetic and typing of neg, abs, sub, div, remainder and pow on
+// evaluated operands, shared by eval and the VM. Integers stay int64_t
+// while the result is one and go on as bignums when it isn't; vectors
+// are done element by element, and everything else in doubles.
+RET_VAL retNeg(RET_VAL num) {
+    // -0 isn't an integer, and -INT64_MIN is a bignum
+    if(retIsInt64(num) && num != ZERO_RET_VAL && retInt64Of(num) != INT64_MIN) {
+        return retFromInt(-retInt64Of(num));
+    }
+    if(retIsInteger(num) && num != ZERO_RET_VAL) {
+        return bigNeg(num);
+    }
+    if(retIsVector(num)) {
+        return vecMap(NEG_FUNC, num, false);
+    }
+    return makeRetVal(retType(num), -(retValue(num)));
+}
+
+RET_VAL retAbs(RET_VAL num) {
+    if(retIsInt64(num) && retInt64Of(num) != INT64_MIN) {
+        return retInt64Of(num) < 0 ? retFromInt(-retInt64Of(num)) : num;
+    }
+    if(retIsInteger(num)) {
+        return bigCompare(num, ZERO_RET_VAL) < 0 ? bigNeg(num) : num;
+    }
+    if(retIsVector(num)) {
+        return vecMap(ABS_FUNC, num, false);
+    }
+    return makeRetVal(retType(num), fabs(retValue(num)));
+}
+
+static NUM_TYPE binaryType(RET_VAL a, RET_VAL b) {
+    if(retType(a) == DOUBLE_TYPE || retType(b) == DOUBLE_TYPE)
+        return DOUBLE_TYPE;
     else
-        result.type = INT_TYPE;
+        return INT_TYPE;
+}
 
-    result.value = fabs(fmod(firstOp.value, secondOP.value));
+RET_VAL retSub(RET_VAL a, RET_VAL b) {
+    int64_t difference;
+    if(retIsInt64(a) && retIsInt64(b) && !__builtin_sub_overflow(retInt64Of(a), retInt64Of(b), &difference)) {
+        return retFromInt(difference);
+    }
+    if(retIsInteger(a) && retIsInteger(b)) {
+        return bigSub(a, b);
+    }
+    if(retIsVector(a) || retIsVector(b)) {
+        return vecZip(SUB_FUNC, a, b, false);
+    }
+    return makeRetVal(binaryType(a, b), retValue(a) - retValue(b));
+}
 
-    return result;
+RET_VAL retDiv(RET_VAL a, RET_VAL b) {
+    // a division that leaves no remainder stays exact; 0 over a negative
+    // number is -0, and INT64_MIN / -1 overflows
+    RET_VAL quotient;
+    if(retIsInt64(a) && retIsInt64(b)) {
+        int64_t dividend = retInt64Of(a), divisor = retInt64Of(b);
+        if(dividend == INT64_MIN && divisor == -1) {
+            return bigNeg(a);
+        }
+        if(divisor != 0 && dividend % divisor == 0 && (dividend != 0 || divisor > 0)) {
+            return retFromInt(dividend / divisor);
+        }
+        if(retFitsFraction(dividend, divisor)) {
+            return retFraction(dividend, divisor);
+        }
+    } else if(retIsInteger(a) && retIsInteger(b) && bigDiv(a, b, &quotient)) {
+        return quotient;
+    }
+    if(retIsVector(a) || retIsVector(b)) {
+        return vecZip(DIV_FUNC, a, b, false);
+    }
+    return makeRetVal(binaryType(a, b), retValue(a) / retValue(b));
 }
 
-RET_VAL evalExp(AST_NODE *oplist) {
-    RET_VAL num;
+RET_VAL retRemainder(RET_VAL a, RET_VAL b) {
+    if(retIsInt64(a) && retIsInt64(b) && retInt64Of(b) != 0) {
+        // INT64_MIN % -1 overflows in C
+        int64_t remainder = retInt64Of(b) == -1 ? 0 : retInt64Of(a) % retInt64Of(b);
+        return retFromInt(remainder < 0 ? -remainder : remainder);
+    }
+    if(retIsInteger(a) && retIsInteger(b) && b != ZERO_RET_VAL) {
+        return bigRemainder(a, b);
+    }
+    if(retIsVector(a) || retIsVector(b)) {
+        return vecZip(REMAINDER_FUNC, a, b, false);
+    }
+    return makeRetVal(binaryType(a, b), fabs(fmod(retValue(a), retValue(b))));
+}
+
+RET_VAL retPow(RET_VAL a, RET_VAL b) {
+    int64_t power;
     RET_VAL result;
-    if(oplist == NULL) {
-        warning("exp called with no operands, NAN returned");
-        return NAN_RET_VAL;
+    if(retIsInt64(a) && retIsInt64(b) && retInt64Of(b) >= 0) {
+        if(retPowInt(retInt64Of(a), retInt64Of(b), &power)) {
+            return retFromInt(power);
+        }
+        if(bigPow(a, retInt64Of(b), &result)) {
+            return result;
+        }
+    } else if(retIsBig(a) && retIsInt64(b) && retInt64Of(b) >= 0 && bigPow(a, retInt64Of(b), &result)) {
+        return result;
     }
-    if(oplist->next != NULL) {
-        warning("exp called with extra operands");
+    if(retIsVector(a) || retIsVector(b)) {
+        return vecZip(POW_FUNC, a, b, false);
     }
+    return makeRetVal(binaryType(a, b), options.math->pow(retValue(a), retValue(b)));
+}
 
-    num = eval(oplist);
+// The operand doubles of the wide calls, gathered in one place.
+static struct {
+    double *values;
+    size_t capacity;
+} wide;
+
+static double *wideBuffer(size_t count) {
+    if(count > wide.capacity) {
+        wide.capacity = 2 * count;
+        if((wide.values = realloc(wide.values, wide.capacity * sizeof(double))) == NULL) {
+            yyerror("Memory allocation failed!");
+        }
+    }
+    return wide.values;
+}
+
+// The rest of a wide add, mult or hypot once the integers run out: acc,
+// what the call came to before vals, with the pairwise reduction of
+// their doubles, or element by element from the first vector on.
+static RET_VAL wideTail(FUNC_TYPE func, double acc, RET_VAL *vals, size_t count) {
+    double *values = wideBuffer(count);
+    bool trackDouble = false;
+    size_t n = 0;
 
-    result.type = DOUBLE_TYPE;
-    result.value = exp(num.value);
-    return result;
+    for(; n < count && !retIsVector(vals[n]); n++) {
+        trackDouble |= retIsDouble(vals[n]);
+        values[n] = retValue(vals[n]);
+    }
+    switch(func) {
+        case ADD_FUNC: acc += vecSum(values, n); break;
+        case MULT_FUNC: acc *= vecProduct(values, n); break;
+        default: acc += vecSumSquares(values, n); break;
+    }
+
+    if(n < count) {
+        return vecFold(func, retDouble(acc), vals + n, count - n);
+    }
+    if(func == HYPOT_FUNC) {
+        return retDouble(sqrt(acc));
+    }
+    return makeRetVal(trackDouble ? DOUBLE_TYPE : retType(vals[count - 1]), acc);
 }
 
-RET_VAL evalExp2(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    if(oplist == NULL) {
-        warning("exp2 called with no operands, NAN returned");
-        return NAN_RET_VAL;
+RET_VAL retSum(RET_VAL *vals, size_t count) {
+    int64_t sum = 0;
+    size_t i = 0;
+    while(i < count && retAddInt(&sum, vals[i])) {
+        i++;
     }
-    if(oplist->next != NULL) {
-        warning("exp2 called with extra operands");
+    if(i == count) {
+        return retFromInt(sum);
     }
+    double value = (double) sum;
+    if(retIsInteger(vals[i])) {
+        BIGNUM big;
+        bigAccStart(&big, sum);
+        while(i < count && retIsInteger(vals[i])) {
+            bigAccAdd(&big, vals[i++]);
+        }
+        if(i == count) {
+            return bigAccFinish(&big);
+        }
+        value = bigAccDouble(&big);
+    }
+    return wideTail(ADD_FUNC, value, vals + i, count - i);
+}
 
-    num = eval(oplist);
+RET_VAL retProduct(RET_VAL *vals, size_t count) {
+    int64_t product = 1;
+    size_t i = 0;
+    while(i < count && retMultInt(&product, vals[i])) {
+        i++;
+    }
+    if(i == count) {
+        return retFromInt(product);
+    }
+    double value = (double) product;
+    if(retIsInteger(vals[i]) && vals[i] != ZERO_RET_VAL) {
+        BIGNUM big;
+        bigAccStart(&big, product);
+        while(i < count && retIsInteger(vals[i]) && vals[i] != ZERO_RET_VAL && bigAccMult(&big, vals[i])) {
+            i++;
+        }
+        if(i == count) {
+            return bigAccFinish(&big);
+        }
+        value = bigAccDouble(&big);
+    }
+    return wideTail(MULT_FUNC, value, vals + i, count - i);
+}
+
+RET_VAL retHypot(RET_VAL *vals, size_t count) {
+    return wideTail(HYPOT_FUNC, 0, vals, count);
+}
 
-    result.type = num.type;
-    result.value = exp2(num.value);
-    if(result.value < 0){
-        result.type = DOUBLE_TYPE;
+// min and max give the same operand as they do in applyCall. Their SIMD
+// search needs operands that are exact as doubles; others (and vectors)
+// are compared one by one.
+static RET_VAL wideExtreme(FUNC_TYPE func, RET_VAL *vals, size_t count) {
+    double *values = wideBuffer(count);
+    for(size_t i = 0; i < count; i++) {
+        if(!retIsDouble(vals[i]) && !retIsInt(vals[i])) {
+            RET_VAL result = vals[0];
+            for(i = 1; i < count; i++) {
+                if(retIsVector(vals[i]) || retIsVector(result)) {
+                    return vecFold(func, result, vals + i, count - i);
+                }
+                if(func == MIN_FUNC ? retLess(vals[i], result) : retLess(result, vals[i])) {
+                    result = vals[i];
+                }
+            }
+            return result;
+        }
+        values[i] = retValue(vals[i]);
     }
-    return result;
+    return vals[func == MIN_FUNC ? vecMinIndex(values, count) : vecMaxIndex(values, count)];
 }
 
-RET_VAL evalPow(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    result.value = 0;
+RET_VAL retMin(RET_VAL *vals, size_t count) {
+    return wideExtreme(MIN_FUNC, vals, count);
+}
 
-    if(oplist == NULL) {
-        warning("pow called with no operands, 0 returned");
-        return ZERO_RET_VAL;
-    } else if(oplist->next == NULL) {
-        warning("pow called with 1 operand, NAN returned");
-        return NAN_RET_VAL;
+RET_VAL retMax(RET_VAL *vals, size_t count) {
+    return wideExtreme(MAX_FUNC, vals, count);
+}
+
+// A call's value from its evaluated operands vals, which are the ones
+// evalCount says it evaluates. Integers are added and multiplied as
+// int64_t, and as a bignum from the step that would overflow, until a
+// non-integer (or, multiplying, a zero) comes along; from the first
+// vector on, variadic calls go element by element.
+static RET_VAL applyCall(FUNC_TYPE func, RET_VAL *vals, size_t count) {
+    NUM_TYPE type;
+    double value;
+    bool trackDouble = false;
+    size_t i = 0;
+
+    switch (func) {
+        case NEG_FUNC: return retNeg(vals[0]);
+        case ABS_FUNC: return retAbs(vals[0]);
+        case SUB_FUNC: return retSub(vals[0], vals[1]);
+        case DIV_FUNC: return retDiv(vals[0], vals[1]);
+        case REMAINDER_FUNC: return retRemainder(vals[0], vals[1]);
+        case POW_FUNC: return retPow(vals[0], vals[1]);
+        case LESS_FUNC:
+        case GREATER_FUNC:
+        case EQUAL_FUNC:
+            if (retIsVector(vals[0]) || retIsVector(vals[1])) {
+                return vecZip(func, vals[0], vals[1], false);
+            }
+            if (func == EQUAL_FUNC) {
+                return retFromBool(retEqual(vals[0], vals[1]));
+            }
+            return retFromBool(func == LESS_FUNC ? retLess(vals[0], vals[1]) : retLess(vals[1], vals[0]));
+        case EXP_FUNC:
+        case EXP2_FUNC:
+        case LOG_FUNC:
+        case SQRT_FUNC:
+        case CBRT_FUNC:
+            if (retIsVector(vals[0])) {
+                return vecMap(func, vals[0], false);
+            }
+            value = retValue(vals[0]);
+            switch (func) {
+                case EXP_FUNC: return retDouble(options.math->exp(value));
+                case LOG_FUNC: return retDouble(options.math->log(value));
+                case SQRT_FUNC: return retDouble(sqrt(value));
+                case CBRT_FUNC: return retDouble(options.math->cbrt(value));
+                default: break;
+            }
+            // exp2 of an integer is exact, and so is the much cheaper ldexp
+            type = retType(vals[0]);
+            value = retIsInt(vals[0]) ? ldexp(1, (int) fmax(fmin(retIntOf(vals[0]), 2000), -2000)) : options.math->exp2(value);
+            if (value < 0) {
+                type = DOUBLE_TYPE;
+            }
+            return makeRetVal(type, value);
+        case ADD_FUNC:
+        {
+            if (count >= RET_WIDE_CALL) {
+                return retSum(vals, count);
+            }
+            int64_t sum = 0;
+            while (i < count && retAddInt(&sum, vals[i])) {
+                i++;
+            }
+            if (i == count) {
+                return retFromInt(sum);
+            }
+            value = (double) sum;
+            if (retIsInteger(vals[i])) {
+                BIGNUM big;
+                bigAccStart(&big, sum);
+                while (i < count && retIsInteger(vals[i])) {
+                    bigAccAdd(&big, vals[i++]);
+                }
+                if (i == count) {
+                    return bigAccFinish(&big);
+                }
+                value = bigAccDouble(&big);
+            }
+            for (; i < count && !retIsVector(vals[i]); i++) {
+                trackDouble |= retIsDouble(vals[i]);
+                value += retValue(vals[i]);
+            }
+            break;
+        }
+        case MULT_FUNC:
+        {
+            if (count >= RET_WIDE_CALL) {
+                return retProduct(vals, count);
+            }
+            int64_t product = 1;
+            while (i < count && retMultInt(&product, vals[i])) {
+                i++;
+            }
+            if (i == count) {
+                return retFromInt(product);
+            }
+            value = (double) product;
+            if (retIsInteger(vals[i]) && vals[i] != ZERO_RET_VAL) {
+                BIGNUM big;
+                bigAccStart(&big, product);
+                while (i < count && retIsInteger(vals[i]) && vals[i] != ZERO_RET_VAL && bigAccMult(&big, vals[i])) {
+                    i++;
+                }
+                if (i == count) {
+                    return bigAccFinish(&big);
+                }
+                value = bigAccDouble(&big);
+            }
+            for (; i < count && !retIsVector(vals[i]); i++) {
+                trackDouble |= retIsDouble(vals[i]);
+                value = value * retValue(vals[i]);
+            }
+            break;
+        }
+        case HYPOT_FUNC:
+            if (count >= RET_WIDE_CALL) {
+                return retHypot(vals, count);
+            }
+            value = 0;
+            for (; i < count && !retIsVector(vals[i]); i++) {
+                value += pow(retValue(vals[i]), 2);
+            }
+            return i < count ? vecFold(HYPOT_FUNC, retDouble(value), vals + i, count - i) : retDouble(sqrt(value));
+        case MIN_FUNC:
+        case MAX_FUNC:
+        {
+            if (count >= RET_WIDE_CALL) {
+                return func == MIN_FUNC ? retMin(vals, count) : retMax(vals, count);
+            }
+            RET_VAL result = vals[0];
+            for (i = 1; i < count; i++) {
+                if (retIsVector(vals[i]) || retIsVector(result)) {
+                    return vecFold(func, result, vals + i, count - i);
+                }
+                if (func == MIN_FUNC ? retLess(vals[i], result) : retLess(result, vals[i])) {
+                    result = vals[i];
+                }
+            }
+            return result;
+        }
+        case VEC_FUNC:
+            return vecMake(vals, count);
+        default:
+            return NAN_RET_VAL;
     }
 
-    RET_VAL firstOp = eval(oplist);
-    RET_VAL secondOP = eval(oplist->next);
+    // the rest of add and mult, which take the last operand's type
+    // unless any operand is a double
+    if (i < count) {
+        return vecFold(func, retDouble(value), vals + i, count - i);
+    }
+    type = trackDouble ? DOUBLE_TYPE : retType(vals[count - 1]);
+    return makeRetVal(type, value);
+}
 
-    if(oplist->next->next != NULL){
-        warning("pow called with too many operands, ignoring extra");
+// A call inferTypes found to be a DOUBLE: its arity is right, and the
+// type rules need no checking. applyCall keeps integers exact until the
+// first operand that isn't one, so the plain double loops of add and
+// mult are only used when that is the first operand, and wide calls
+// reduce differently. neg, abs, exp2, min and max are only DOUBLEs if
+// their operands are.
+static double applyDoubleCall(AST_ID node, RET_VAL *vals, size_t count) {
+    FUNC_TYPE func = NODE(node).function.func;
+    double value, operand;
+
+    switch (func) {
+        case NEG_FUNC: return -retValue(vals[0]);
+        case ABS_FUNC: return fabs(retValue(vals[0]));
+        case EXP_FUNC: return options.math->exp(retValue(vals[0]));
+        case EXP2_FUNC: return options.math->exp2(retValue(vals[0]));
+        case LOG_FUNC: return options.math->log(retValue(vals[0]));
+        case SQRT_FUNC: return sqrt(retValue(vals[0]));
+        case CBRT_FUNC: return options.math->cbrt(retValue(vals[0]));
+        case SUB_FUNC: return retValue(vals[0]) - retValue(vals[1]);
+        case DIV_FUNC: return retValue(vals[0]) / retValue(vals[1]);
+        case REMAINDER_FUNC: return fabs(fmod(retValue(vals[0]), retValue(vals[1])));
+        case POW_FUNC: return options.math->pow(retValue(vals[0]), retValue(vals[1]));
+        case ADD_FUNC:
+            if (ast.numTypes[NODE_OPS(node)[0]] != DOUBLE_TYPE || count >= RET_WIDE_CALL) {
+                return retDoubleOf(applyCall(func, vals, count));
+            }
+            value = 0;
+            for (size_t i = 0; i < count; i++) {
+                value += retValue(vals[i]);
+            }
+            return value;
+        case MULT_FUNC:
+            if (ast.numTypes[NODE_OPS(node)[0]] != DOUBLE_TYPE || count >= RET_WIDE_CALL) {
+                return retDoubleOf(applyCall(func, vals, count));
+            }
+            value = 1;
+            for (size_t i = 0; i < count; i++) {
+                value = value * retValue(vals[i]);
+            }
+            return value;
+        case HYPOT_FUNC:
+            if (count >= RET_WIDE_CALL) {
+                return retDoubleOf(applyCall(func, vals, count));
+            }
+            value = 0;
+            for (size_t i = 0; i < count; i++) {
+                value += pow(retValue(vals[i]), 2);
+            }
+            return sqrt(value);
+        case MIN_FUNC:
+        case MAX_FUNC:
+            value = retValue(vals[0]);
+            for (size_t i = 1; i < count; i++) {
+                operand = retValue(vals[i]);
+                if (func == MIN_FUNC ? operand < value : value < operand) {
+                    value = operand;
+                }
+            }
+            return value;
+        default:
+            return NAN;
     }
+}
 
-    if(firstOp.type == DOUBLE_TYPE || secondOP.type == DOUBLE_TYPE)
-        result.type = DOUBLE_TYPE;
-    else
-        result.type = INT_TYPE;
+// The tree evaluator keeps its own stacks rather than recursing on the
+// C stack, so how deep a program nests is limited only by memory. Each
+// call, scope and let binding being evaluated has a task; the values of
+// finished operands wait on the value stack for their call. Scope
+// activations are frames, with their binding slots on the binding stack.
+// A function call is a task for its parameters' scope node, in a frame
+// of its own; a call in tail position takes over its caller's frame and
+// task instead, so looping by recursion runs in constant space.
+typedef struct {
+    AST_ID node;
+    uint32_t next;      // a call's operands started so far
+    uint32_t count;     // and how many of them it evaluates
+    uint32_t memo;      // memo slot + 1 to keep a call's value in, or 0
+    int caller;         // the frame a scope or binding returns to
+    int slot;           // the slot a binding's value goes in
+    size_t warnings;    // warningCount when the task was pushed
+} EVAL_TASK;
+
+static struct {
+    EVAL_TASK *tasks;
+    size_t taskCount, taskCapacity;
+    RET_VAL *values;
+    size_t valueCount, valueCapacity;
+    SCOPE_FRAME *frames;
+    size_t frameCount, frameCapacity;
+    BINDING_SLOT *slots;
+    size_t slotCount, slotCapacity;
+    int currentFrame;   // -1 outside every scope
+} evaluator = { .currentFrame = -1 };
+
+// Values of the calls resolveSymbols shared, one per memo slot,
+// computed on first use in each evaluation.
+static struct {
+    BINDING_SLOT *slots;
+    size_t capacity;
+} memo;
+
+static void memoReset(void) {
+    if (ast.memoCount > memo.capacity) {
+        memo.capacity = 2 * ast.memoCount;
+        if ((memo.slots = realloc(memo.slots, memo.capacity * sizeof(BINDING_SLOT))) == NULL) {
+            yyerror("Memory allocation failed!");
+        }
+    }
+    for (size_t i = 0; i < ast.memoCount; i++) {
+        memo.slots[i].state = SLOT_UNEVALUATED;
+    }
+}
 
-    result.value = pow(firstOp.value, secondOP.value);
+// Function activations and the arena, for both engines. A tail call
+// takes over its caller's frame, but the int64s its arguments were boxed
+// in would stay in the arena until the program is done. So each slot of
+// the binding stack has a pair of int64 cells, and a tail call moves an
+// int64 argument into the cell of its slot that the slot's old value is
+// not in, as another argument may still be that value. Unless the
+// iteration kept a value somewhere that outlives it (a slot below the
+// frame's end, a memo slot or a result cache) or passes another boxed
+// argument, nothing allocated since it began is reachable any more, and
+// the arena is rewound to there. A value in a cell lasts only as long as
+// its frame: cellRelease boxes it again as it leaves.
+#define CELL_BLOCK 4096
+
+static struct {
+    int64_t **blocks;       // a pair of cells per slot, CELL_BLOCK slots a block
+    size_t blockCount;
+} cells;
+
+typedef struct {
+    ARENA_MARK mark;        // the arena as the current iteration began
+    size_t limit;           // the end of the frame's slots
+    size_t floor;           // the lowest slot a value was kept in since
+} CALL_MARK;
+
+static struct {
+    CALL_MARK *marks;       // one per function activation
+    size_t count, capacity;
+} calls;
+
+static int64_t *cellPair(size_t slot) {
+    size_t block = slot / CELL_BLOCK;
+    if (block >= cells.blockCount) {
+        size_t count = cells.blockCount;
+        AST_GROW(cells.blocks, count, cells.blockCount, block + 1 - count);
+        for (size_t i = count; i < cells.blockCount; i++) {
+            cells.blocks[i] = NULL;
+        }
+    }
+    if (cells.blocks[block] == NULL && (cells.blocks[block] = malloc(2 * CELL_BLOCK * sizeof(int64_t))) == NULL) {
+        yyerror("Memory allocation failed!");
+    }
+    return cells.blocks[block] + 2 * (slot % CELL_BLOCK);
+}
 
-    return result;
+// val, boxed in the arena if it is in a cell.
+RET_VAL cellRelease(RET_VAL val) {
+    if ((val & ~RET_PAYLOAD) == RET_INT64_TAG) {
+        int64_t *box = retInt64Box(val);
+        for (size_t i = 0; i < cells.blockCount; i++) {
+            if (cells.blocks[i] != NULL && box >= cells.blocks[i] && box < cells.blocks[i] + 2 * CELL_BLOCK) {
+                return boxInt64(*box);
+            }
+        }
+    }
+    return val;
 }
 
-RET_VAL evalLog(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    if(oplist == NULL) {
-        warning("log called with no operands, NAN returned");
-        return NAN_RET_VAL;
+// A function's frame is laid out, its slots ending at limit.
+void callEnter(size_t limit) {
+    AST_GROW(calls.marks, calls.count, calls.capacity, 1);
+    calls.marks[calls.count++] = (CALL_MARK) { arenaMark(), limit, SIZE_MAX };
+}
+
+// The innermost function returns; what it kept counts for its caller.
+void callLeave(void) {
+    CALL_MARK *left = &calls.marks[--calls.count];
+    if (calls.count > 0 && left->floor < calls.marks[calls.count - 1].floor) {
+        calls.marks[calls.count - 1].floor = left->floor;
     }
-    if(oplist->next != NULL) {
-        warning("log called with extra operands");
+}
+
+// A value was kept in slot of the binding stack; memo slots and result
+// caches pass 0.
+void slotKept(size_t slot) {
+    if (calls.count > 0 && slot < calls.marks[calls.count - 1].floor) {
+        calls.marks[calls.count - 1].floor = slot;
     }
+}
 
-    num = eval(oplist);
+// Fills the parameter slots of the frame a tail call takes over, from
+// slot base on, with args, and starts the next iteration: the frame's
+// slots now end at limit.
+void tailArguments(BINDING_SLOT *slots, size_t base, RET_VAL *args, size_t count, size_t limit) {
+    CALL_MARK *top = &calls.marks[calls.count - 1];
+    bool rewind = top->floor >= top->limit;
+
+    for (size_t i = 0; i < count; i++) {
+        RET_VAL arg = args[i];
+        if ((arg & ~RET_PAYLOAD) == RET_INT64_TAG) {
+            int64_t *pair = cellPair(base + i);
+            RET_VAL old = slots[i].value;
+            int64_t *cell = (old & ~RET_PAYLOAD) == RET_INT64_TAG && retInt64Box(old) == pair ? pair + 1 : pair;
+            *cell = *retInt64Box(arg);
+            arg = RET_INT64_TAG | ((uint64_t) (uintptr_t) cell & RET_PAYLOAD);
+        } else if (!retIsDouble(arg) && arg >= RET_BOX_TAG && arg < RET_FRAC_TAG) {
+            rewind = false;
+        }
+        slots[i].value = arg;
+        slots[i].state = SLOT_READY;
+    }
 
-    result.type = DOUBLE_TYPE;
-    result.value = log(num.value);
-    return result;
+    if (rewind) {
+        arenaRewind(top->mark);
+    } else {
+        top->mark = arenaMark();
+    }
+    top->limit = limit;
+    top->floor = SIZE_MAX;
 }
 
-RET_VAL evalSqrt(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    if(oplist == NULL) {
-        warning("sqrt called with no operands, NAN returned");
-        return NAN_RET_VAL;
+// Results of the memo functions, a table per function, kept for one
+// evaluation. A table is open addressed on the bits of the arguments:
+// each row holds the arguments and then the result. Boxed arguments
+// only match the same box, so equal big values made twice are kept
+// twice. A table doubles while it is half full, up to --memo-size rows;
+// after that a result that finds no free row in its window replaces the
+// first row of it.
+#define CACHE_START 16
+#define CACHE_PROBES 8
+
+typedef struct {
+    RET_VAL *rows;
+    uint8_t *used;
+    size_t capacity, count;
+} RESULT_CACHE;
+
+static struct {
+    RESULT_CACHE *tables;
+    size_t count, capacity;
+    RET_VAL *row;       // the row resultCacheStore adds
+    size_t rowCapacity;
+} caches;
+
+void resultCacheReset(void) {
+    for (size_t i = 0; i < caches.count; i++) {
+        free(caches.tables[i].rows);
+        free(caches.tables[i].used);
     }
-    if(oplist->next != NULL) {
-        warning("sqrt called with extra operands");
+    AST_GROW(caches.tables, 0, caches.capacity, ast.lambdaCount);
+    for (size_t i = 0; i < ast.lambdaCount; i++) {
+        caches.tables[i] = (RESULT_CACHE) { NULL, NULL, 0, 0 };
     }
+    caches.count = ast.lambdaCount;
+}
 
-    num = eval(oplist);
+static size_t cacheWidth(uint32_t lambda) {
+    return (size_t) NODE_SCOPE(ast.lambdas[lambda].params)->slotCount;
+}
 
-    result.type = DOUBLE_TYPE;
-    result.value = sqrt(num.value);
-    return result;
+// murmur3's 64-bit finalizer: every bit of x reaches every bit of the
+// hash. The DOUBLEs of small integers differ only in their high bits,
+// and a multiplicative hash alone leaves them in a few buckets.
+static uint64_t cacheMix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    return x ^ (x >> 33);
 }
 
-RET_VAL evalCbrt(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    if(oplist == NULL) {
-        warning("cbrt called with no operands, NAN returned");
-        return NAN_RET_VAL;
+static size_t cacheHash(RET_VAL *args, size_t count) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; i++) {
+        hash = cacheMix(hash ^ args[i]);
+    }
+    return (size_t) hash;
+}
+
+// Puts row, count arguments and a result, in table, unless its window
+// is full and evict is false.
+static bool cacheInsert(RESULT_CACHE *table, RET_VAL *row, size_t count, bool evict) {
+    size_t home = cacheHash(row, count);
+    for (size_t probe = 0; probe < CACHE_PROBES; probe++) {
+        size_t at = (home + probe) & (table->capacity - 1);
+        if (!table->used[at] || memcmp(table->rows + at * (count + 1), row, count * sizeof(RET_VAL)) == 0) {
+            table->count += !table->used[at];
+            table->used[at] = 1;
+            memcpy(table->rows + at * (count + 1), row, (count + 1) * sizeof(RET_VAL));
+            return true;
+        }
     }
-    if(oplist->next != NULL) {
-        warning("cbrt called with extra operands");
+    if (evict) {
+        memcpy(table->rows + (home & (table->capacity - 1)) * (count + 1), row, (count + 1) * sizeof(RET_VAL));
     }
+    return evict;
+}
 
-    num = eval(oplist);
+// Moves table's rows to a table of capacity rows; those that no longer
+// fit their window are dropped.
+static void cacheResize(RESULT_CACHE *table, size_t count, size_t capacity) {
+    RESULT_CACHE old = *table;
+    table->capacity = capacity;
+    table->count = 0;
+    if ((table->rows = malloc(capacity * (count + 1) * sizeof(RET_VAL))) == NULL
+            || (table->used = calloc(capacity, 1)) == NULL) {
+        yyerror("Memory allocation failed!");
+    }
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.used[i]) {
+            cacheInsert(table, old.rows + i * (count + 1), count, false);
+        }
+    }
+    free(old.rows);
+    free(old.used);
+}
 
-    result.type = DOUBLE_TYPE;
-    result.value = cbrt(num.value);
-    return result;
+// Finds the result a memo function gave for args, if it is kept.
+bool resultCacheLookup(uint32_t lambda, RET_VAL *args, RET_VAL *result) {
+    RESULT_CACHE *table = &caches.tables[lambda];
+    size_t count = cacheWidth(lambda);
+    if (table->capacity == 0) {
+        return false;
+    }
+    size_t home = cacheHash(args, count);
+    for (size_t probe = 0; probe < CACHE_PROBES; probe++) {
+        size_t at = (home + probe) & (table->capacity - 1);
+        if (!table->used[at]) {
+            return false;
+        }
+        RET_VAL *row = table->rows + at * (count + 1);
+        if (memcmp(row, args, count * sizeof(RET_VAL)) == 0) {
+            *result = row[count];
+            return true;
+        }
+    }
+    return false;
 }
 
-RET_VAL evalHypot(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
-    result.value = 0;
+// Keeps the result a memo function gave for the arguments in params.
+void resultCacheStore(uint32_t lambda, BINDING_SLOT *params, RET_VAL result) {
+    RESULT_CACHE *table = &caches.tables[lambda];
+    size_t count = cacheWidth(lambda);
+    size_t limit = 1;
 
-    if(oplist == NULL) {
-        warning("hypot called with no operands, 0 returned");
-        return ZERO_RET_VAL;
+    if (options.memoSize == 0) {
+        return;
+    }
+    while (limit <= options.memoSize / 2) {
+        limit *= 2;
     }
+    AST_GROW(caches.row, 0, caches.rowCapacity, count + 1);
+    for (size_t i = 0; i < count; i++) {
+        caches.row[i] = cellRelease(params[i].value);
+    }
+    caches.row[count] = cellRelease(result);
+    slotKept(0);
 
-    while(oplist != NULL) {
-        num = eval(oplist);
-        result.value += pow(num.value, 2);
-        oplist = oplist->next;
+    if (table->capacity == 0) {
+        cacheResize(table, count, limit < CACHE_START ? limit : CACHE_START);
+    } else if (table->capacity < limit && 2 * table->count >= table->capacity) {
+        cacheResize(table, count, 2 * table->capacity);
+    }
+    while (!cacheInsert(table, caches.row, count, table->capacity >= limit)) {
+        cacheResize(table, count, 2 * table->capacity);
     }
-    result.type = DOUBLE_TYPE;
-    result.value = sqrt(result.value);
-    return result;
 }
 
-RET_VAL evalMin(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
+static void pushValue(RET_VAL value) {
+    AST_GROW(evaluator.values, evaluator.valueCount, evaluator.valueCapacity, 1);
+    evaluator.values[evaluator.valueCount++] = value;
+}
+
+static void pushTask(AST_ID node, uint32_t count, uint32_t memoSlot, int caller) {
+    AST_GROW(evaluator.tasks, evaluator.taskCount, evaluator.taskCapacity, 1);
+    EVAL_TASK *task = &evaluator.tasks[evaluator.taskCount++];
+    task->node = node;
+    task->next = 0;
+    task->count = count;
+    task->memo = memoSlot;
+    task->caller = caller;
+    task->slot = 0;
+    task->warnings = warningCount;
+}
+
+static void startNode(AST_ID node);
+
+// Starts a call: prints the arity warnings given before its operands
+// are evaluated, then either pushes its value, for a call with too few
+// operands, or a task to evaluate the operands it uses.
+static void startCall(AST_ID node, uint32_t memoSlot) {
+    FUNC_TYPE func = NODE(node).function.func;
+    size_t count = NODE(node).function.count;
+
+    switch (func) {
+        case NEG_FUNC:
+        case ABS_FUNC:
+        case EXP_FUNC:
+        case EXP2_FUNC:
+        case LOG_FUNC:
+        case SQRT_FUNC:
+        case CBRT_FUNC:
+            if (count == 0) {
+                warning("%s called with no operands, NAN returned", funcName(func));
+                pushValue(NAN_RET_VAL);
+                return;
+            }
+            if (count > 1) {
+                warning("%s called with extra operands", funcName(func));
+            }
+            count = 1;
+            break;
+        case SUB_FUNC:
+        case DIV_FUNC:
+        case REMAINDER_FUNC:
+        case POW_FUNC:
+        case LESS_FUNC:
+        case GREATER_FUNC:
+        case EQUAL_FUNC:
+            if (count < 2) {
+                warning(count == 0 ? "%s called with no operands, 0 returned" : "%s called with 1 operand, NAN returned", funcName(func));
+                pushValue(count == 0 ? ZERO_RET_VAL : NAN_RET_VAL);
+                return;
+            }
+            count = 2;
+            break;
+        case COND_FUNC:
+            if (count < 3) {
+                warning("%s called with too few operands, NAN returned", funcName(func));
+                pushValue(NAN_RET_VAL);
+                return;
+            }
+            count = 1;
+            break;
+        case AND_FUNC:
+        case OR_FUNC:
+            // one operand at a time, for finishLazy to go on from
+            count = count > 0;
+            break;
+        case ADD_FUNC:
+        case MULT_FUNC:
+        case HYPOT_FUNC:
+        case MIN_FUNC:
+        case MAX_FUNC:
+            if (count == 0) {
+                warning("%s called with no operands, 0 returned", funcName(func));
+                pushValue(ZERO_RET_VAL);
+                return;
+            }
+            break;
+        case VEC_FUNC:
+            break;
+        case CUSTOM_FUNC:
+        {
+            // undefined functions were already reported by resolveSymbols
+            AST_ID callee = NODE_CALLEE(node);
+            if (NODE(callee).symbol.depth < 0) {
+                pushValue(NAN_RET_VAL);
+                return;
+            }
+            AST_LAMBDA *lambda = &ast.lambdas[NODE(callee).symbol.lambda];
+            size_t params = (size_t) NODE_SCOPE(lambda->params)->slotCount;
+            if (count < params) {
+                warning("%s called with too few operands, NAN returned", symbolName(lambda->id));
+                pushValue(NAN_RET_VAL);
+                return;
+            }
+            count = params;
+            break;
+        }
+        default:
+            count = 0;
+            break;
+    }
+    pushTask(node, (uint32_t) count, memoSlot, 0);
+}
 
-    if(oplist == NULL) {
-        warning("min called with no operands, 0 returned");
-        return ZERO_RET_VAL;
+// The frame the scope depth scopes out from frame is in.
+static int outerFrame(int frame, int depth) {
+    for (; depth > 0; depth--) {
+        frame = evaluator.frames[frame].outer;
     }
-    num = eval(oplist);
-    result.value = num.value;
-    oplist = oplist->next;
+    return frame;
+}
 
-    while(oplist != NULL) {
-        num = eval(oplist);
-        if(result.value > num.value) {
-            result.type = num.type;
-            result.value = num.value;
+// Copies a function's captures into slots, reading them through env,
+// its closure. A binding that is not evaluated yet is forwarded to, so
+// that it is still evaluated once, where it is bound.
+static void copyCaptures(BINDING_SLOT *slots, AST_LAMBDA *lambda, int env) {
+    for (uint32_t i = 0; i < lambda->captureCount; i++) {
+        AST_CAPTURE *capture = &lambda->captures[i];
+        int frame = outerFrame(env, capture->depth);
+        BINDING_SLOT *source = &evaluator.slots[evaluator.frames[frame].base + capture->slot];
+        if (source->state == SLOT_READY || source->state == SLOT_FORWARDED) {
+            slots[i] = *source;
+        } else {
+            slots[i].state = SLOT_FORWARDED;
+            slots[i].value = (uint64_t) frame << 32 | (uint32_t) capture->slot;
         }
-        oplist = oplist->next;
     }
-    return result;
 }
 
-RET_VAL evalMax(AST_NODE *oplist) {
-    RET_VAL num;
-    RET_VAL result;
+// The frame a call of lambda through env may take over: the calling
+// function's, when the call is the last thing its body does (only let
+// scopes are left to finish above that function's task), the callee was
+// not bound inside it, and both cast their result alike. Neither may be
+// a memo function, whose result is kept as its frame is left. -1
+// otherwise.
+// *task is the calling function's task.
+static int tailFrame(AST_LAMBDA *lambda, int env, size_t *task) {
+    int frame = evaluator.currentFrame;
+    for (size_t i = evaluator.taskCount; i-- > 0;) {
+        AST_ID node = evaluator.tasks[i].node;
+        if (NODE_TYPE(node) != SCOPE_NODE_TYPE) {
+            return -1;
+        }
+        int caller = NODE_SCOPE(node)->lambda;
+        if (caller >= 0) {
+            *task = i;
+            return env < frame && ast.lambdas[caller].type == lambda->type
+                   && !ast.lambdas[caller].memo && !lambda->memo ? frame : -1;
+        }
+        frame = evaluator.frames[frame].outer;
+    }
+    return -1;
+}
+
+// Calls a let-bound function on its arguments, the top count values:
+// fills a frame with them and the captures, and starts the body. A memo
+// function's kept result is pushed instead, if it has one.
+static void startFunction(AST_ID node, size_t count) {
+    AST_ID callee = NODE_CALLEE(node);
+    uint32_t index = NODE(callee).symbol.lambda;
+    AST_LAMBDA *lambda = &ast.lambdas[index];
+    AST_SCOPE *params = NODE_SCOPE(lambda->params);
+    size_t task;
+
+    if (NODE(node).function.count > count) {
+        warning("%s called with too many operands, ignoring extra", symbolName(lambda->id));
+    }
 
-    if(oplist == NULL) {
-        warning("max called with no operands, 0 returned");
-        return ZERO_RET_VAL;
+    RET_VAL *args = evaluator.values + evaluator.valueCount - count;
+    RET_VAL kept;
+    if (lambda->memo && resultCacheLookup(index, args, &kept)) {
+        evaluator.valueCount -= count;
+        pushValue(kept);
+        return;
     }
-    num = eval(oplist);
-    result.value = num.value;
-    oplist = oplist->next;
 
-    while(oplist != NULL) {
-        num = eval(oplist);
-        if(result.value < num.value) {
-            result.type = num.type;
-            result.value = num.value;
+    int frame = outerFrame(evaluator.currentFrame, NODE(callee).symbol.depth);
+    int env = (int) evaluator.slots[evaluator.frames[frame].base + NODE(callee).symbol.slot].value;
+    int target = tailFrame(lambda, env, &task);
+    bool reusing = target >= 0;
+    bool sameCaptures = false;
+
+    if (target >= 0) {
+        SCOPE_FRAME *reused = &evaluator.frames[target];
+        sameCaptures = reused->scope == params && reused->outer == env;
+        reused->scope = params;
+        reused->outer = env;
+        evaluator.tasks[task].node = lambda->params;
+        evaluator.taskCount = task + 1;
+        evaluator.frameCount = (size_t) target + 1;
+        evaluator.slotCount = reused->base;
+    } else {
+        AST_GROW(evaluator.frames, evaluator.frameCount, evaluator.frameCapacity, 1);
+        target = (int) evaluator.frameCount++;
+        evaluator.frames[target].scope = params;
+        evaluator.frames[target].outer = env;
+        evaluator.frames[target].base = evaluator.slotCount;
+        pushTask(lambda->params, 0, 0, evaluator.currentFrame);
+    }
+
+    AST_GROW(evaluator.slots, evaluator.slotCount, evaluator.slotCapacity, count + lambda->captureCount);
+    BINDING_SLOT *slots = evaluator.slots + evaluator.slotCount;
+    size_t limit = evaluator.slotCount + count + lambda->captureCount;
+    args = evaluator.values + evaluator.valueCount - count;
+    if (reusing) {
+        tailArguments(slots, evaluator.slotCount, args, count, limit);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            slots[i].value = args[i];
+            slots[i].state = SLOT_READY;
         }
-        oplist = oplist->next;
+        callEnter(limit);
     }
-    return result;
+    if (!sameCaptures) {
+        copyCaptures(slots + count, lambda, env);
+    }
+    evaluator.slotCount = limit;
+    evaluator.valueCount -= count;
+    evaluator.currentFrame = target;
+    startNode(params->child);
 }
 
-RET_VAL evalFuncNode(AST_NODE *node)
-{
-    if (!node)
-    {
-        yyerror("NULL ast node passed into evalFuncNode!");
-        return NAN_RET_VAL; // unreachable but kills a clang-tidy warning
+// A shared call keeps its value in its memo slot.
+static void keepValue(EVAL_TASK *task, RET_VAL value) {
+    if (task->memo) {
+        memo.slots[task->memo - 1].value = value;
+        memo.slots[task->memo - 1].state = SLOT_READY;
+        slotKept(0);
     }
+}
 
-    AST_NODE *oplist = node->data.function.opList;
+// Whether a condition of cond, and or or holds. A vector warns and is
+// taken as false.
+static bool conditionHolds(FUNC_TYPE func, RET_VAL value) {
+    if (retIsVector(value)) {
+        warning("%s given a vector as a condition, taken as false", funcName(func));
+        return false;
+    }
+    return retIsTrue(value);
+}
 
-    switch (node->data.function.func) {
-        case NEG_FUNC: return evalNeg(oplist);
-        case ADD_FUNC: return evalAdd(oplist);
-        case ABS_FUNC: return evalAbs(oplist);
-        case SUB_FUNC: return evalSub(oplist);
-        case MULT_FUNC: return evalMult(oplist);
-        case DIV_FUNC: return evalDiv(oplist);
-        case REMAINDER_FUNC: return evalRemainder(oplist);
-        case EXP_FUNC: return evalExp(oplist);
-        case EXP2_FUNC: return evalExp2(oplist);
-        case POW_FUNC: return evalPow(oplist);
-        case LOG_FUNC: return evalLog(oplist);
-        case SQRT_FUNC: return evalSqrt(oplist);
-        case CBRT_FUNC: return evalCbrt(oplist);
-        case HYPOT_FUNC: return evalHypot(oplist);
-        case MIN_FUNC: return evalMin(oplist);
-        case MAX_FUNC: return evalMax(oplist);
-        default: return NAN_RET_VAL;
+// cond, and and or have evaluated their last operand so far, the top
+// value. cond goes on to the branch it picks, which takes the call's
+// place; a shared cond's task stays, marked by slot, to keep the
+// branch's value once it is on top. and and or go on to their next
+// operand while the result is still open, and give 1 or 0.
+static void finishLazy(EVAL_TASK *task) {
+    AST_ID node = task->node;
+    FUNC_TYPE func = NODE(node).function.func;
+    bool truth;
+
+    if (task->slot) {
+        keepValue(task, evaluator.values[evaluator.valueCount - 1]);
+        return;
+    }
+    if (func == COND_FUNC) {
+        truth = conditionHolds(func, evaluator.values[--evaluator.valueCount]);
+        if (NODE(node).function.count > 3) {
+            warning("%s called with too many operands, ignoring extra", funcName(func));
+        }
+        if (task->memo) {
+            task->slot = 1;
+            evaluator.taskCount++;
+        }
+        startNode(NODE_OPS(node)[truth ? 1 : 2]);
+        return;
     }
 
-    return NAN_RET_VAL;
+    if (task->count == 0) {
+        truth = func == AND_FUNC;
+    } else {
+        truth = conditionHolds(func, evaluator.values[--evaluator.valueCount]);
+        if (truth == (func == AND_FUNC) && task->count < NODE(node).function.count) {
+            task->count++;
+            evaluator.taskCount++;
+            return;
+        }
+    }
+    keepValue(task, retFromBool(truth));
+    pushValue(retFromBool(truth));
 }
 
-RET_VAL evalNumNode(AST_NODE *node)
-{
-    if (!node)
-    {
-        yyerror("NULL ast node passed into evalNumNode!");
-        return NAN_RET_VAL;
+// Combines a call's operands, the top task->count values, into its value.
+static void finishCall(EVAL_TASK *task) {
+    AST_ID node = task->node;
+    size_t count = task->count;
+    RET_VAL *vals = evaluator.values + evaluator.valueCount - count;
+    RET_VAL result;
+
+    switch (NODE(node).function.func) {
+        case CUSTOM_FUNC:
+            startFunction(node, count);
+            return;
+        case COND_FUNC:
+        case AND_FUNC:
+        case OR_FUNC:
+            finishLazy(task);
+            return;
+        default:
+            break;
     }
 
-    RET_VAL result = NAN_RET_VAL;
-    result.value = node->data.number.value;
-    result.type = node->data.number.type;
+    // sub, div, remainder and pow warn of operands they ignored once
+    // they have evaluated the two they use
+    if (count == 2 && NODE(node).function.count > 2) {
+        warning("%s called with too many operands, ignoring extra", funcName(NODE(node).function.func));
+    }
+    if (ast.numTypes[node] == DOUBLE_TYPE) {
+        result = retDouble(applyDoubleCall(node, vals, count));
+    } else {
+        result = applyCall(NODE(node).function.func, vals, count);
+    }
+    keepValue(task, result);
+    evaluator.valueCount -= count;
+    pushValue(result);
+}
+
+// A scope activation's binding slots are evaluated on first reference.
+// The closures of the functions it binds are the frame itself.
+static void startScope(AST_ID node) {
+    AST_SCOPE *scope = NODE_SCOPE(node);
+    size_t count = scope->slotCount;
+
+    AST_GROW(evaluator.frames, evaluator.frameCount, evaluator.frameCapacity, 1);
+    AST_GROW(evaluator.slots, evaluator.slotCount, evaluator.slotCapacity, count + scope->lambdaCount);
+
+    SCOPE_FRAME *frame = &evaluator.frames[evaluator.frameCount];
+    frame->scope = scope;
+    frame->outer = evaluator.currentFrame;
+    frame->base = evaluator.slotCount;
+    for (size_t i = 0; i < count; i++) {
+        evaluator.slots[frame->base + i].state = SLOT_UNEVALUATED;
+    }
+    for (size_t i = count; i < count + scope->lambdaCount; i++) {
+        evaluator.slots[frame->base + i].value = evaluator.frameCount;
+        evaluator.slots[frame->base + i].state = SLOT_READY;
+    }
+    evaluator.slotCount += count + scope->lambdaCount;
 
-    return result;
+    pushTask(node, 0, 0, evaluator.currentFrame);
+    evaluator.currentFrame = (int) evaluator.frameCount++;
 }
 
-RET_VAL evalScope(AST_NODE *node) {
-    if(!node) {
-        warning("null node passed to eval scope");
-        return NAN_RET_VAL;
+// A function's value takes its cast as its frame is left, and is taken
+// out of the frame's cells; a memo function's is kept unless the call
+// printed a warning.
+static void finishScope(EVAL_TASK *task) {
+    int lambda = NODE_SCOPE(task->node)->lambda;
+    RET_VAL *value = &evaluator.values[evaluator.valueCount - 1];
+    if (lambda >= 0 && ast.lambdas[lambda].type != NO_TYPE) {
+        *value = retCast(*value, ast.lambdas[lambda].type);
+    }
+    if (lambda >= 0) {
+        *value = cellRelease(*value);
     }
-    return eval((node->data.scope.child));
+    if (lambda >= 0 && ast.lambdas[lambda].memo && task->warnings == warningCount) {
+        resultCacheStore((uint32_t) lambda, &evaluator.slots[evaluator.frames[evaluator.currentFrame].base], *value);
+    }
+    if (lambda >= 0) {
+        callLeave();
+    }
+    evaluator.slotCount = evaluator.frames[evaluator.currentFrame].base;
+    evaluator.frameCount = (size_t) evaluator.currentFrame;
+    evaluator.currentFrame = task->caller;
 }
 
-RET_VAL evalSymbolNode(AST_NODE *node) {
-    if(!node) {
-        warning("null node passed to eval scope");
-        return NAN_RET_VAL;
+// Pushes a symbol's value, or a task that evaluates its bound
+// expression, once, in the frame of the scope that defines it. Returns
+// the binding's expression in the latter case, 0 otherwise.
+static AST_ID startSymbol(AST_ID node) {
+    // undefined symbols were already reported by resolveSymbols
+    if (NODE(node).symbol.depth < 0) {
+        pushValue(NAN_RET_VAL);
+        return 0;
+    }
+
+    int frame = outerFrame(evaluator.currentFrame, NODE(node).symbol.depth);
+    int index = NODE(node).symbol.slot;
+    BINDING_SLOT *slot = &evaluator.slots[evaluator.frames[frame].base + index];
+    if (slot->state == SLOT_FORWARDED) {
+        frame = (int) (slot->value >> 32);
+        index = (int) (uint32_t) slot->value;
+        slot = &evaluator.slots[evaluator.frames[frame].base + index];
+    }
+    if (slot->state == SLOT_READY) {
+        pushValue(slot->value);
+        return 0;
     }
+    if (slot->state == SLOT_EVALUATING) {
+        warning("symbol %s is defined in terms of itself, nan returned", symbolName(NODE(node).symbol.id));
+        pushValue(NAN_RET_VAL);
+        return 0;
+    }
+
+    slot->state = SLOT_EVALUATING;
+    pushTask(node, 0, 0, evaluator.currentFrame);
+    evaluator.tasks[evaluator.taskCount - 1].slot = index;
+    evaluator.currentFrame = frame;
+    return SCOPE_SLOT(evaluator.frames[frame].scope, index)->value;
+}
 
-    AST_NODE *currScope = node;
+// The binding's value is on top of the value stack, and its frame current.
+static void finishSymbol(EVAL_TASK *task) {
+    SCOPE_FRAME *frame = &evaluator.frames[evaluator.currentFrame];
+    SYMBOL_TABLE_NODE *table = SCOPE_SLOT(frame->scope, task->slot);
+    BINDING_SLOT *slot = &evaluator.slots[frame->base + task->slot];
+    RET_VAL *value = &evaluator.values[evaluator.valueCount - 1];
+
+    if (table->type != NO_TYPE && table->type != ast.numTypes[table->value]) {
+        *value = retCast(*value, table->type);
+    }
+    slot->value = *value;
+    slot->state = SLOT_READY;
+    slotKept(frame->base + task->slot);
+    evaluator.currentFrame = task->caller;
+}
 
-    while(currScope != NULL) {
-        SYMBOL_TABLE_NODE *table = currScope->symbolTable;
-        while(table != NULL) {
-            if(strcmp(table->id, node->data.symbol.id) == 0) {
-                RET_VAL toReturn = eval(table->value);
-                if (table->type != NO_TYPE) {
-                    toReturn.type = table->type;
+// Starts evaluating node: pushes its value if that is at hand, or the
+// tasks to compute it. Scopes and symbols go straight on to the node
+// they evaluate, so only calls are left with operands to start.
+static void startNode(AST_ID node) {
+    for (;;) {
+        if (!node) {
+            yyerror("NULL ast node passed into eval!");
+        }
+        switch (NODE_TYPE(node)) {
+            case NUM_NODE_TYPE:
+                pushValue(NODE(node).number);
+                return;
+            case FUNC_NODE_TYPE:
+            {
+                uint32_t memoSlot = NODE(node).function.memo;
+                if (memoSlot && memo.slots[memoSlot - 1].state == SLOT_READY) {
+                    pushValue(memo.slots[memoSlot - 1].value);
+                    return;
                 }
-                return toReturn;
+                startCall(node, memoSlot);
+                return;
             }
-            table = table->next;
+            case SCOPE_NODE_TYPE:
+                startScope(node);
+                node = NODE_SCOPE(node)->child;
+                break;
+            case SYM_NODE_TYPE:
+                if ((node = startSymbol(node)) == 0) {
+                    return;
+                }
+                break;
+            default:
+                pushValue(NAN_RET_VAL);
+                return;
+        }
+    }
+}
+
+// Runs the tasks above bottom to the end and pops the value they leave.
+static RET_VAL runTasks(size_t bottom) {
+    while (evaluator.taskCount > bottom) {
+        EVAL_TASK *task = &evaluator.tasks[evaluator.taskCount - 1];
+        if (task->next < task->count) {
+            startNode(NODE_OPS(task->node)[task->next++]);
+            continue;
         }
-        if(currScope->parent == NULL) {
+
+        evaluator.taskCount--;
+        switch (NODE_TYPE(task->node)) {
+            case FUNC_NODE_TYPE: finishCall(task); break;
+            case SCOPE_NODE_TYPE: finishScope(task); break;
+            default: finishSymbol(task); break;
         }
-        currScope = currScope->parent;
     }
-    warning("undefined symbol, nan returned");
-    return NAN_RET_VAL;
+    return evaluator.values[--evaluator.valueCount];
 }
 
-RET_VAL eval(AST_NODE *node)
+// A call's value, worked out afresh even if it is shared (foldConstants
+// uses this on calls of numbers before there are memo slots).
+RET_VAL evalFuncNode(AST_ID node)
 {
     if (!node)
     {
-        yyerror("NULL ast node passed into eval!");
-        return NAN_RET_VAL;
+        yyerror("NULL ast node passed into evalFuncNode!");
+        return NAN_RET_VAL; // unreachable but kills a clang-tidy warning
     }
 
-    if(node->type == NUM_NODE_TYPE) {
-        return evalNumNode(node);
-    } else if (node->type == FUNC_NODE_TYPE) {
-        return evalFuncNode(node);
-    } else if(node->type == SCOPE_NODE_TYPE) {
-        return evalScope(node);
-    } else if(node->type == SYM_NODE_TYPE) {
-        return evalSymbolNode(node);
+    size_t bottom = evaluator.taskCount;
+    startCall(node, 0);
+    return runTasks(bottom);
+}
+
+RET_VAL eval(AST_ID node)
+{
+    if (!node)
+    {
+        yyerror("NULL ast node passed into eval!");
+        return NAN_RET_VAL;
     }
 
-    return NAN_RET_VAL;
+    size_t bottom = evaluator.taskCount;
+    startNode(node);
+    return runTasks(bottom);
 }
 
-// prints the type and value of a RET_VAL
-void printRetVal(RET_VAL val)
+// Evaluates one resolved top-level program with the selected engine.
+// The bytecode VM is the default, with hot numeric expressions handed to
+// the JIT; --engine=tree walks the AST with eval.
+RET_VAL evalProgram(AST_ID program)
 {
-    switch (val.type)
+    RET_VAL result;
+
+    resultCacheReset();
+    calls.count = 0;
+    if (options.engine == VM_ENGINE)
     {
-        case INT_TYPE:
-            printf("Integer : %.lf\n", val.value);
-            break;
-        case DOUBLE_TYPE:
-            printf("Double : %lf\n", val.value);
-            break;
-        default:
-            printf("No Type : %lf\n", val.value);
-            break;
+        if (jitEvaluate(program, &result))
+        {
+            return result;
+        }
+        if (vmCompile(program))
+        {
+            return vmExecute();
+        }
     }
+    memoReset();
+    return eval(program);
 }
 
+// Resolves and simplifies a parsed top-level program, then prints its value
+// (or, with --emit-c, compiles it to C).
+static void runPasses(AST_ID program)
+{
+    program = resolveSymbols(program, 0);
 
+    if (options.dumpAst)
+    {
+        dumpAst("AST: ", program);
+    }
+    if (options.fold)
+    {
+        foldConstants(program);
+        if (options.dumpAst)
+        {
+            dumpAst("folded: ", program);
+        }
+    }
+    if (options.prune)
+    {
+        program = pruneScopes(program);
+        if (options.dumpAst)
+        {
+            dumpAst("pruned: ", program);
+        }
+    }
+    if (options.infer)
+    {
+        inferTypes(program);
+    }
 
-void freeNode(AST_NODE *node)
-{
-    if (!node)
+    if (options.emitC)
     {
+        emitCProgram(program);
         return;
     }
+    printRetVal(evalProgram(program));
+}
 
-    // TODO complete the function
+static void *runPassesThread(void *program)
+{
+    runPasses((AST_ID) (uintptr_t) program);
+    return NULL;
+}
 
-    // look through the AST_NODE struct, decide what
-    // referenced data should have freeNode called on it
-    // (hint: it might be part of an s_expr_list, with more
-    // nodes following it in the list)
+// The passes before evaluation (resolveSymbols through vmCompile, and
+// the JIT and --emit-c) recurse once per level of nesting, and through
+// a symbol into its binding's value. A program the parser found could
+// take them DEEP_PROGRAM levels or more may go deeper than the C stack
+// allows, so it is run on a thread with DEEP_FRAME_BYTES of stack per
+// level, of which only the pages a pass reaches are ever touched.
+#define DEEP_PROGRAM 16384
+#define DEEP_FRAME_BYTES 1024
 
-    // if this node is FUNC_TYPE, it might have some operands
-    // to free as well (but this should probably be done in
-    // a call to another function, named something like
-    // freeFunctionNode)
+void runProgram(AST_ID program)
+{
+    pthread_attr_t attributes;
+    pthread_t thread;
 
-    // and, finally,
+    if (ast.depths[program] < DEEP_PROGRAM)
+    {
+        runPasses(program);
+        return;
+    }
 
-   if (node->type == FUNC_NODE_TYPE) {
-        freeNode(node->data.function.opList);
+    if (pthread_attr_init(&attributes) != 0
+        || pthread_attr_setstacksize(&attributes, (size_t) ast.depths[program] * DEEP_FRAME_BYTES) != 0
+        || pthread_create(&thread, &attributes, runPassesThread, (void *) (uintptr_t) program) != 0)
+    {
+        yyerror("Memory allocation failed!");
     }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attributes);
+}
 
-    free(node);
+// prints the type and value of a RET_VAL
+void printRetVal(RET_VAL val)
+{
+    switch (retType(val))
+    {
+        case INT_TYPE:
+            if (retIsInt64(val))
+            {
+                printf("Integer : %" PRId64 "\n", retInt64Of(val));
+            }
+            else if (retIsBig(val))
+            {
+                printf("Integer : ");
+                bigPrint(val);
+                printf("\n");
+            }
+            else
+            {
+                printf("Integer : ");
+                printf(options.hexDoubles ? "%a\n" : "%.lf\n", retValue(val));
+            }
+            break;
+        case DOUBLE_TYPE:
+            printf("Double : ");
+            printf(options.hexDoubles ? "%a\n" : "%lf\n", retValue(val));
+            break;
+        case VECTOR_TYPE:
+            printf("Vector : ");
+            vecPrint(val);
+            printf("\n");
+            break;
+        default:
+            printf("No Type : ");
+            printf(options.hexDoubles ? "%a\n" : "%lf\n", retValue(val));
+            break;
+    }
 }
@@ -7,22 +7,42 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
-#define NAN_RET_VAL (RET_VAL){DOUBLE_TYPE, NAN}
-#define ZERO_RET_VAL (RET_VAL){INT_TYPE, 0}
+#define NAN_RET_VAL retDouble(NAN)
+#define ZERO_RET_VAL RET_INT_TAG
 
 
 #define BISON_FLEX_LOG_PATH "bison_flex.log"
-FILE* read_target;
-FILE* flex_bison_log_file;
+extern FILE* read_target;
+extern FILE* flex_bison_log_file;
 size_t yyreadline(char **lineptr, size_t *n, FILE *stream, size_t n_terminate);
 
+// Bulk reader for regular files (mmap) and pipes (block reads), see yyreadprint.c
+typedef struct {
+    char *base;         // mapped file or block buffer
+    size_t size;        // bytes of input in base
+    size_t capacity;    // block buffer size, 0 when mapped
+    size_t pos;         // start of the next line
+    int fd;
+    bool eof;
+    char *savedAt;      // input bytes hidden under the current line's terminators
+    char saved[2];
+    char *tail;         // reusable copy of the final line
+    size_t tailSize;
+} YY_BULK_READER;
+
+bool yybulkopen(YY_BULK_READER *reader, FILE *stream);
+size_t yybulkline(YY_BULK_READER *reader, char **lineptr, size_t n_terminate);
+
 
 int yyparse(void);
 int yylex(void);
 void yyerror(char *, ...);
 void warning(char*, ...);
+extern size_t warningCount;     // warnings printed so far
 
 
 typedef enum func_type {
@@ -42,6 +62,13 @@ typedef enum func_type {
     HYPOT_FUNC,
     MAX_FUNC,
     MIN_FUNC,
+    LESS_FUNC,
+    GREATER_FUNC,
+    EQUAL_FUNC,
+    COND_FUNC,      // cond, and and or only evaluate the operands they need
+    AND_FUNC,
+    OR_FUNC,
+    VEC_FUNC,
     CUSTOM_FUNC
 } FUNC_TYPE;
 
@@ -49,9 +76,17 @@ typedef enum func_type {
 FUNC_TYPE resolveFunc(char *);
 
 
+// Handle of an interned identifier; equal names have equal handles.
+typedef uint32_t SYMBOL_ID;
+
+SYMBOL_ID internSymbol(char *name, size_t length);
+char *symbolName(SYMBOL_ID id);
+
+
 typedef enum num_type {
     INT_TYPE,
     DOUBLE_TYPE,
+    VECTOR_TYPE,
     NO_TYPE
 } NUM_TYPE;
 
@@ -61,12 +96,406 @@ typedef struct {
     double value;
 } AST_NUMBER;
 
-typedef AST_NUMBER RET_VAL;
+// Values are NaN-boxed into one 64-bit word. A DOUBLE is stored as its
+// own bits, with any NaN canonicalized to the quiet NaN of its sign.
+// Everything else lives in the quiet NaNs with the sign bit clear and a
+// nonzero tag in bits 48-50, which arithmetic never produces:
+//   tag 1: an INT with an integral value that fits in 48 bits;
+//   tag 2: a pointer to an arena AST_NUMBER, for the INT values that
+//          aren't integers in int64 range (fractions, -0, huge, inf,
+//          nan) and for NO_TYPE;
+//   tag 3: a pointer to an arena int64_t, for the other integral INTs;
+//   tag 4: a pointer to an arena BIGNUM, for the integers beyond int64
+//          that the integer kernels compute (see bignum.c);
+//   tag 5: a pointer to an arena VECTOR, for VECTOR_TYPE (see vector.c);
+//   tag 6: an INT that div left as a fraction of two integers below
+//          2^23, held as the pair: dividing them again gives the same
+//          bits, without boxing the quotient.
+// Tag 7 is free for later boxed kinds. Read a RET_VAL with retType
+// and retValue, build one with makeRetVal (or retInt / retDouble).
+typedef uint64_t RET_VAL;
+
+#define RET_QUIET_NAN UINT64_C(0x7FF8000000000000)
+#define RET_SIGN UINT64_C(0x8000000000000000)
+#define RET_INT_TAG UINT64_C(0x7FF9000000000000)
+#define RET_BOX_TAG UINT64_C(0x7FFA000000000000)
+#define RET_INT64_TAG UINT64_C(0x7FFB000000000000)
+#define RET_BIG_TAG UINT64_C(0x7FFC000000000000)
+#define RET_VEC_TAG UINT64_C(0x7FFD000000000000)
+#define RET_FRAC_TAG UINT64_C(0x7FFE000000000000)
+#define RET_TAGGED_SPAN UINT64_C(0x0007000000000000)
+#define RET_PAYLOAD UINT64_C(0x0000FFFFFFFFFFFF)
+#define RET_INT_LIMIT 0x1p47
+#define RET_INT64_LIMIT 0x1p63
+#define RET_FRAC_LIMIT (INT64_C(1) << 23)
+#define RET_FRAC_MASK UINT64_C(0xFFFFFF)
+
+RET_VAL boxRetVal(NUM_TYPE type, double value);
+RET_VAL boxInt64(int64_t value);
+RET_VAL intLiteral(char *text);
+double bigToDouble(RET_VAL val);
+
+static inline bool retIsDouble(RET_VAL val)
+{
+    return val - RET_INT_TAG >= RET_TAGGED_SPAN;
+}
+
+// The double in a RET_VAL that retIsDouble.
+static inline double retDoubleOf(RET_VAL val)
+{
+    double value;
+    memcpy(&value, &val, sizeof(value));
+    return value;
+}
+
+static inline RET_VAL retDouble(double value)
+{
+    RET_VAL val;
+    memcpy(&val, &value, sizeof(val));
+    if (value != value)
+    {
+        val = (val & RET_SIGN) | RET_QUIET_NAN;
+    }
+    return val;
+}
+
+static inline RET_VAL retFromInt(int64_t i)
+{
+    if (i > -(INT64_C(1) << 47) && i < (INT64_C(1) << 47))
+    {
+        return RET_INT_TAG | ((uint64_t) i & RET_PAYLOAD);
+    }
+    return boxInt64(i);
+}
+
+static inline RET_VAL retInt(double value)
+{
+    if (value > -RET_INT64_LIMIT && value < RET_INT64_LIMIT)
+    {
+        int64_t i = (int64_t) value;
+        if ((double) i == value && (i != 0 || !signbit(value)))
+        {
+            return retFromInt(i);
+        }
+    }
+    return boxRetVal(INT_TYPE, value);
+}
+
+static inline RET_VAL makeRetVal(NUM_TYPE type, double value)
+{
+    switch (type)
+    {
+        case DOUBLE_TYPE: return retDouble(value);
+        case INT_TYPE: return retInt(value);
+        default: return boxRetVal(type, value);
+    }
+}
+
+// Tag 6 INTs: whether dividend / divisor fits one, making one, and its value.
+static inline bool retFitsFraction(int64_t dividend, int64_t divisor)
+{
+    return dividend > -RET_FRAC_LIMIT && dividend < RET_FRAC_LIMIT
+        && divisor > -RET_FRAC_LIMIT && divisor < RET_FRAC_LIMIT && divisor != 0;
+}
+
+static inline RET_VAL retFraction(int64_t dividend, int64_t divisor)
+{
+    return RET_FRAC_TAG | ((uint64_t) dividend & RET_FRAC_MASK) | ((uint64_t) divisor & RET_FRAC_MASK) << 24;
+}
+
+static inline double retFractionOf(RET_VAL val)
+{
+    return (double) ((int64_t) (val << 40) >> 40) / (double) ((int64_t) (val << 16) >> 40);
+}
+
+static inline int64_t *retInt64Box(RET_VAL val)
+{
+    return (int64_t *) (uintptr_t) (val & RET_PAYLOAD);
+}
+
+static inline NUM_TYPE retType(RET_VAL val)
+{
+    if (retIsDouble(val))
+    {
+        return DOUBLE_TYPE;
+    }
+    if (val < RET_BOX_TAG)
+    {
+        return INT_TYPE;
+    }
+    if (val >= RET_VEC_TAG)
+    {
+        return val >= RET_FRAC_TAG ? INT_TYPE : VECTOR_TYPE;
+    }
+    if (val >= RET_INT64_TAG)
+    {
+        return INT_TYPE;
+    }
+    return ((AST_NUMBER *) (uintptr_t) (val & RET_PAYLOAD))->type;
+}
+
+// A VECTOR has no single value, and reads as nan.
+static inline double retValue(RET_VAL val)
+{
+    if (retIsDouble(val))
+    {
+        return retDoubleOf(val);
+    }
+    if (val < RET_BOX_TAG)
+    {
+        return (double) ((int64_t) (val << 16) >> 16);
+    }
+    if (val >= RET_FRAC_TAG)
+    {
+        return retFractionOf(val);
+    }
+    if (val >= RET_BIG_TAG)
+    {
+        return val >= RET_VEC_TAG ? NAN : bigToDouble(val);
+    }
+    if (val >= RET_INT64_TAG)
+    {
+        return (double) *retInt64Box(val);
+    }
+    return ((AST_NUMBER *) (uintptr_t) (val & RET_PAYLOAD))->value;
+}
+
+// val as a value of the given type. INTs stay exact when they already
+// are one; other values go through their double. Vectors hold doubles
+// whatever they are cast to, so a cast leaves them alone.
+static inline RET_VAL retCast(RET_VAL val, NUM_TYPE type)
+{
+    NUM_TYPE current = retType(val);
+    return current == type || current == VECTOR_TYPE ? val : makeRetVal(type, retValue(val));
+}
+
+// Integer kernels. INTs that are integers in int64 range (tags 1 and 3)
+// are added, subtracted, multiplied, divided and raised to powers as
+// int64_t; a step that would overflow carries on with bignums, and
+// mixing in a non-integer falls back to the doubles.
+#define RET_EXACT_TERMS 64      // tagged INTs that always add up without overflow
+
+static inline bool retIsInt(RET_VAL val)
+{
+    return val - RET_INT_TAG < RET_BOX_TAG - RET_INT_TAG;
+}
+
+static inline int64_t retIntOf(RET_VAL val)
+{
+    return (int64_t) (val << 16) >> 16;
+}
+
+// DOUBLEs and tag 1 INTs hold their value in the word itself, exact as a
+// double. add, sub, mult and div of a pair of them that isn't two INTs
+// give the DOUBLE of their doubles, and min and max compare their
+// doubles, the same as the general paths do.
+static inline bool retIsPlain(RET_VAL val)
+{
+    return val - RET_BOX_TAG >= RET_TAGGED_SPAN - (RET_BOX_TAG - RET_INT_TAG);
+}
+
+static inline double retPlainOf(RET_VAL val)
+{
+    return retIsInt(val) ? (double) retIntOf(val) : retDoubleOf(val);
+}
+
+static inline bool retIsInt64(RET_VAL val)
+{
+    return retIsInt(val) || (val & ~RET_PAYLOAD) == RET_INT64_TAG;
+}
+
+// The integer in a RET_VAL that retIsInt64.
+static inline int64_t retInt64Of(RET_VAL val)
+{
+    return retIsInt(val) ? retIntOf(val) : *retInt64Box(val);
+}
+
+static inline bool retIsBig(RET_VAL val)
+{
+    return (val & ~RET_PAYLOAD) == RET_BIG_TAG;
+}
+
+// An INT that is an exact integer: an int64 or a bignum.
+static inline bool retIsInteger(RET_VAL val)
+{
+    return retIsInt64(val) || retIsBig(val);
+}
+
+int bigCompare(RET_VAL a, RET_VAL b);
+
+// a < b, as min and max compare values
+static inline bool retLess(RET_VAL a, RET_VAL b)
+{
+    if (retIsInt(a) && retIsInt(b))
+    {
+        return retIntOf(a) < retIntOf(b);
+    }
+    if (retIsInt64(a) && retIsInt64(b))
+    {
+        return retInt64Of(a) < retInt64Of(b);
+    }
+    if (retIsInteger(a) && retIsInteger(b))
+    {
+        return bigCompare(a, b) < 0;
+    }
+    return retValue(a) < retValue(b);
+}
+
+// a == b, exactly for integers, as equal compares values
+static inline bool retEqual(RET_VAL a, RET_VAL b)
+{
+    if (retIsInt64(a) && retIsInt64(b))
+    {
+        return retInt64Of(a) == retInt64Of(b);
+    }
+    if (retIsInteger(a) && retIsInteger(b))
+    {
+        return bigCompare(a, b) == 0;
+    }
+    return retValue(a) == retValue(b);
+}
+
+// The INT 1 or 0 that less, greater, equal, and and or give.
+static inline RET_VAL retFromBool(bool truth)
+{
+    return ZERO_RET_VAL + (uint64_t) truth;
+}
+
+// Whether a condition holds: anything but zero does, nan included (as
+// in C). A vector reads as nan; cond, and and or warn of one instead.
+static inline bool retIsTrue(RET_VAL val)
+{
+    return retIsInt(val) ? val != ZERO_RET_VAL : retValue(val) != 0;
+}
+
+// *sum += val, if val is an integer and the sum doesn't overflow.
+static inline bool retAddInt(int64_t *sum, RET_VAL val)
+{
+    int64_t result;
+    if (!retIsInt64(val) || __builtin_add_overflow(*sum, retInt64Of(val), &result))
+    {
+        return false;
+    }
+    *sum = result;
+    return true;
+}
+
+// *product *= val, if val is an integer and the product doesn't overflow.
+// Zero products are left to the doubles, which know the sign of zero.
+static inline bool retMultInt(int64_t *product, RET_VAL val)
+{
+    int64_t result;
+    if (!retIsInt64(val) || retInt64Of(val) == 0 || __builtin_mul_overflow(*product, retInt64Of(val), &result))
+    {
+        return false;
+    }
+    *product = result;
+    return true;
+}
+
+// base ** exponent by squaring, for a non-negative exponent, if it
+// doesn't overflow.
+static inline bool retPowInt(int64_t base, int64_t exponent, int64_t *result)
+{
+    int64_t power = 1;
+    while (exponent > 0)
+    {
+        if ((exponent & 1) && __builtin_mul_overflow(power, base, &power))
+        {
+            return false;
+        }
+        exponent >>= 1;
+        if (exponent > 0 && __builtin_mul_overflow(base, base, &base))
+        {
+            return false;
+        }
+    }
+    *result = power;
+    return true;
+}
+
+// Bignum kernels, the slow paths of the integer kernels above. They take
+// INTs that retIsInteger and give exact INTs, as int64s when they fit.
+// Those returning bool give up (for the doubles) on a result of more
+// than BIG_MAX_LIMBS limbs, and bigDiv on a division that leaves a
+// remainder.
+typedef struct {
+    uint32_t *limbs;    // magnitude, least significant first
+    uint32_t count;     // limbs in use, without leading zeros
+    uint32_t capacity;
+    bool negative;
+} BIGNUM;
+
+RET_VAL bigLiteral(char *text);
+RET_VAL bigNeg(RET_VAL a);
+RET_VAL bigSub(RET_VAL a, RET_VAL b);
+bool bigDiv(RET_VAL a, RET_VAL b, RET_VAL *result);
+RET_VAL bigRemainder(RET_VAL a, RET_VAL b);
+bool bigPow(RET_VAL base, int64_t exponent, RET_VAL *result);
+void bigPrint(RET_VAL val);
+
+// Running sums and products of add and mult once they overflow int64,
+// kept in pooled limbs until bigAccFinish boxes them or bigAccDouble
+// hands them to the doubles. bigAccMult refuses zero, whose sign only
+// the doubles know.
+void bigAccStart(BIGNUM *acc, int64_t value);
+void bigAccAdd(BIGNUM *acc, RET_VAL val);
+bool bigAccMult(BIGNUM *acc, RET_VAL val);
+RET_VAL bigAccFinish(BIGNUM *acc);
+double bigAccDouble(BIGNUM *acc);
+
+// Packed double vectors, made by vec. Every builtin but cond, and and or
+// works on them element by element, with scalar operands broadcast to
+// every element, the comparisons giving 1 or 0 in each; see vector.c. A
+// vector as a condition warns and is taken as false. The values live in
+// the arena with the header.
+typedef struct {
+    uint32_t count;
+    double *values;
+} VECTOR;
+
+static inline bool retIsVector(RET_VAL val)
+{
+    return (val & ~RET_PAYLOAD) == RET_VEC_TAG;
+}
+
+static inline VECTOR *retVectorOf(RET_VAL val)
+{
+    return (VECTOR *) (uintptr_t) (val & RET_PAYLOAD);
+}
+
+// vecMap and vecZip apply a builtin to a vector, or to a pair of operands
+// at least one of which is; vecFold carries a variadic call on from acc
+// over the rest of its operands. owned says a is a vector nobody else
+// holds, which the result may overwrite.
+RET_VAL vecMake(RET_VAL *vals, size_t count);
+RET_VAL vecMap(FUNC_TYPE func, RET_VAL a, bool owned);
+RET_VAL vecZip(FUNC_TYPE func, RET_VAL a, RET_VAL b, bool owned);
+RET_VAL vecFold(FUNC_TYPE func, RET_VAL acc, RET_VAL *vals, size_t count);
+void vecPrint(RET_VAL val);
+
+// Reductions of arrays of doubles, for the wide calls (see retSum).
+// vecMinIndex and vecMaxIndex pick the element a left to right
+// min or max in applyCall would, and need at least one.
+double vecSum(const double *values, size_t count);
+double vecProduct(const double *values, size_t count);
+double vecSumSquares(const double *values, size_t count);
+size_t vecMinIndex(const double *values, size_t count);
+size_t vecMaxIndex(const double *values, size_t count);
+
 
+// Nodes are referred to by AST_ID, an index into the arrays of "ast".
+// Id 0 is never a node; the parser uses it for expressions it could not parse.
+typedef uint32_t AST_ID;
 
-typedef struct ast_function {
+// A CUSTOM_FUNC call is a call of a let-bound function; its operands are
+// followed in ast.children by a symbol node naming the function (see
+// NODE_CALLEE).
+typedef struct {
     FUNC_TYPE func;
-    struct ast_node *opList;
+    uint32_t start;     // first operand in ast.children
+    uint32_t count;
+    uint32_t memo;      // memo slot + 1 if evaluated from several places, see resolveSymbols
 } AST_FUNCTION;
 
 
@@ -77,47 +506,284 @@ typedef enum ast_node_type {
     SCOPE_NODE_TYPE
 } AST_NODE_TYPE;
 
+// A symbol's lexical address, filled in by resolveSymbols:
+// the binding lives in slot "slot" of the scope "depth" scopes out
+// from the innermost scope enclosing the reference.
+// depth is -1 for symbols that are not bound anywhere.
+// The name of a called function is resolved the same way, among the
+// functions, to the slot that holds its closure.
 typedef struct {
-    char* id;
+    SYMBOL_ID id;
+    int depth;
+    int slot;
+    uint32_t lambda;    // a called function's index in ast.lambdas
 } AST_SYMBOL;
 
+// Scope nodes only hold their position in ast.scopes, so the common
+// node kinds set the size of AST_DATA.
 typedef struct {
-    struct ast_node *child;
+    AST_ID child;
+    AST_ID outer;               // next enclosing scope
+    uint32_t firstSlot;         // bindings in source order, in ast.bindings
+    int slotCount;
+    uint32_t *index;            // hashed slots of wide scopes, see SYMBOL_TABLE
+    size_t indexSize;
+    uint32_t firstLambda;       // functions bound here, in ast.lambdas
+    int lambdaCount;
+    int lambda;                 // for a function's parameters, its index in ast.lambdas, else -1
 } AST_SCOPE;
 
-typedef struct ast_node {
-    AST_NODE_TYPE type;
-    struct ast_node *parent;
-    struct symbol_table_node *symbolTable;
-    union {
-        AST_NUMBER number;
-        AST_FUNCTION function;
-        AST_SYMBOL symbol;
-        AST_SCOPE scope;
-    } data;
-    struct ast_node *next;
-} AST_NODE;
+typedef union {
+    RET_VAL number;
+    AST_FUNCTION function;
+    AST_SYMBOL symbol;
+    uint32_t scope;
+} AST_DATA;
 
 typedef struct symbol_table_node {
-    char *id;
-    AST_NODE *value;
-    struct symbol_table_node *next;
+    SYMBOL_ID id;
     NUM_TYPE type;
+    AST_ID value;
 } SYMBOL_TABLE_NODE;
 
-AST_NODE *createNumberNode(double value, NUM_TYPE type);
-AST_NODE *createFunctionNode(FUNC_TYPE func, AST_NODE *opList);
-AST_NODE *addExpressionToList(AST_NODE *newExpr, AST_NODE *exprList);
-AST_NODE *createSymbolNode(char *id);
-SYMBOL_TABLE_NODE *createSymbol(char *id, AST_NODE *value);
-AST_NODE *createScopeNode(SYMBOL_TABLE_NODE *symbolTable, AST_NODE *child);
-SYMBOL_TABLE_NODE *addSymbolToTable(SYMBOL_TABLE_NODE *new, SYMBOL_TABLE_NODE *table);
-SYMBOL_TABLE_NODE *createTypedSymbol(char *id, AST_NODE *value, bool type);
+// A variable or function from outside a function's body that the body
+// uses: its address from the scope binding the function, and for a
+// function, which one it is.
+typedef struct {
+    SYMBOL_ID id;
+    bool function;
+    int depth;
+    int slot;
+    uint32_t lambda;
+} AST_CAPTURE;
+
+// A function bound in a let section. Its parameters are the bindings of
+// a scope node of their own, params, whose child is the body. A function
+// is a flat closure: resolveSymbols turns everything its body uses from
+// outside into captures, which a call copies into its frame after the
+// arguments, so the body never looks past its own frame.
+// A memo function keeps its results by arguments (see resultCacheLookup).
+typedef struct ast_lambda {
+    SYMBOL_ID id;
+    NUM_TYPE type;              // cast of the result, NO_TYPE for none
+    AST_ID params;
+    AST_CAPTURE *captures;      // in the arena
+    uint32_t captureCount, captureCapacity;
+    bool memo;
+} AST_LAMBDA;
+
+// The program being parsed, struct-of-arrays: a type tag and a 16 byte
+// AST_DATA per node, operand ranges in one shared child array and let
+// bindings in another. The parser stacks the operands and bindings of
+// the lists it is in the middle of; nested lists are finished first, so
+// each list is contiguous at the top of its stack when its node is made.
+// Calls are hash-consed as they are made (see createFunctionNode), so a
+// program can be a DAG; callIndex is an open-addressing set of its
+// function nodes. Everything is reset, keeping the buffers, by astReset.
+typedef struct {
+    uint8_t *types;                     // AST_NODE_TYPE of each node
+    uint8_t *numTypes;                  // NUM_TYPE it evaluates to, NO_TYPE if unknown, see inferTypes
+    uint32_t *depths;                   // how deep the passes can recurse from it, see runProgram
+    AST_DATA *data;
+    size_t count, capacity;
+    AST_ID *children;
+    size_t childCount, childCapacity;
+    SYMBOL_TABLE_NODE *bindings;
+    size_t bindingCount, bindingCapacity;
+    AST_SCOPE *scopes;
+    size_t scopeCount, scopeCapacity;
+    AST_LAMBDA *lambdas;
+    size_t lambdaCount, lambdaCapacity;
+
+    AST_ID *pendingOps;
+    size_t pendingOpCount, pendingOpCapacity;
+    SYMBOL_TABLE_NODE *pendingBindings;
+    size_t pendingBindingCount, pendingBindingCapacity;
+    AST_LAMBDA *pendingLambdas;
+    size_t pendingLambdaCount, pendingLambdaCapacity;
+
+    AST_ID *callIndex;
+    size_t callCount, callIndexSize;
+    size_t reuseCount;                  // calls that reused an earlier node
+    size_t memoCount;                   // memo slots handed out by resolveSymbols
+} AST;
+
+extern AST ast;
+
+#define NODE_TYPE(id) ((AST_NODE_TYPE) ast.types[id])
+#define NODE(id) (ast.data[id])
+#define NODE_OPS(id) (ast.children + ast.data[id].function.start)
+#define NODE_SCOPE(id) (&ast.scopes[ast.data[id].scope])
+#define NODE_CALLEE(id) (NODE_OPS(id)[ast.data[id].function.count])
+#define SCOPE_SLOT(scope, slot) (&ast.bindings[(scope)->firstSlot + (slot)])
+
+// Tables with more than SCOPE_HASH_THRESHOLD bindings also keep an
+// open-addressing index: a power-of-two array of item positions + 1
+// (0 marks an empty bucket), probed linearly from a hash of the SYMBOL_ID.
+#define SCOPE_HASH_THRESHOLD 8
+
+// A let list being parsed: its bindings are ast.pendingBindings[start...]
+// and its functions ast.pendingLambdas[lambdaStart...]
+typedef struct symbol_table {
+    size_t start;
+    size_t count;
+    uint32_t *index;
+    size_t indexSize;
+    size_t lambdaStart;
+    size_t lambdaCount;
+} SYMBOL_TABLE;
+
+// One activation of a scope while it is being evaluated.
+// Binding values are computed on first reference and cached in the
+// frame's slots on the binding stack until the scope is left. A let
+// scope's bindings are followed by the closures of the functions it
+// binds, each the index of the frame itself; a call's frame holds the
+// arguments and then the captures, and its outer is the closure.
+typedef enum {
+    SLOT_UNEVALUATED,
+    SLOT_EVALUATING,
+    SLOT_READY,
+    SLOT_FORWARDED      // captured unevaluated: value is frame << 32 | slot of the binding
+} SLOT_STATE;
+
+typedef struct {
+    RET_VAL value;
+    SLOT_STATE state;
+} BINDING_SLOT;
+
+typedef struct {
+    AST_SCOPE *scope;
+    int outer;                  // activation of the enclosing scope, -1 for none
+    size_t base;                // first slot on the binding stack
+} SCOPE_FRAME;
+
+AST_ID createNumberNode(double value, NUM_TYPE type);
+AST_ID createIntNode(RET_VAL value);
+AST_ID createFunctionNode(FUNC_TYPE func, uint32_t opList);
+AST_ID createCallNode(SYMBOL_ID id, uint32_t opList);
+uint32_t createExpressionList(AST_ID expr);
+uint32_t addExpressionToList(uint32_t exprList, AST_ID newExpr);
+AST_ID createSymbolNode(SYMBOL_ID id);
+SYMBOL_TABLE_NODE *createSymbol(SYMBOL_ID id, AST_ID value);
+AST_ID createScopeNode(SYMBOL_TABLE *symbolTable, AST_ID child);
+SYMBOL_TABLE *createSymbolTable(SYMBOL_TABLE_NODE *symbol);
+SYMBOL_TABLE *addSymbolToTable(SYMBOL_TABLE *table, SYMBOL_TABLE_NODE *new);
+SYMBOL_TABLE_NODE *createTypedSymbol(SYMBOL_ID id, AST_ID value, bool type);
+AST_LAMBDA *createLambda(SYMBOL_ID id, AST_ID params, NUM_TYPE type, bool memo);
+SYMBOL_TABLE *addLambdaToTable(SYMBOL_TABLE *table, AST_LAMBDA *new);
+void astReset(void);
+
+AST_ID resolveSymbols(AST_ID node, AST_ID scope);
+AST_ID copyNode(AST_ID node);
+bool callIsSilent(FUNC_TYPE func, size_t count);
+bool astMakesVectors(void);
+
+// exp, exp2, log, cbrt and pow, one argument at a time and over arrays
+// of doubles (for vectors, pow with vector.c's operand steps): libm's,
+// or the approximations of fastmath.c with --math=fast (for the arrays,
+// and cbrt one at a time; see fastmath.c).
+typedef struct {
+    double (*exp)(double);
+    double (*exp2)(double);
+    double (*log)(double);
+    double (*cbrt)(double);
+    double (*pow)(double, double);
+    void (*expMap)(double *out, const double *a, size_t n);
+    void (*exp2Map)(double *out, const double *a, size_t n);
+    void (*logMap)(double *out, const double *a, size_t n);
+    void (*cbrtMap)(double *out, const double *a, size_t n);
+    void (*powZip)(double *out, const double *a, size_t aStep, const double *b, size_t bStep, size_t n);
+} MATH_FUNCS;
+
+extern const MATH_FUNCS libmMath;
+
+// The approximations working on width (1, 2, 4 or 8) doubles at a time,
+// NULL if this CPU can't; width 0 picks the widest it can.
+const MATH_FUNCS *fastMath(int width);
+
+typedef enum {
+    VM_ENGINE,
+    TREE_ENGINE
+} ENGINE_TYPE;
+
+typedef enum {
+    JIT_AUTO,       // compile expression shapes once they are hot
+    JIT_ALWAYS,
+    JIT_OFF
+} JIT_MODE;
+
+// Command line options, set by main
+typedef struct {
+    ENGINE_TYPE engine;
+    JIT_MODE jit;
+    bool emitC;     // translate to C instead of evaluating
+    bool fold;      // run foldConstants before evaluating
+    bool prune;     // then pruneScopes
+    bool infer;     // then inferTypes
+    bool dumpAst;   // print each program before and after those passes
+    bool hexDoubles;    // print doubles with %a, so results compare bit for bit
+    const MATH_FUNCS *math;     // libmMath, or fastMath with --math=fast
+    size_t memoSize;            // most results a memo function keeps, 0 to keep none
+} CILISP_OPTIONS;
+
+extern CILISP_OPTIONS options;
+
+char *funcName(FUNC_TYPE func);
+
+bool vmCompile(AST_ID program);
+RET_VAL vmExecute(void);
+
+bool jitEvaluate(AST_ID program, RET_VAL *result);
+
+void emitCText(char *text);
+void emitCWarning(char *message);
+void emitCError(char *message);
+void emitCProgram(AST_ID program);
+
+RET_VAL evalProgram(AST_ID program);
+void runProgram(AST_ID program);
+
+void foldConstants(AST_ID program);
+AST_ID pruneScopes(AST_ID program);
+void inferTypes(AST_ID program);
+void dumpAst(char *label, AST_ID program);
+
+RET_VAL eval(AST_ID node);
+RET_VAL evalFuncNode(AST_ID node);
+
+void resultCacheReset(void);
+bool resultCacheLookup(uint32_t lambda, RET_VAL *args, RET_VAL *result);
+void resultCacheStore(uint32_t lambda, BINDING_SLOT *params, RET_VAL result);
+
+RET_VAL cellRelease(RET_VAL val);
+void callEnter(size_t limit);
+void callLeave(void);
+void slotKept(size_t slot);
+void tailArguments(BINDING_SLOT *slots, size_t base, RET_VAL *args, size_t count, size_t limit);
+
+RET_VAL retNeg(RET_VAL num);
+RET_VAL retAbs(RET_VAL num);
+RET_VAL retSub(RET_VAL a, RET_VAL b);
+RET_VAL retDiv(RET_VAL a, RET_VAL b);
+RET_VAL retRemainder(RET_VAL a, RET_VAL b);
+RET_VAL retPow(RET_VAL a, RET_VAL b);
+
+// add, mult, hypot, min and max of RET_WIDE_CALL operands or more, on
+// their evaluated operands. The doubles of a sum, product or hypot are
+// reduced pairwise, in SIMD lanes (see vector.c), rather than one by one
+// from the left: a different rounding, the same on every engine.
+#define RET_WIDE_CALL 16
 
-RET_VAL eval(AST_NODE *node);
+RET_VAL retSum(RET_VAL *vals, size_t count);
+RET_VAL retProduct(RET_VAL *vals, size_t count);
+RET_VAL retHypot(RET_VAL *vals, size_t count);
+RET_VAL retMin(RET_VAL *vals, size_t count);
+RET_VAL retMax(RET_VAL *vals, size_t count);
 
 void printRetVal(RET_VAL val);
 
-void freeNode(AST_NODE *node);
+void *arenaAlloc(size_t size);
+char *arenaStrdup(char *str);
+void arenaReset(void);
 
 #endif
@@ -1,25 +1,37 @@
 %{
     #include "cilisp.h"
-    #define ylog(r, p) {fprintf(flex_bison_log_file, "BISON: %s ::= %s \n", #r, #p); fflush(flex_bison_log_file);}
+    #define ylog(r, p) {fprintf(flex_bison_log_file, "BISON: %s ::= %s \n", #r, #p);}
     int yylex();
     void yyerror(char*, ...);
+    // Nesting is bounded by memory, not by bison's default 10000: the
+    // parser stacks are heap-allocated and double as they fill.
+    #define YYMAXDEPTH (PTRDIFF_MAX / 64)
 %}
 
 %union {
     double dval;
+    RET_VAL number;
     int ival;
-    char *sval;
-    struct ast_node *astNode;
+    SYMBOL_ID symbol;
+    AST_ID astNode;
+    uint32_t astList;
     struct symbol_table_node *symTNode;
+    struct symbol_table *symTable;
+    struct ast_lambda *lambda;
 };
 
 %token <ival> FUNC
-%token <dval> INT DOUBLE
-%token <sval> SYMBOL
-%token QUIT EOL EOFT LPAREN RPAREN LET INT_TYPECAST DOUBLE_TYPECAST
-
-%type <astNode> s_expr number f_expr s_expr_section s_expr_list
-%type <symTNode> let_section let_elem let_list
+%token <number> INT
+%token <dval> DOUBLE
+%token <symbol> SYMBOL
+%token QUIT EOL EOFT LPAREN RPAREN LET INT_TYPECAST DOUBLE_TYPECAST LAMBDA MEMO
+
+%type <astNode> s_expr number f_expr
+%type <astList> s_expr_section s_expr_list
+%type <symTNode> let_elem
+%type <lambda> lambda_elem
+%type <ival> lambda_kind
+%type <symTable> let_section let_list param_list
 
 %%
 
@@ -27,17 +39,19 @@ program:
     s_expr EOL {
         ylog(program, s_expr EOL);
         if ($1) {
-            printRetVal(eval($1));
-            freeNode($1);
+            runProgram($1);
         }
+        astReset();
+        arenaReset();
         YYACCEPT;
     }
     | s_expr EOFT {
         ylog(program, s_expr EOFT);
         if ($1) {
-            printRetVal(eval($1));
-            freeNode($1);
+            runProgram($1);
         }
+        astReset();
+        arenaReset();
         exit(EXIT_SUCCESS);
     }
     | EOL {
@@ -55,7 +69,7 @@ number:
         $$ = createNumberNode($1, DOUBLE_TYPE);
         } | INT {
         ylog(number, INT_TYPE);
-        $$ = createNumberNode($1, INT_TYPE);
+        $$ = createIntNode($1);
 
         }
 
@@ -63,6 +77,9 @@ f_expr:
     LPAREN FUNC s_expr_section RPAREN {
         ylog(f_expr, LPAREN FUNC s_expr_section RPAREN);
         $$ = createFunctionNode($2, $3);
+    } | LPAREN SYMBOL s_expr_section RPAREN {
+        ylog(f_expr, LPAREN SYMBOL s_expr_section RPAREN);
+        $$ = createCallNode($2, $3);
     }
 
 s_expr_section:
@@ -70,14 +87,18 @@ s_expr_section:
         ylog(s_expr_section, s_expr_list);
     } | {
         ylog(s_expr_section, empty);
-        $$ = NULL;
+        $$ = (uint32_t) ast.pendingOpCount;
     }
 
+// Lists are left recursive so bison reduces after every element and
+// the parser stack stays flat however many operands there are.
+// Operands go on ast.pendingOps; a list's value is where it starts.
 s_expr_list:
     s_expr {
         ylog(s_expr_list, s_expr);
-     } | s_expr s_expr_list {
-        ylog(s_expr, s_expr_list);
+        $$ = createExpressionList($1);
+     } | s_expr_list s_expr {
+        ylog(s_expr_list, s_expr_list s_expr);
         $$ = addExpressionToList($1, $2);
      }
 
@@ -92,7 +113,7 @@ s_expr:
     }| error {
         ylog(s_expr, error);
         yyerror("unexpected token");
-        $$ = NULL;
+        $$ = 0;
     } | SYMBOL {
         ylog(s_expr, SYMBOL);
         $$ = createSymbolNode($1);
@@ -110,10 +131,16 @@ s_expr:
     let_list:
         let_elem {
             ylog(let_list, let_elem);
-            $$ = $1;
-        }| let_elem let_list {
-            ylog(let_list, let_elem let_list);
+            $$ = createSymbolTable($1);
+        }| lambda_elem {
+            ylog(let_list, lambda_elem);
+            $$ = addLambdaToTable(createSymbolTable(NULL), $1);
+        }| let_list let_elem {
+            ylog(let_list, let_list let_elem);
             $$ = addSymbolToTable($1, $2);
+        }| let_list lambda_elem {
+            ylog(let_list, let_list lambda_elem);
+            $$ = addLambdaToTable($1, $2);
         };
 
     let_elem:
@@ -128,5 +155,37 @@ s_expr:
             $$ = createTypedSymbol($3, $4, false);
         };
 
+    // The parameters are bound in a scope of their own around the body.
+    lambda_elem:
+        LPAREN SYMBOL lambda_kind LPAREN param_list RPAREN s_expr RPAREN {
+            ylog(lambda_elem, LPAREN SYMBOL lambda_kind LPAREN param_list RPAREN s_expr RPAREN);
+            $$ = createLambda($2, createScopeNode($5, $7), NO_TYPE, $3);
+        } | LPAREN INT_TYPECAST SYMBOL lambda_kind LPAREN param_list RPAREN s_expr RPAREN {
+            ylog(lambda_elem, LPAREN INT_TYPECAST SYMBOL lambda_kind LPAREN param_list RPAREN s_expr RPAREN);
+            $$ = createLambda($3, createScopeNode($6, $8), INT_TYPE, $4);
+        } | LPAREN DOUBLE_TYPECAST SYMBOL lambda_kind LPAREN param_list RPAREN s_expr RPAREN {
+            ylog(lambda_elem, LPAREN DOUBLE_TYPECAST SYMBOL lambda_kind LPAREN param_list RPAREN s_expr RPAREN);
+            $$ = createLambda($3, createScopeNode($6, $8), DOUBLE_TYPE, $4);
+        };
+
+    // (f memo lambda (n) ...) keeps f's results
+    lambda_kind:
+        LAMBDA {
+            ylog(lambda_kind, LAMBDA);
+            $$ = false;
+        } | MEMO LAMBDA {
+            ylog(lambda_kind, MEMO LAMBDA);
+            $$ = true;
+        };
+
+    param_list:
+        {
+            ylog(param_list, empty);
+            $$ = createSymbolTable(NULL);
+        } | param_list SYMBOL {
+            ylog(param_list, param_list SYMBOL);
+            $$ = addSymbolToTable($1, createSymbol($2, 0));
+        };
+
 %%
 
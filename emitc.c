@@ -0,0 +1,1377 @@
+#include "cilisp.h"
+
+// Ahead-of-time compiler: --emit-c turns a CILisp program into C.
+//
+// Each top-level expression becomes a straight-line function returning
+// a RET_VAL, built from small helpers that repeat the arithmetic and
+// typing rules of retNeg, retDiv, applyCall's add and the rest. Arity
+// warnings are emitted as warning() calls at the point eval would print
+// them, and let bindings are computed at their first reference, so the
+// compiled program prints exactly what the interpreter would.
+// cond, and and or become if statements. A binding computed on only some
+// of their paths gets a flag, set where it was computed and tested where
+// it is next referenced.
+// Literals are read from a global table rather than written inline, so
+// the C compiler cannot fold libm calls at build time (its correctly
+// rounded results can differ from libm's in the last bit, and the sign
+// of a folded NaN can differ too). INTs that are integers in int64
+// range are carried as long long, as the interpreter carries them, and
+// their literals go in a second table. The interpreter's bignums are not
+// compiled: beyond int64, compiled programs compute INTs in doubles, and
+// the first integer step that overflows int64, or bignum literal, prints
+// a warning saying so.
+// Neither are vectors; vec compiles to a warning and nan.
+// A let-bound function becomes a GNU C nested function of the function
+// its let is compiled into, so that its body reaches what it captures by
+// name; a function never outlives its let, so neither does the frame it
+// reads. A call a function makes of itself in tail position jumps back
+// to its start; other calls, recursion included, run on the C stack.
+// Wide calls
+// (RET_WIDE_CALL operands or more) of add, mult and hypot are reduced
+// by a plain C copy of the pairwise reduction in vector.c. Compiled
+// programs always call libm; --math=fast is ignored with --emit-c.
+//
+// Everything else the interpreter would have printed (prompts, echoed
+// lines, parse and resolve warnings, errors) is replayed by the
+// generated main. The C source is written to stdout when the
+// interpreter exits.
+
+typedef struct {
+    char *text;
+    size_t size;
+    size_t capacity;
+} C_BUFFER;
+
+static C_BUFFER functions;
+static C_BUFFER mainBody;
+// the statements, variables and nested functions of the C function
+// being emitted
+static C_BUFFER *body;
+static C_BUFFER *declarations;
+static C_BUFFER *definitions;
+static C_BUFFER literals;
+static C_BUFFER intLiterals;
+
+static int programCount = 0;
+static int tempCount;
+static int literalCount;
+static int intLiteralCount;
+static int functionCount;
+static bool getters;
+static bool registered = false;
+
+// What the code emitted so far has done with a binding. MAYBE_READY is
+// a binding computed on some paths only: its flag says which one ran.
+typedef enum {
+    C_UNEVALUATED,
+    C_EVALUATING,
+    C_READY,
+    C_MAYBE_READY
+} C_STATE;
+
+// let bindings of the expression being compiled: state, and variable number
+static struct {
+    C_STATE *states;
+    size_t count;
+    size_t capacity;
+} bindings;
+
+typedef struct c_scope {
+    AST_SCOPE *node;
+    int base;
+    int functions;          // number of the first function it binds
+    struct c_scope *outer;
+} C_SCOPE;
+
+typedef struct {
+    C_BUFFER variables;     // and forward declarations of nested functions
+    C_BUFFER nested;
+    C_BUFFER statements;
+    bool restarts;          // a tail call of itself jumps to start
+} C_FUNCTION;
+
+typedef struct {
+    C_BUFFER *body;
+    C_BUFFER *declarations;
+    C_BUFFER *definitions;
+} C_OUTER;
+
+static const char *prelude =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <stdarg.h>\n"
+    "#include <stdbool.h>\n"
+    "#include <limits.h>\n"
+    "#include <math.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "#define RED             \"\\033[31m\"\n"
+    "#define RESET_COLOR     \"\\033[0m\"\n"
+    "\n"
+    "typedef enum { INT_TYPE, DOUBLE_TYPE, NO_TYPE } NUM_TYPE;\n"
+    "typedef struct { NUM_TYPE type; bool exact; long long i; double value; } RET_VAL;\n"
+    "\n"
+    "// Helpers a program may not use; -Wall stays quiet about those.\n"
+    "#define CL_HELPER static __attribute__((unused))\n"
+    "\n"
+    "static long cl_warnings = 0;\n"
+    "\n"
+    "CL_HELPER void warning(char *format, ...)\n"
+    "{\n"
+    "    char buffer[256];\n"
+    "    va_list args;\n"
+    "    cl_warnings++;\n"
+    "    va_start(args, format);\n"
+    "    vsnprintf(buffer, 255, format, args);\n"
+    "    printf(RED \"WARNING: %s\\n\" RESET_COLOR, buffer);\n"
+    "    fflush(stdout);\n"
+    "    va_end(args);\n"
+    "}\n"
+    "\n"
+    "CL_HELPER void error(char *message)\n"
+    "{\n"
+    "    printf(RED \"\\nERROR: %s\\nExiting...\\n\" RESET_COLOR, message);\n"
+    "    fflush(stdout);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "CL_HELPER void printRetVal(RET_VAL val)\n"
+    "{\n"
+    "    switch (val.type)\n"
+    "    {\n"
+    "        case INT_TYPE:\n"
+    "            if (val.exact) printf(\"Integer : %lld\\n\", val.i);\n"
+    "            else printf(\"Integer : %.lf\\n\", val.value);\n"
+    "            break;\n"
+    "        case DOUBLE_TYPE: printf(\"Double : %lf\\n\", val.value); break;\n"
+    "        default: printf(\"No Type : %lf\\n\", val.value); break;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline RET_VAL cl_int(long long i) { RET_VAL v = { INT_TYPE, true, i, (double) i }; return v; }\n"
+    "static inline RET_VAL cl_num(NUM_TYPE type, double value)\n"
+    "{\n"
+    "    if (type == INT_TYPE && value > -0x1p63 && value < 0x1p63 && (double) (long long) value == value && (value != 0 || !signbit(value)))\n"
+    "        return cl_int((long long) value);\n"
+    "    RET_VAL v = { type, false, 0, value };\n"
+    "    return v;\n"
+    "}\n"
+    "static bool cl_overflowed = false;\n"
+    "CL_HELPER void cl_overflow(void)\n"
+    "{\n"
+    "    if (cl_overflowed) return;\n"
+    "    cl_overflowed = true;\n"
+    "    printf(RED \"WARNING: INTs beyond int64 are computed in doubles by --emit-c, results may be inexact\\n\" RESET_COLOR);\n"
+    "    fflush(stdout);\n"
+    "}\n"
+    "static inline RET_VAL cl_cast(RET_VAL v, NUM_TYPE type) { return v.type == type ? v : cl_num(type, v.value); }\n"
+    "static inline NUM_TYPE cl_type(RET_VAL a, RET_VAL b) { return a.type == DOUBLE_TYPE || b.type == DOUBLE_TYPE ? DOUBLE_TYPE : INT_TYPE; }\n"
+    "static inline bool cl_less(RET_VAL a, RET_VAL b) { return a.exact && b.exact ? a.i < b.i : a.value < b.value; }\n"
+    "static inline bool cl_equal(RET_VAL a, RET_VAL b) { return a.exact && b.exact ? a.i == b.i : a.value == b.value; }\n"
+    "static inline bool cl_true(RET_VAL a) { return a.exact ? a.i != 0 : a.value != 0; }\n"
+    "static inline bool cl_pow_int(long long base, long long exponent, long long *result)\n"
+    "{\n"
+    "    long long power = 1;\n"
+    "    for (; exponent > 0; exponent >>= 1)\n"
+    "    {\n"
+    "        if ((exponent & 1) && __builtin_mul_overflow(power, base, &power)) { cl_overflow(); return false; }\n"
+    "        if (exponent > 1 && __builtin_mul_overflow(base, base, &base)) { cl_overflow(); return false; }\n"
+    "    }\n"
+    "    *result = power;\n"
+    "    return true;\n"
+    "}\n"
+    "static inline RET_VAL cl_neg(RET_VAL a)\n"
+    "{\n"
+    "    if (a.exact && a.i == LLONG_MIN) cl_overflow();\n"
+    "    return a.exact && a.i != 0 && a.i != LLONG_MIN ? cl_int(-a.i) : cl_num(a.type, -(a.value));\n"
+    "}\n"
+    "static inline RET_VAL cl_abs(RET_VAL a)\n"
+    "{\n"
+    "    if (a.exact && a.i == LLONG_MIN) cl_overflow();\n"
+    "    return a.exact && a.i != LLONG_MIN ? cl_int(a.i < 0 ? -a.i : a.i) : cl_num(a.type, fabs(a.value));\n"
+    "}\n"
+    "static inline RET_VAL cl_exp(RET_VAL a) { return cl_num(DOUBLE_TYPE, exp(a.value)); }\n"
+    "static inline RET_VAL cl_exp2(RET_VAL a) { double value = exp2(a.value); return cl_num(value < 0 ? DOUBLE_TYPE : a.type, value); }\n"
+    "static inline RET_VAL cl_log(RET_VAL a) { return cl_num(DOUBLE_TYPE, log(a.value)); }\n"
+    "static inline RET_VAL cl_sqrt(RET_VAL a) { return cl_num(DOUBLE_TYPE, sqrt(a.value)); }\n"
+    "static inline RET_VAL cl_cbrt(RET_VAL a) { return cl_num(DOUBLE_TYPE, cbrt(a.value)); }\n"
+    "static inline RET_VAL cl_sub(RET_VAL a, RET_VAL b)\n"
+    "{\n"
+    "    long long i;\n"
+    "    if (a.exact && b.exact)\n"
+    "    {\n"
+    "        if (!__builtin_sub_overflow(a.i, b.i, &i)) return cl_int(i);\n"
+    "        cl_overflow();\n"
+    "    }\n"
+    "    return cl_num(cl_type(a, b), a.value - b.value);\n"
+    "}\n"
+    "static inline RET_VAL cl_div(RET_VAL a, RET_VAL b)\n"
+    "{\n"
+    "    if (a.exact && b.exact && b.i != 0 && !(a.i == LLONG_MIN && b.i == -1) && a.i % b.i == 0 && (a.i != 0 || b.i > 0))\n"
+    "        return cl_int(a.i / b.i);\n"
+    "    return cl_num(cl_type(a, b), a.value / b.value);\n"
+    "}\n"
+    "static inline RET_VAL cl_remainder(RET_VAL a, RET_VAL b)\n"
+    "{\n"
+    "    if (a.exact && b.exact && b.i != 0)\n"
+    "    {\n"
+    "        long long i = b.i == -1 ? 0 : a.i % b.i;\n"
+    "        return cl_int(i < 0 ? -i : i);\n"
+    "    }\n"
+    "    return cl_num(cl_type(a, b), fabs(fmod(a.value, b.value)));\n"
+    "}\n"
+    "static inline RET_VAL cl_pow(RET_VAL a, RET_VAL b)\n"
+    "{\n"
+    "    long long i;\n"
+    "    if (a.exact && b.exact && b.i >= 0 && cl_pow_int(a.i, b.i, &i)) return cl_int(i);\n"
+    "    return cl_num(cl_type(a, b), pow(a.value, b.value));\n"
+    "}\n"
+    "static inline void cl_add(RET_VAL *acc, bool *dbl, RET_VAL v)\n"
+    "{\n"
+    "    long long i;\n"
+    "    if (acc->exact && v.exact)\n"
+    "    {\n"
+    "        if (!__builtin_add_overflow(acc->i, v.i, &i)) { *acc = cl_int(i); return; }\n"
+    "        cl_overflow();\n"
+    "    }\n"
+    "    acc->exact = false; acc->type = v.type; *dbl |= v.type == DOUBLE_TYPE; acc->value += v.value;\n"
+    "}\n"
+    "static inline void cl_mult(RET_VAL *acc, bool *dbl, RET_VAL v)\n"
+    "{\n"
+    "    long long i;\n"
+    "    if (acc->exact && v.exact && v.i != 0)\n"
+    "    {\n"
+    "        if (!__builtin_mul_overflow(acc->i, v.i, &i)) { *acc = cl_int(i); return; }\n"
+    "        cl_overflow();\n"
+    "    }\n"
+    "    acc->exact = false; acc->type = v.type; *dbl |= v.type == DOUBLE_TYPE; acc->value = acc->value * v.value;\n"
+    "}\n"
+    "static inline RET_VAL cl_total(RET_VAL acc, bool dbl) { return acc.exact ? acc : cl_num(dbl ? DOUBLE_TYPE : acc.type, acc.value); }\n"
+    "static inline void cl_hypot(RET_VAL *acc, RET_VAL v) { acc->value += pow(v.value, 2); }\n"
+    "static inline void cl_min(RET_VAL *acc, RET_VAL v) { if (cl_less(v, *acc)) *acc = v; }\n"
+    "static inline void cl_max(RET_VAL *acc, RET_VAL v) { if (cl_less(*acc, v)) *acc = v; }\n"
+    "enum { CL_SUM, CL_PRODUCT, CL_SQUARES };\n"
+    "CL_HELPER double cl_lanes(const double *x, size_t n, int op)\n"
+    "{\n"
+    "    double lane[8];\n"
+    "    for (int k = 0; k < 8; k++) lane[k] = op == CL_PRODUCT ? 1.0 : -0.0;\n"
+    "    for (size_t i = 0; i < n; i++)\n"
+    "    {\n"
+    "        double l = lane[i % 8], y = x[i];\n"
+    "        lane[i % 8] = op == CL_PRODUCT ? l * y : op == CL_SQUARES ? l + y * y : l + y;\n"
+    "    }\n"
+    "    if (op == CL_PRODUCT) return ((lane[0] * lane[1]) * (lane[2] * lane[3])) * ((lane[4] * lane[5]) * (lane[6] * lane[7]));\n"
+    "    return ((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7]));\n"
+    "}\n"
+    "CL_HELPER double cl_pairwise(const double *x, size_t n, int op)\n"
+    "{\n"
+    "    if (n <= 256) return cl_lanes(x, n, op);\n"
+    "    double low = cl_pairwise(x, n / 2, op), high = cl_pairwise(x + n / 2, n - n / 2, op);\n"
+    "    return op == CL_PRODUCT ? low * high : low + high;\n"
+    "}\n"
+    "CL_HELPER RET_VAL cl_wide(int op, const RET_VAL *v, size_t n)\n"
+    "{\n"
+    "    long long acc = op == CL_PRODUCT, i;\n"
+    "    size_t k = 0;\n"
+    "    if (op == CL_SUM)\n"
+    "        while (k < n && v[k].exact && !__builtin_add_overflow(acc, v[k].i, &i)) acc = i, k++;\n"
+    "    else if (op == CL_PRODUCT)\n"
+    "        while (k < n && v[k].exact && v[k].i != 0 && !__builtin_mul_overflow(acc, v[k].i, &i)) acc = i, k++;\n"
+    "    if (k == n) return cl_int(acc);\n"
+    "    if (op != CL_SQUARES && v[k].exact && (op == CL_SUM || v[k].i != 0)) cl_overflow();\n"
+    "    double value = op == CL_SQUARES ? 0 : (double) acc;\n"
+    "    double x[n - k];\n"
+    "    bool dbl = false;\n"
+    "    for (size_t j = k; j < n; j++) { x[j - k] = v[j].value; dbl |= v[j].type == DOUBLE_TYPE; }\n"
+    "    double rest = cl_pairwise(x, n - k, op);\n"
+    "    if (op == CL_SQUARES) return cl_num(DOUBLE_TYPE, sqrt(value + rest));\n"
+    "    return cl_num(dbl ? DOUBLE_TYPE : v[n - 1].type, op == CL_PRODUCT ? value * rest : value + rest);\n"
+    "}\n"
+    "typedef struct { RET_VAL *entries; bool *used; size_t count, capacity; } CL_MEMO;\n"
+    "static inline bool cl_same(RET_VAL a, RET_VAL b) { return a.type == b.type && a.exact == b.exact && a.i == b.i && memcmp(&a.value, &b.value, sizeof(double)) == 0; }\n"
+    "CL_HELPER size_t cl_slot(const CL_MEMO *memo, const RET_VAL *args, size_t n)\n"
+    "{\n"
+    "    unsigned long long hash = 14695981039346656037ULL, bits;\n"
+    "    for (size_t k = 0; k < n; k++)\n"
+    "    {\n"
+    "        memcpy(&bits, &args[k].value, sizeof bits);\n"
+    "        hash = (hash ^ bits ^ (unsigned long long) args[k].i ^ (unsigned long long) args[k].type) * 1099511628211ULL;\n"
+    "    }\n"
+    "    size_t h = (size_t) (hash ^ hash >> 32) & (memo->capacity - 1);\n"
+    "    while (memo->used[h])\n"
+    "    {\n"
+    "        const RET_VAL *entry = memo->entries + h * (n + 1);\n"
+    "        size_t k = 0;\n"
+    "        while (k < n && cl_same(entry[k], args[k])) k++;\n"
+    "        if (k == n) break;\n"
+    "        h = (h + 1) & (memo->capacity - 1);\n"
+    "    }\n"
+    "    return h;\n"
+    "}\n"
+    "CL_HELPER bool cl_recall(const CL_MEMO *memo, const RET_VAL *args, size_t n, RET_VAL *result)\n"
+    "{\n"
+    "    if (memo->capacity == 0) return false;\n"
+    "    size_t h = cl_slot(memo, args, n);\n"
+    "    if (!memo->used[h]) return false;\n"
+    "    *result = memo->entries[h * (n + 1) + n];\n"
+    "    return true;\n"
+    "}\n"
+    "CL_HELPER void cl_keep(CL_MEMO *memo, const RET_VAL *args, size_t n, RET_VAL result)\n"
+    "{\n"
+    "    if (2 * (memo->count + 1) > memo->capacity)\n"
+    "    {\n"
+    "        CL_MEMO old = *memo;\n"
+    "        memo->capacity = old.capacity ? 2 * old.capacity : 16;\n"
+    "        memo->entries = malloc(memo->capacity * (n + 1) * sizeof(RET_VAL));\n"
+    "        memo->used = calloc(memo->capacity, sizeof(bool));\n"
+    "        memo->count = 0;\n"
+    "        if (memo->entries == NULL || memo->used == NULL) error(\"Memory allocation failed!\");\n"
+    "        for (size_t h = 0; h < old.capacity; h++)\n"
+    "            if (old.used[h]) cl_keep(memo, old.entries + h * (n + 1), n, old.entries[h * (n + 1) + n]);\n"
+    "        free(old.entries);\n"
+    "        free(old.used);\n"
+    "    }\n"
+    "    size_t h = cl_slot(memo, args, n);\n"
+    "    if (!memo->used[h]) { memo->used[h] = true; memo->count++; }\n"
+    "    if (n > 0) memcpy(memo->entries + h * (n + 1), args, n * sizeof(RET_VAL));\n"
+    "    memo->entries[h * (n + 1) + n] = result;\n"
+    "}\n"
+    "\n";
+
+static void bufferPrintf(C_BUFFER *buffer, char *format, ...)
+{
+    va_list args;
+    int needed;
+
+    va_start(args, format);
+    needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (buffer->size + needed + 1 > buffer->capacity)
+    {
+        buffer->capacity = 2 * (buffer->size + needed + 1);
+        if ((buffer->text = realloc(buffer->text, buffer->capacity)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+
+    va_start(args, format);
+    vsnprintf(buffer->text + buffer->size, needed + 1, format, args);
+    va_end(args);
+    buffer->size += needed;
+}
+
+// Appends text as a C string literal.
+static void bufferString(C_BUFFER *buffer, char *text)
+{
+    bufferPrintf(buffer, "\"");
+    for (unsigned char *c = (unsigned char *) text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            bufferPrintf(buffer, "\\%c", *c);
+        }
+        else if (*c == '\n')
+        {
+            bufferPrintf(buffer, "\\n");
+        }
+        else if (*c < ' ' || *c >= 0x7F)
+        {
+            bufferPrintf(buffer, "\\%03o", *c);
+        }
+        else
+        {
+            bufferPrintf(buffer, "%c", *c);
+        }
+    }
+    bufferPrintf(buffer, "\"");
+}
+
+// Writes a double so that it reads back exactly.
+static void bufferDouble(C_BUFFER *buffer, double value)
+{
+    if (isnan(value))
+    {
+        bufferPrintf(buffer, signbit(value) ? "-NAN" : "NAN");
+    }
+    else if (isinf(value))
+    {
+        bufferPrintf(buffer, value < 0 ? "-INFINITY" : "INFINITY");
+    }
+    else
+    {
+        bufferPrintf(buffer, "%a", value);
+    }
+}
+
+static const char *typeName(NUM_TYPE type)
+{
+    switch (type)
+    {
+        case INT_TYPE: return "INT_TYPE";
+        case DOUBLE_TYPE: return "DOUBLE_TYPE";
+        default: return "NO_TYPE";
+    }
+}
+
+static void emitCFinish(void)
+{
+    fputs(prelude, stdout);
+    if (functions.text != NULL)
+    {
+        fputs(functions.text, stdout);
+    }
+    printf("int main(void)\n{\n");
+    if (mainBody.text != NULL)
+    {
+        fputs(mainBody.text, stdout);
+    }
+    printf("    return 0;\n}\n");
+    fflush(stdout);
+}
+
+static void emitCStart(void)
+{
+    if (!registered)
+    {
+        registered = true;
+        atexit(emitCFinish);
+    }
+}
+
+// Output the interpreter itself would have printed goes into main.
+void emitCText(char *text)
+{
+    emitCStart();
+    bufferPrintf(&mainBody, "    printf(\"%%s\", ");
+    bufferString(&mainBody, text);
+    bufferPrintf(&mainBody, ");\n    fflush(stdout);\n");
+}
+
+// A warning raised while compiling (parse and resolve time) goes into
+// main; one raised by an expression's evaluation goes into its function.
+void emitCWarning(char *message)
+{
+    emitCStart();
+    bufferPrintf(body == NULL ? &mainBody : body, "    warning(\"%%s\", ");
+    bufferString(body == NULL ? &mainBody : body, message);
+    bufferPrintf(body == NULL ? &mainBody : body, ");\n");
+}
+
+void emitCError(char *message)
+{
+    emitCStart();
+    bufferPrintf(&mainBody, "    error(");
+    bufferString(&mainBody, message);
+    bufferPrintf(&mainBody, ");\n");
+}
+
+static int newTemp(void)
+{
+    return tempCount++;
+}
+
+static int emitNode(AST_ID node, C_SCOPE *scope);
+static void enterScope(AST_ID node, C_SCOPE *scope, C_SCOPE *inner);
+
+static int emitConstant(NUM_TYPE type, double value)
+{
+    int temp = newTemp();
+    bufferPrintf(body, "    RET_VAL t%d = cl_num(%s, expr_%d_literals[%d]);\n",
+                 temp, typeName(type), programCount, literalCount++);
+    bufferDouble(&literals, value);
+    bufferPrintf(&literals, ",");
+    return temp;
+}
+
+static int emitIntConstant(int64_t value)
+{
+    int temp = newTemp();
+    bufferPrintf(body, "    RET_VAL t%d = cl_int(expr_%d_ints[%d]);\n", temp, programCount, intLiteralCount++);
+    bufferPrintf(&intLiterals, "%lldLL,", (long long) value);
+    return temp;
+}
+
+static void emitWarningFor(char *format, FUNC_TYPE func)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), format, funcName(func));
+    emitCWarning(buffer);
+}
+
+static int emitUnary(FUNC_TYPE func, AST_ID *ops, size_t count, C_SCOPE *scope)
+{
+    if (count == 0)
+    {
+        emitWarningFor("%s called with no operands, NAN returned", func);
+        return emitConstant(DOUBLE_TYPE, NAN);
+    }
+    if (count > 1)
+    {
+        emitWarningFor("%s called with extra operands", func);
+    }
+
+    int operand = emitNode(ops[0], scope);
+    int temp = newTemp();
+    bufferPrintf(body, "    RET_VAL t%d = cl_%s(t%d);\n", temp, funcName(func), operand);
+    return temp;
+}
+
+static int emitBinary(FUNC_TYPE func, AST_ID *ops, size_t count, C_SCOPE *scope)
+{
+    if (count == 0)
+    {
+        emitWarningFor("%s called with no operands, 0 returned", func);
+        return emitConstant(INT_TYPE, 0);
+    }
+    if (count == 1)
+    {
+        emitWarningFor("%s called with 1 operand, NAN returned", func);
+        return emitConstant(DOUBLE_TYPE, NAN);
+    }
+
+    int first = emitNode(ops[0], scope);
+    int second = emitNode(ops[1], scope);
+    if (count > 2)
+    {
+        emitWarningFor("%s called with too many operands, ignoring extra", func);
+    }
+
+    int temp = newTemp();
+    switch (func)
+    {
+        case LESS_FUNC:
+            bufferPrintf(body, "    RET_VAL t%d = cl_int(cl_less(t%d, t%d));\n", temp, first, second);
+            break;
+        case GREATER_FUNC:
+            bufferPrintf(body, "    RET_VAL t%d = cl_int(cl_less(t%d, t%d));\n", temp, second, first);
+            break;
+        case EQUAL_FUNC:
+            bufferPrintf(body, "    RET_VAL t%d = cl_int(cl_equal(t%d, t%d));\n", temp, first, second);
+            break;
+        default:
+            bufferPrintf(body, "    RET_VAL t%d = cl_%s(t%d, t%d);\n", temp, funcName(func), first, second);
+            break;
+    }
+    return temp;
+}
+
+// A copy of the binding states, to emit another path from.
+static C_STATE *saveStates(void)
+{
+    C_STATE *saved = malloc((bindings.count + 1) * sizeof(C_STATE));
+
+    if (saved == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    if (bindings.count > 0)
+    {
+        memcpy(saved, bindings.states, bindings.count * sizeof(C_STATE));
+    }
+    return saved;
+}
+
+// Where the path just emitted into code and the one that left saved
+// (emitted into savedCode, or NULL for a path that skips) meet, the
+// first count bindings are ready only if both paths made them so.
+// Otherwise the paths that computed one set its flag.
+static void joinPaths(C_STATE *saved, size_t count, C_BUFFER *code, C_BUFFER *savedCode)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (bindings.states[i] == saved[i])
+        {
+            continue;
+        }
+        if (bindings.states[i] != C_MAYBE_READY && saved[i] != C_MAYBE_READY)
+        {
+            bufferPrintf(declarations, "    bool r%zu __attribute__((unused)) = false;\n", i);
+        }
+        if (bindings.states[i] == C_READY)
+        {
+            bufferPrintf(code, "    r%zu = true;\n", i);
+        }
+        if (saved[i] == C_READY && savedCode != NULL)
+        {
+            bufferPrintf(savedCode, "    r%zu = true;\n", i);
+        }
+        bindings.states[i] = C_MAYBE_READY;
+    }
+}
+
+// Appends code one level further in, as the body of an if.
+static void bufferBlock(C_BUFFER *buffer, C_BUFFER *code)
+{
+    char *line = code->text;
+
+    while (line != NULL && *line != '\0')
+    {
+        char *end = strchr(line, '\n');
+        bufferPrintf(buffer, "    %.*s\n", (int) (end - line), line);
+        line = end + 1;
+    }
+    free(code->text);
+}
+
+// Emits node as code run only on some paths, into its own buffer.
+static int emitPath(C_BUFFER *code, AST_ID node, C_SCOPE *scope)
+{
+    C_BUFFER *outer = body;
+
+    body = code;
+    int temp = emitNode(node, scope);
+    body = outer;
+    return temp;
+}
+
+// cond runs one branch; its value is the branch's, unconverted.
+static int emitCond(AST_ID *ops, size_t count, C_SCOPE *scope)
+{
+    if (count < 3)
+    {
+        emitWarningFor("%s called with too few operands, NAN returned", COND_FUNC);
+        return emitConstant(DOUBLE_TYPE, NAN);
+    }
+
+    int condition = emitNode(ops[0], scope);
+    if (count > 3)
+    {
+        emitWarningFor("%s called with too many operands, ignoring extra", COND_FUNC);
+    }
+
+    int temp = newTemp();
+    size_t known = bindings.count;
+    C_STATE *before = saveStates();
+    C_BUFFER chosen = { NULL, 0, 0 }, other = { NULL, 0, 0 };
+
+    bufferPrintf(&chosen, "    t%d = t%d;\n", temp, emitPath(&chosen, ops[1], scope));
+    C_STATE *afterChosen = saveStates();
+    if (known > 0)
+    {
+        memcpy(bindings.states, before, known * sizeof(C_STATE));
+    }
+    bufferPrintf(&other, "    t%d = t%d;\n", temp, emitPath(&other, ops[2], scope));
+    joinPaths(afterChosen, known, &other, &chosen);
+
+    bufferPrintf(body, "    RET_VAL t%d;\n    if (cl_true(t%d))\n    {\n", temp, condition);
+    bufferBlock(body, &chosen);
+    bufferPrintf(body, "    }\n    else\n    {\n");
+    bufferBlock(body, &other);
+    bufferPrintf(body, "    }\n");
+    free(before);
+    free(afterChosen);
+    return temp;
+}
+
+// and and or run operands from the first until one decides them, and
+// give the truth of the last one run as 1 or 0.
+static void emitLogic(FUNC_TYPE func, AST_ID *ops, size_t count, int temp, C_SCOPE *scope)
+{
+    int operand = emitNode(ops[0], scope);
+
+    if (count == 1)
+    {
+        bufferPrintf(body, "    t%d = cl_int(cl_true(t%d));\n", temp, operand);
+        return;
+    }
+
+    size_t known = bindings.count;
+    C_STATE *before = saveStates();
+    C_BUFFER rest = { NULL, 0, 0 };
+    C_BUFFER *outer = body;
+
+    body = &rest;
+    emitLogic(func, ops + 1, count - 1, temp, scope);
+    body = outer;
+    joinPaths(before, known, &rest, NULL);
+
+    bufferPrintf(body, "    if (%scl_true(t%d))\n    {\n", func == AND_FUNC ? "" : "!", operand);
+    bufferBlock(body, &rest);
+    bufferPrintf(body, "    }\n");
+    free(before);
+}
+
+// The operands still run, for their warnings.
+static int emitVec(AST_ID *ops, size_t count, C_SCOPE *scope)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        bufferPrintf(body, "    (void) t%d;\n", emitNode(ops[i], scope));
+    }
+    emitWarningFor("%s is not supported by --emit-c, NAN returned", VEC_FUNC);
+    return emitConstant(DOUBLE_TYPE, NAN);
+}
+
+// Follows a (depth, slot) address out from scope to the scope that
+// binds it, through the captures of the functions whose parameters it
+// passes; a capture is addressed from the scope binding the function.
+static C_SCOPE *findSlot(C_SCOPE *scope, int depth, int *slot)
+{
+    for (;;)
+    {
+        for (; depth > 0; depth--)
+        {
+            scope = scope->outer;
+        }
+        if (scope->node->lambda < 0 || *slot < scope->node->slotCount)
+        {
+            return scope;
+        }
+        AST_CAPTURE *capture = &ast.lambdas[scope->node->lambda].captures[*slot - scope->node->slotCount];
+        scope = scope->outer;
+        depth = capture->depth;
+        *slot = capture->slot;
+    }
+}
+
+// Emits the arguments of a call of a let-bound function, as startCall
+// and startFunction evaluate them, and returns the number of the
+// function it calls, or -1 if the call gives nan: the function is
+// undefined (already reported by resolveSymbols) or has too few
+// operands. *temps holds the arguments.
+static int emitArguments(AST_ID node, C_SCOPE *scope, int **temps, AST_LAMBDA **called)
+{
+    AST_ID callee = NODE_CALLEE(node);
+    char buffer[256];
+
+    if (NODE(callee).symbol.depth < 0)
+    {
+        return -1;
+    }
+
+    AST_LAMBDA *lambda = &ast.lambdas[NODE(callee).symbol.lambda];
+    size_t params = (size_t) NODE_SCOPE(lambda->params)->slotCount;
+    if (NODE(node).function.count < params)
+    {
+        snprintf(buffer, sizeof(buffer), "%s called with too few operands, NAN returned", symbolName(lambda->id));
+        emitCWarning(buffer);
+        return -1;
+    }
+    if ((*temps = malloc((params + 1) * sizeof(int))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    for (size_t i = 0; i < params; i++)
+    {
+        (*temps)[i] = emitNode(NODE_OPS(node)[i], scope);
+    }
+    if (NODE(node).function.count > params)
+    {
+        snprintf(buffer, sizeof(buffer), "%s called with too many operands, ignoring extra", symbolName(lambda->id));
+        emitCWarning(buffer);
+    }
+
+    int slot = NODE(callee).symbol.slot;
+    C_SCOPE *home = findSlot(scope, NODE(callee).symbol.depth, &slot);
+    *called = lambda;
+    return home->functions + slot - home->node->slotCount;
+}
+
+// Writes the call fN(tA, tB, ...).
+static void bufferCall(C_BUFFER *buffer, int function, AST_LAMBDA *lambda, int *temps)
+{
+    bufferPrintf(buffer, "f%d(", function);
+    for (int i = 0; i < NODE_SCOPE(lambda->params)->slotCount; i++)
+    {
+        bufferPrintf(buffer, i == 0 ? "t%d" : ", t%d", temps[i]);
+    }
+    bufferPrintf(buffer, ")");
+}
+
+static int emitCall(AST_ID node, C_SCOPE *scope)
+{
+    int *temps;
+    AST_LAMBDA *lambda;
+    int function = emitArguments(node, scope, &temps, &lambda);
+
+    if (function < 0)
+    {
+        return emitConstant(DOUBLE_TYPE, NAN);
+    }
+
+    int temp = newTemp();
+    bufferPrintf(body, "    RET_VAL t%d = ", temp);
+    bufferCall(body, function, lambda, temps);
+    bufferPrintf(body, ";\n");
+    free(temps);
+    return temp;
+}
+
+// Wide sums, products and hypots gather their operands and reduce them
+// as retSum, retProduct and retHypot do, in the same lanes and halves.
+static int emitWide(FUNC_TYPE func, AST_ID *ops, size_t count, C_SCOPE *scope)
+{
+    int *operands = malloc(count * sizeof(int));
+    int temp;
+
+    if (operands == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        operands[i] = emitNode(ops[i], scope);
+    }
+    temp = newTemp();
+    bufferPrintf(body, "    RET_VAL w%d[] = {", temp);
+    for (size_t i = 0; i < count; i++)
+    {
+        bufferPrintf(body, i == 0 ? " t%d" : ", t%d", operands[i]);
+    }
+    bufferPrintf(body, " };\n");
+    bufferPrintf(body, "    RET_VAL t%d = cl_wide(%s, w%d, %zu);\n", temp,
+                 func == ADD_FUNC ? "CL_SUM" : func == MULT_FUNC ? "CL_PRODUCT" : "CL_SQUARES", temp, count);
+    free(operands);
+    return temp;
+}
+
+static int emitVariadic(FUNC_TYPE func, AST_ID *ops, size_t count, C_SCOPE *scope)
+{
+    int temp;
+    int operand;
+
+    if (count == 0)
+    {
+        emitWarningFor("%s called with no operands, 0 returned", func);
+        return emitConstant(INT_TYPE, 0);
+    }
+
+    if (count >= RET_WIDE_CALL && func != MIN_FUNC && func != MAX_FUNC)
+    {
+        return emitWide(func, ops, count, scope);
+    }
+
+    switch (func)
+    {
+        case ADD_FUNC:
+        case MULT_FUNC:
+            temp = emitIntConstant(func == ADD_FUNC ? 0 : 1);
+            bufferPrintf(body, "    bool d%d = false;\n", temp);
+            for (size_t i = 0; i < count; i++)
+            {
+                operand = emitNode(ops[i], scope);
+                bufferPrintf(body, "    cl_%s(&t%d, &d%d, t%d);\n", funcName(func), temp, temp, operand);
+            }
+            bufferPrintf(body, "    t%d = cl_total(t%d, d%d);\n", temp, temp, temp);
+            return temp;
+
+        case HYPOT_FUNC:
+            temp = emitConstant(DOUBLE_TYPE, 0);
+            for (size_t i = 0; i < count; i++)
+            {
+                operand = emitNode(ops[i], scope);
+                bufferPrintf(body, "    cl_hypot(&t%d, t%d);\n", temp, operand);
+            }
+            bufferPrintf(body, "    t%d.value = sqrt(t%d.value);\n", temp, temp);
+            return temp;
+
+        default:
+            // min and max start from the first operand
+            temp = emitNode(ops[0], scope);
+            for (size_t i = 1; i < count; i++)
+            {
+                operand = emitNode(ops[i], scope);
+                bufferPrintf(body, "    cl_%s(&t%d, t%d);\n", funcName(func), temp, operand);
+            }
+            return temp;
+    }
+}
+
+// Numbers count more bindings, for one emission of their scope.
+static int addBindings(size_t count)
+{
+    int base = (int) bindings.count;
+
+    if (bindings.count + count > bindings.capacity)
+    {
+        bindings.capacity = 2 * (bindings.count + count);
+        if ((bindings.states = realloc(bindings.states, bindings.capacity * sizeof(C_STATE))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        bindings.states[bindings.count++] = C_UNEVALUATED;
+    }
+    return base;
+}
+
+// Appends code to buffer and frees it.
+static void bufferTake(C_BUFFER *buffer, C_BUFFER *code)
+{
+    if (code->size > 0)
+    {
+        bufferPrintf(buffer, "%s", code->text);
+    }
+    free(code->text);
+}
+
+// Makes function's buffers the ones emitted into.
+static C_OUTER enterFunction(C_FUNCTION *function)
+{
+    C_OUTER outer = { body, declarations, definitions };
+
+    body = &function->statements;
+    declarations = &function->variables;
+    definitions = &function->nested;
+    return outer;
+}
+
+// Goes back to the buffers of the function around, and appends function
+// to its nested functions.
+static void leaveFunction(C_OUTER outer, C_FUNCTION *function, char *header)
+{
+    C_BUFFER code = { NULL, 0, 0 };
+
+    body = outer.body;
+    declarations = outer.declarations;
+    definitions = outer.definitions;
+    bufferPrintf(&code, "%s\n{\n", header);
+    if (function->restarts)
+    {
+        // before the variables, so that the bindings start over
+        bufferPrintf(&code, "start:;\n");
+    }
+    bufferTake(&code, &function->variables);
+    bufferTake(&code, &function->nested);
+    bufferTake(&code, &function->statements);
+    bufferPrintf(&code, "}\n");
+    bufferBlock(definitions, &code);
+}
+
+// A binding's getter gN, in a program that binds functions: sN is 0
+// until it has computed bN, 1 while it does, and 2 after.
+static void emitGetter(int binding, SYMBOL_TABLE_NODE *table, C_SCOPE *scope)
+{
+    C_FUNCTION getter = { { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 }, false };
+    C_BUFFER itself = { NULL, 0, 0 }, value = { NULL, 0, 0 };
+    char buffer[256];
+    C_OUTER outer = enterFunction(&getter);
+
+    body = &itself;
+    snprintf(buffer, sizeof(buffer), "symbol %s is defined in terms of itself, nan returned", symbolName(table->id));
+    emitCWarning(buffer);
+    bufferPrintf(&itself, "    return t%d;\n", emitConstant(DOUBLE_TYPE, NAN));
+
+    bufferPrintf(&value, "    s%d = 1;\n", binding);
+    int temp = emitPath(&value, table->value, scope);
+    if (table->type != NO_TYPE)
+    {
+        bufferPrintf(&value, "    b%d = cl_cast(t%d, %s);\n", binding, temp, typeName(table->type));
+    }
+    else
+    {
+        bufferPrintf(&value, "    b%d = t%d;\n", binding, temp);
+    }
+    bufferPrintf(&value, "    s%d = 2;\n", binding);
+
+    body = &getter.statements;
+    bufferPrintf(body, "    if (s%d == 1)\n    {\n", binding);
+    bufferBlock(body, &itself);
+    bufferPrintf(body, "    }\n    if (s%d == 0)\n    {\n", binding);
+    bufferBlock(body, &value);
+    bufferPrintf(body, "    }\n    return b%d;\n", binding);
+    snprintf(buffer, sizeof(buffer), "RET_VAL g%d(void)", binding);
+    leaveFunction(outer, &getter, buffer);
+}
+
+// The let-bound function whose body is being emitted: its number, the
+// number of its parameters' first binding, and its C function.
+typedef struct {
+    AST_LAMBDA *lambda;
+    int number;
+    int base;
+    C_FUNCTION *code;
+} C_TAIL;
+
+// The end of a function's body: casts the value, keeps it if the
+// function is memo and the call printed nothing, and returns it.
+static void emitReturn(int temp, C_TAIL *tail)
+{
+    if (tail->lambda->type != NO_TYPE)
+    {
+        bufferPrintf(body, "    t%d = cl_cast(t%d, %s);\n", temp, temp, typeName(tail->lambda->type));
+    }
+    if (tail->lambda->memo)
+    {
+        int count = NODE_SCOPE(tail->lambda->params)->slotCount;
+        bufferPrintf(body, "    if (cl_warnings == warnings)\n    {\n        cl_keep(&memo_%d_%d, %s, %d, t%d);\n    }\n",
+                     programCount, tail->number, count > 0 ? "args" : "NULL", count, temp);
+    }
+    bufferPrintf(body, "    return t%d;\n", temp);
+}
+
+// Emits node as the rest of a function's body. The branches of a cond
+// are the rest of the body in turn. A call of the function itself there
+// passes its arguments as the parameters and jumps back to the start,
+// unless the function is memo; any other call whose value needs no cast
+// is returned as it is.
+static void emitTail(AST_ID node, C_SCOPE *scope, C_TAIL *tail)
+{
+    if (NODE_TYPE(node) == SCOPE_NODE_TYPE)
+    {
+        C_SCOPE inner;
+        enterScope(node, scope, &inner);
+        emitTail(inner.node->child, &inner, tail);
+        return;
+    }
+    if (NODE_TYPE(node) != FUNC_NODE_TYPE)
+    {
+        emitReturn(emitNode(node, scope), tail);
+        return;
+    }
+
+    AST_ID *ops = NODE_OPS(node);
+    size_t count = NODE(node).function.count;
+
+    if (NODE(node).function.func == COND_FUNC && count >= 3)
+    {
+        C_BUFFER chosen = { NULL, 0, 0 }, other = { NULL, 0, 0 };
+        C_BUFFER *outer = body;
+
+        int condition = emitNode(ops[0], scope);
+        if (count > 3)
+        {
+            emitWarningFor("%s called with too many operands, ignoring extra", COND_FUNC);
+        }
+        body = &chosen;
+        emitTail(ops[1], scope, tail);
+        body = &other;
+        emitTail(ops[2], scope, tail);
+        body = outer;
+
+        bufferPrintf(body, "    if (cl_true(t%d))\n    {\n", condition);
+        bufferBlock(body, &chosen);
+        bufferPrintf(body, "    }\n    else\n    {\n");
+        bufferBlock(body, &other);
+        bufferPrintf(body, "    }\n");
+        return;
+    }
+    if (NODE(node).function.func != CUSTOM_FUNC || tail->lambda->memo)
+    {
+        emitReturn(emitNode(node, scope), tail);
+        return;
+    }
+
+    int *temps;
+    AST_LAMBDA *called;
+    int function = emitArguments(node, scope, &temps, &called);
+
+    if (function < 0)
+    {
+        emitReturn(emitConstant(DOUBLE_TYPE, NAN), tail);
+        return;
+    }
+    if (function == tail->number)
+    {
+        for (int i = 0; i < NODE_SCOPE(called->params)->slotCount; i++)
+        {
+            bufferPrintf(body, "    b%d = t%d;\n", tail->base + i, temps[i]);
+        }
+        bufferPrintf(body, "    goto start;\n");
+        tail->code->restarts = true;
+    }
+    else if (tail->lambda->type == NO_TYPE || tail->lambda->type == called->type)
+    {
+        bufferPrintf(body, "    return ");
+        bufferCall(body, function, called, temps);
+        bufferPrintf(body, ";\n");
+    }
+    else
+    {
+        int temp = newTemp();
+        bufferPrintf(body, "    RET_VAL t%d = ", temp);
+        bufferCall(body, function, called, temps);
+        bufferPrintf(body, ";\n");
+        emitReturn(temp, tail);
+    }
+    free(temps);
+}
+
+// A let-bound function becomes the nested function fN, taking its
+// parameters as the variables of their bindings. A memo function first
+// looks its arguments up in memo_P_N.
+static void emitFunction(AST_LAMBDA *lambda, int number, C_SCOPE *scope)
+{
+    C_FUNCTION function = { { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 }, false };
+    C_BUFFER header = { NULL, 0, 0 }, arguments = { NULL, 0, 0 };
+    C_SCOPE params = { NODE_SCOPE(lambda->params), 0, 0, scope };
+    int count = params.node->slotCount;
+
+    params.base = addBindings((size_t) count);
+    bufferPrintf(&header, "RET_VAL f%d(", number);
+    for (int i = 0; i < count; i++)
+    {
+        bufferPrintf(&header, i == 0 ? "RET_VAL b%d" : ", RET_VAL b%d", params.base + i);
+        bufferPrintf(&arguments, i == 0 ? "b%d" : ", b%d", params.base + i);
+    }
+    bufferPrintf(&header, count == 0 ? "void)" : ")");
+
+    C_TAIL tail = { lambda, number, params.base, &function };
+    C_OUTER outer = enterFunction(&function);
+    if (lambda->memo)
+    {
+        bufferPrintf(&functions, "static CL_MEMO memo_%d_%d;\n", programCount, number);
+        if (count > 0)
+        {
+            bufferPrintf(body, "    RET_VAL args[] = { %s };\n", arguments.text);
+        }
+        bufferPrintf(body, "    RET_VAL kept;\n    if (cl_recall(&memo_%d_%d, %s, %d, &kept))\n    {\n        return kept;\n    }\n",
+                     programCount, number, count > 0 ? "args" : "NULL", count);
+        bufferPrintf(body, "    long warnings = cl_warnings;\n");
+    }
+    emitTail(params.node->child, &params, &tail);
+    leaveFunction(outer, &function, header.text);
+    free(header.text);
+    free(arguments.text);
+}
+
+// Numbers a scope's bindings and functions for this emission of it. In a
+// program that binds functions, a binding can be reached from their
+// bodies as well as from the code around them, so it is computed by a
+// getter that keeps its state at run time; otherwise it is just the
+// variable bN, whose state emitSymbol follows.
+static void enterScope(AST_ID node, C_SCOPE *scope, C_SCOPE *inner)
+{
+    AST_SCOPE *bound = NODE_SCOPE(node);
+
+    inner->node = bound;
+    inner->base = addBindings((size_t) bound->slotCount);
+    inner->functions = functionCount;
+    inner->outer = scope;
+    functionCount += bound->lambdaCount;
+
+    for (int i = 0; i < bound->slotCount; i++)
+    {
+        bufferPrintf(declarations, "    RET_VAL b%d __attribute__((unused));\n", inner->base + i);
+        if (getters)
+        {
+            bufferPrintf(declarations, "    int s%d = 0;\n    auto RET_VAL g%d(void) __attribute__((unused));\n", inner->base + i, inner->base + i);
+        }
+    }
+    for (int i = 0; i < bound->lambdaCount; i++)
+    {
+        int count = NODE_SCOPE(ast.lambdas[bound->firstLambda + i].params)->slotCount;
+        bufferPrintf(declarations, "    auto RET_VAL f%d(", inner->functions + i);
+        for (int j = 0; j < count; j++)
+        {
+            bufferPrintf(declarations, j == 0 ? "RET_VAL" : ", RET_VAL");
+        }
+        bufferPrintf(declarations, count == 0 ? "void) __attribute__((unused));\n" : ") __attribute__((unused));\n");
+    }
+    if (getters)
+    {
+        for (int i = 0; i < bound->slotCount; i++)
+        {
+            emitGetter(inner->base + i, SCOPE_SLOT(bound, i), inner);
+        }
+    }
+    for (int i = 0; i < bound->lambdaCount; i++)
+    {
+        emitFunction(&ast.lambdas[bound->firstLambda + i], inner->functions + i, inner);
+    }
+}
+
+static int emitSymbol(AST_ID node, C_SCOPE *scope)
+{
+    int depth = NODE(node).symbol.depth;
+    int slot = NODE(node).symbol.slot;
+
+    if (depth < 0)
+    {
+        // already reported when the program was resolved
+        return emitConstant(DOUBLE_TYPE, NAN);
+    }
+
+    scope = findSlot(scope, depth, &slot);
+
+    int binding = scope->base + slot;
+    SYMBOL_TABLE_NODE *table = SCOPE_SLOT(scope->node, slot);
+
+    if (getters)
+    {
+        // a parameter is an argument of the function it is in
+        int temp = newTemp();
+        bufferPrintf(body, scope->node->lambda >= 0 ? "    RET_VAL t%d = b%d;\n" : "    RET_VAL t%d = g%d();\n", temp, binding);
+        return temp;
+    }
+
+    if (bindings.states[binding] == C_EVALUATING)
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "symbol %s is defined in terms of itself, nan returned", symbolName(table->id));
+        emitCWarning(buffer);
+        return emitConstant(DOUBLE_TYPE, NAN);
+    }
+
+    if (bindings.states[binding] == C_UNEVALUATED || bindings.states[binding] == C_MAYBE_READY)
+    {
+        // on this path the first reference emitted is the first one run;
+        // one that some earlier path may have computed tests its flag
+        bool guarded = bindings.states[binding] == C_MAYBE_READY;
+        size_t known = bindings.count;
+        C_STATE *before = saveStates();
+        C_BUFFER code = { NULL, 0, 0 };
+
+        bindings.states[binding] = C_EVALUATING;
+        int value = emitPath(guarded ? &code : body, table->value, scope);
+        C_BUFFER *into = guarded ? &code : body;
+
+        if (table->type != NO_TYPE)
+        {
+            bufferPrintf(into, "    b%d = cl_cast(t%d, %s);\n", binding, value, typeName(table->type));
+        }
+        else
+        {
+            bufferPrintf(into, "    b%d = t%d;\n", binding, value);
+        }
+        if (guarded)
+        {
+            bufferPrintf(&code, "    r%d = true;\n", binding);
+            bindings.states[binding] = C_MAYBE_READY;
+            joinPaths(before, known, &code, NULL);
+            bufferPrintf(body, "    if (!r%d)\n    {\n", binding);
+            bufferBlock(body, &code);
+            bufferPrintf(body, "    }\n");
+        }
+        // either way it is computed now
+        bindings.states[binding] = C_READY;
+        free(before);
+    }
+
+    int temp = newTemp();
+    bufferPrintf(body, "    RET_VAL t%d = b%d;\n", temp, binding);
+    return temp;
+}
+
+static int emitNode(AST_ID node, C_SCOPE *scope)
+{
+    switch (NODE_TYPE(node))
+    {
+        case NUM_NODE_TYPE:
+            if (retIsVector(NODE(node).number))
+            {
+                // a folded vec
+                return emitVec(NULL, 0, scope);
+            }
+            if (retIsInt64(NODE(node).number))
+            {
+                return emitIntConstant(retInt64Of(NODE(node).number));
+            }
+            if (retIsBig(NODE(node).number))
+            {
+                // a bignum literal, or one folded from literals
+                bufferPrintf(body, "    cl_overflow();\n");
+            }
+            return emitConstant(retType(NODE(node).number), retValue(NODE(node).number));
+
+        case SYM_NODE_TYPE:
+            return emitSymbol(node, scope);
+
+        case SCOPE_NODE_TYPE:
+        {
+            C_SCOPE inner;
+            enterScope(node, scope, &inner);
+            return emitNode(inner.node->child, &inner);
+        }
+
+        case FUNC_NODE_TYPE:
+        {
+            FUNC_TYPE func = NODE(node).function.func;
+            AST_ID *ops = NODE_OPS(node);
+            size_t count = NODE(node).function.count;
+
+            switch (func)
+            {
+                case NEG_FUNC:
+                case ABS_FUNC:
+                case EXP_FUNC:
+                case EXP2_FUNC:
+                case LOG_FUNC:
+                case SQRT_FUNC:
+                case CBRT_FUNC:
+                    return emitUnary(func, ops, count, scope);
+                case SUB_FUNC:
+                case DIV_FUNC:
+                case REMAINDER_FUNC:
+                case POW_FUNC:
+                case LESS_FUNC:
+                case GREATER_FUNC:
+                case EQUAL_FUNC:
+                    return emitBinary(func, ops, count, scope);
+                case COND_FUNC:
+                    return emitCond(ops, count, scope);
+                case AND_FUNC:
+                case OR_FUNC:
+                {
+                    // the value of being decided early, or with no operands
+                    // of deciding nothing
+                    int temp = emitIntConstant((func == AND_FUNC) == (count == 0));
+                    if (count > 0)
+                    {
+                        emitLogic(func, ops, count, temp, scope);
+                    }
+                    return temp;
+                }
+                case ADD_FUNC:
+                case MULT_FUNC:
+                case HYPOT_FUNC:
+                case MIN_FUNC:
+                case MAX_FUNC:
+                    return emitVariadic(func, ops, count, scope);
+                case VEC_FUNC:
+                    return emitVec(ops, count, scope);
+                case CUSTOM_FUNC:
+                    return emitCall(node, scope);
+                default:
+                    return emitConstant(DOUBLE_TYPE, NAN);
+            }
+        }
+
+        default:
+            return emitConstant(DOUBLE_TYPE, NAN);
+    }
+}
+
+// Compiles one resolved top-level expression into a function and
+// appends a call that prints its value to main.
+void emitCProgram(AST_ID program)
+{
+    C_FUNCTION function = { { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 }, false };
+    int id = ++programCount;
+
+    emitCStart();
+
+    tempCount = 0;
+    literalCount = 0;
+    literals.size = 0;
+    intLiteralCount = 0;
+    intLiterals.size = 0;
+    bindings.count = 0;
+    functionCount = 0;
+    getters = ast.lambdaCount > 0;
+    enterFunction(&function);
+    int result = emitNode(program, NULL);
+    body = NULL;
+    declarations = NULL;
+    definitions = NULL;
+
+    if (literalCount > 0)
+    {
+        bufferPrintf(&functions, "double expr_%d_literals[] = { %s };\n", id, literals.text);
+    }
+    if (intLiteralCount > 0)
+    {
+        bufferPrintf(&functions, "long long expr_%d_ints[] = { %s };\n", id, intLiterals.text);
+    }
+    bufferPrintf(&functions, "\nstatic RET_VAL expr_%d(void)\n{\n", id);
+    bufferTake(&functions, &function.variables);
+    bufferTake(&functions, &function.nested);
+    bufferTake(&functions, &function.statements);
+    bufferPrintf(&functions, "    return t%d;\n}\n\n", result);
+    bufferPrintf(&mainBody, "    printRetVal(expr_%d());\n", id);
+}
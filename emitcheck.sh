@@ -0,0 +1,5 @@
+#!/bin/bash
+# Checks --emit-c against the interpreter; see check.sh.
+# Build first with "run", then: ./emitcheck.sh [programs...]
+
+exec ./check.sh --emit-c -- "$@"
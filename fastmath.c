@@ -0,0 +1,357 @@
+#include "cilisp.h"
+#include <float.h>
+
+// Elementary functions for the evaluators: libm's, or with --math=fast
+// polynomial approximations that give up the last bit or two for speed.
+//
+// exp and exp2 reduce x to r = x - k ln 2, |r| <= ln 2 / 2, and scale a
+// degree 13 Taylor polynomial of exp(r) by 2^k. log writes x as 2^e m,
+// m in [sqrt(1/2), sqrt(2)), and takes log(m) = 2 atanh((m - 1) / (m + 1))
+// in fdlibm's arrangement. cbrt guesses from the exponent bits, takes two
+// Halley steps and finishes with fdlibm's rounding Newton step. pow is
+// exp(y log x), with log x and y log x carried in two doubles. Over the
+// samples of mathcheck.sh, against libm's long double functions, the
+// errors are at most
+//
+//     exp, exp2    1.5 ulp
+//     log          1 ulp
+//     cbrt         0.7 ulp
+//     pow          2 ulp while |y log x| < 32, 32 ulp toward overflow
+//
+// (libm's own are about 0.5 ulp, and 3.3 for cbrt). mathcheck.sh checks
+// these bounds; mathbench.sh times the functions.
+//
+// Only the array maps use the approximations, apart from cbrt. One
+// argument at a time, libm's exp, exp2, log and pow are faster than the
+// width 1 polynomials (see mathbench.sh), so the one-at-a-time entries
+// of the fast tables are libm's and only vectors and batches go the
+// fast way. cbrt's approximation beats libm's even alone and stays.
+//
+// The approximations use only +, -, *, / and bit operations on GCC
+// vector types, so one definition serves 1, 2, 4 and 8 doubles at a time
+// (scalar, SSE2, AVX2 and AVX-512 on x86-64) and every width gives the
+// same bits. That is also why contraction into FMAs, which AVX-512 would
+// otherwise do, is off in this file. Arguments outside a function's fast
+// range (not finite, subnormal, zero or negative for log and pow, or a
+// result that would overflow or be subnormal) are passed to libm one by
+// one, so special values come out exactly as libm's do. sqrt is not
+// here: the evaluators already use the exactly rounded instruction.
+
+#pragma GCC optimize ("fp-contract=off")
+
+typedef double F1 __attribute__((vector_size(8)));
+typedef double F2 __attribute__((vector_size(16)));
+typedef double F4 __attribute__((vector_size(32)));
+typedef double F8 __attribute__((vector_size(64)));
+typedef int64_t I1 __attribute__((vector_size(8)));
+typedef int64_t I2 __attribute__((vector_size(16)));
+typedef int64_t I4 __attribute__((vector_size(32)));
+typedef int64_t I8 __attribute__((vector_size(64)));
+typedef uint64_t U1 __attribute__((vector_size(8)));
+typedef uint64_t U2 __attribute__((vector_size(16)));
+typedef uint64_t U4 __attribute__((vector_size(32)));
+typedef uint64_t U8 __attribute__((vector_size(64)));
+
+#if defined(__x86_64__)
+#define SSE2_TARGET
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+#else
+#define SSE2_TARGET
+#define AVX2_TARGET
+#define AVX512_TARGET
+#endif
+
+#define LN2 0x1.62e42fefa39efp-1
+#define LN2_HI 0x1.62e42feep-1          // low 32 bits clear: k * LN2_HI is exact
+#define LN2_LO 0x1.a39ef35793c76p-33
+#define LOG2E 0x1.71547652b82fep0
+#define ROUNDER 0x1.8p52                // x + ROUNDER rounds x to an integer in its low bits
+#define ROUNDER_BITS 0x4338000000000000
+#define SPLITTER 0x1.0000002p27         // 2^27 + 1, halves a double for exact products
+#define SQRT_HALF_BITS 0x3fe6a09e667f3bcd
+#define EXPONENT_MASK ((int64_t) 0xfff0000000000000)
+#define SIGN_BIT INT64_MIN
+#define CBRT_BIAS 715094163             // fdlibm's B1, on the high word
+
+// exp(r) = 1 + r + r^2 / 2 + ... + r^13 / 13!
+#define EXP_POLY(r) \
+    (1 + (r) * (1 + (r) * (1 / 2.0 + (r) * (1 / 6.0 + (r) * (1 / 24.0 + (r) * (1 / 120.0 + (r) * (1 / 720.0 \
+    + (r) * (1 / 5040.0 + (r) * (1 / 40320.0 + (r) * (1 / 362880.0 + (r) * (1 / 3628800.0 \
+    + (r) * (1 / 39916800.0 + (r) * (1 / 479001600.0 + (r) * (1 / 6227020800.0))))))))))))))
+
+// 2 atanh(s) = 2s + s R(s^2), R(z) = z (2/3 + 2z/5 + ... + 2z^10/23)
+#define LOG_POLY(z) \
+    ((z) * (2 / 3.0 + (z) * (2 / 5.0 + (z) * (2 / 7.0 + (z) * (2 / 9.0 + (z) * (2 / 11.0 + (z) * (2 / 13.0 \
+    + (z) * (2 / 15.0 + (z) * (2 / 17.0 + (z) * (2 / 19.0 + (z) * (2 / 21.0 + (z) * (2 / 23.0))))))))))))
+
+// The approximations on a vector of W doubles. Each sets *inside to the
+// lanes whose argument is in its fast range.
+#define FAST_CORES(S, W, TARGET) \
+    TARGET static inline F##W twoProduct##S(F##W a, F##W b, F##W *err) \
+    { \
+        F##W p = a * b; \
+        F##W ca = a * SPLITTER, ah = ca - (ca - a), al = a - ah; \
+        F##W cb = b * SPLITTER, bh = cb - (cb - b), bl = b - bh; \
+        *err = ((ah * bh - p) + ah * bl + al * bh) + al * bl; \
+        return p; \
+    } \
+    \
+    TARGET static inline F##W twoSum##S(F##W a, F##W b, F##W *err) \
+    { \
+        F##W s = a + b, bb = s - a; \
+        *err = (a - (s - bb)) + (b - bb); \
+        return s; \
+    } \
+    \
+    TARGET static inline F##W expScaled##S(F##W r, I##W k) \
+    { \
+        /* unsigned, as lanes outside the range may shift garbage */ \
+        return EXP_POLY(r) * (F##W) ((U##W) (k + 1023) << 52); \
+    } \
+    \
+    TARGET static inline F##W expCore##S(F##W x, I##W *inside) \
+    { \
+        F##W t = x * LOG2E + ROUNDER, k = t - ROUNDER; \
+        *inside = (x >= -708) & (x <= 709); \
+        return expScaled##S(x - k * LN2_HI - k * LN2_LO, (I##W) t - ROUNDER_BITS); \
+    } \
+    \
+    TARGET static inline F##W exp2Core##S(F##W x, I##W *inside) \
+    { \
+        F##W t = x + ROUNDER, k = t - ROUNDER; \
+        *inside = (x >= -1022) & (x <= 1023); \
+        return expScaled##S((x - k) * LN2, (I##W) t - ROUNDER_BITS); \
+    } \
+    \
+    TARGET static inline F##W logReduce##S(F##W x, F##W *e, F##W *f, F##W *s) \
+    { \
+        I##W bits = (I##W) x, offset = bits - SQRT_HALF_BITS; \
+        F##W z; \
+        *e = (F##W) ((offset >> 52) + ROUNDER_BITS) - ROUNDER; \
+        *f = (F##W) (bits - (offset & EXPONENT_MASK)) - 1; \
+        *s = *f / (2 + *f); \
+        z = *s * *s; \
+        return LOG_POLY(z); \
+    } \
+    \
+    TARGET static inline F##W logCore##S(F##W x, I##W *inside) \
+    { \
+        F##W e, f, s, R = logReduce##S(x, &e, &f, &s), hfsq = 0.5 * f * f; \
+        *inside = (x >= DBL_MIN) & (x <= DBL_MAX); \
+        return e * LN2_HI - ((hfsq - (s * (hfsq + R) + e * LN2_LO)) - f); \
+    } \
+    \
+    TARGET static inline F##W cbrtCore##S(F##W x, I##W *inside) \
+    { \
+        I##W sign = (I##W) x & SIGN_BIT; \
+        F##W ax = (F##W) ((I##W) x ^ sign), t, q, r; \
+        I##W high = (I##W) ax >> 32; \
+        t = (F##W) ((((high * 0x55555556) >> 32) + CBRT_BIAS) << 32); \
+        q = t * t * (t / ax); \
+        t = t * ((q + 2) / (q + q + 1)); \
+        q = t * t * (t / ax); \
+        t = t * ((q + 2) / (q + q + 1)); \
+        t = (F##W) (((I##W) t + 0x80000000) & (int64_t) -0x40000000); \
+        r = ax / (t * t); \
+        r = (r - t) / (t + t + r); \
+        t = t + t * r; \
+        *inside = (ax >= DBL_MIN) & (ax <= DBL_MAX); \
+        return (F##W) ((I##W) t | sign); \
+    } \
+    \
+    TARGET static inline F##W powCore##S(F##W x, F##W y, I##W *inside) \
+    { \
+        F##W e, f, s, R = logReduce##S(x, &e, &f, &s); \
+        F##W u, uLo, sp, spLo, ds, sq, sqLo, hfsq, a, aLo, sa, saLo, h1, l1, h2, l2, h3, l3, rest, hi, lo, p, pLo, t, k; \
+        u = 2 + f; \
+        uLo = (2 - u) + f; \
+        sp = twoProduct##S(s, u, &spLo); \
+        ds = (((f - sp) - spLo) - s * uLo) / u; \
+        sq = twoProduct##S(f, f, &sqLo); \
+        hfsq = 0.5 * sq; \
+        a = twoSum##S(hfsq, R, &aLo); \
+        aLo += 0.5 * sqLo; \
+        sa = twoProduct##S(s, a, &saLo); \
+        saLo += s * aLo + ds * a; \
+        h1 = twoSum##S(e * LN2_HI, f, &l1); \
+        h2 = twoSum##S(h1, -hfsq, &l2); \
+        h3 = twoSum##S(h2, sa, &l3); \
+        rest = l1 + l2 + l3 + ((saLo - 0.5 * sqLo) + e * LN2_LO); \
+        hi = h3 + rest; \
+        lo = (h3 - hi) + rest; \
+        p = twoProduct##S(y, hi, &pLo); \
+        pLo += y * lo; \
+        t = p * LOG2E + ROUNDER; \
+        k = t - ROUNDER; \
+        *inside = (x >= DBL_MIN) & (x <= DBL_MAX) & (y >= -0x1p900) & (y <= 0x1p900) & (p >= -708) & (p <= 709); \
+        return expScaled##S((p - k * LN2_HI - k * LN2_LO) + pLo, (I##W) t - ROUNDER_BITS); \
+    }
+
+FAST_CORES(Scalar, 1, )
+FAST_CORES(Sse2, 2, SSE2_TARGET)
+FAST_CORES(Avx2, 4, AVX2_TARGET)
+FAST_CORES(Avx512, 8, AVX512_TARGET)
+
+// One argument at a time, as the scalar evaluators call them.
+#define FAST_SCALAR(NAME, CORE, LIBM) \
+    static double NAME(double x) \
+    { \
+        I1 inside; \
+        F1 y = CORE((F1) { x }, &inside); \
+        return inside[0] ? y[0] : LIBM(x); \
+    }
+
+FAST_SCALAR(expFast, expCoreScalar, exp)
+FAST_SCALAR(exp2Fast, exp2CoreScalar, exp2)
+FAST_SCALAR(logFast, logCoreScalar, log)
+FAST_SCALAR(cbrtFast, cbrtCoreScalar, cbrt)
+
+static double powFast(double x, double y)
+{
+    I1 inside;
+    F1 z = powCoreScalar((F1) { x }, (F1) { y }, &inside);
+    return inside[0] ? z[0] : pow(x, y);
+}
+
+// out[i] = f(a[i]) W at a time; the elements left over take the scalar
+// path, which rounds the same. out may be a.
+#define FAST_MAP(NAME, S, W, TARGET, CORE, SCALAR, LIBM) \
+    TARGET static void NAME(double *out, const double *a, size_t n) \
+    { \
+        size_t i = 0; \
+        for (; i + W <= n; i += W) \
+        { \
+            F##W x, y; \
+            I##W inside; \
+            memcpy(&x, a + i, sizeof x); \
+            y = CORE##S(x, &inside); \
+            for (int j = 0; j < W; j++) \
+            { \
+                if (!inside[j]) \
+                { \
+                    y[j] = LIBM(x[j]); \
+                } \
+            } \
+            memcpy(out + i, &y, sizeof y); \
+        } \
+        for (; i < n; i++) \
+        { \
+            out[i] = SCALAR(a[i]); \
+        } \
+    }
+
+// out[i] = pow(a[i], b[i]), an operand with a step of 0 being a single
+// value used for every element, as in vector.c's kernels.
+#define FAST_POW(NAME, S, W, TARGET) \
+    TARGET static void NAME(double *out, const double *a, size_t aStep, const double *b, size_t bStep, size_t n) \
+    { \
+        size_t i = 0; \
+        for (; i + W <= n; i += W) \
+        { \
+            F##W x, y, z; \
+            I##W inside; \
+            if (aStep) \
+            { \
+                memcpy(&x, a + i, sizeof x); \
+            } \
+            else \
+            { \
+                x = (F##W) {} + a[0]; \
+            } \
+            if (bStep) \
+            { \
+                memcpy(&y, b + i, sizeof y); \
+            } \
+            else \
+            { \
+                y = (F##W) {} + b[0]; \
+            } \
+            z = powCore##S(x, y, &inside); \
+            for (int j = 0; j < W; j++) \
+            { \
+                if (!inside[j]) \
+                { \
+                    z[j] = pow(x[j], y[j]); \
+                } \
+            } \
+            memcpy(out + i, &z, sizeof z); \
+        } \
+        for (; i < n; i++) \
+        { \
+            out[i] = powFast(a[i * aStep], b[i * bStep]); \
+        } \
+    }
+
+#define FAST_TABLE(S, W, TARGET) \
+    FAST_MAP(expMap##S, S, W, TARGET, expCore, expFast, exp) \
+    FAST_MAP(exp2Map##S, S, W, TARGET, exp2Core, exp2Fast, exp2) \
+    FAST_MAP(logMap##S, S, W, TARGET, logCore, logFast, log) \
+    FAST_MAP(cbrtMap##S, S, W, TARGET, cbrtCore, cbrtFast, cbrt) \
+    FAST_POW(powZip##S, S, W, TARGET) \
+    \
+    static const MATH_FUNCS fast##S = { \
+        exp, exp2, log, cbrtFast, pow, \
+        expMap##S, exp2Map##S, logMap##S, cbrtMap##S, powZip##S \
+    };
+
+FAST_TABLE(Scalar, 1, )
+FAST_TABLE(Sse2, 2, SSE2_TARGET)
+FAST_TABLE(Avx2, 4, AVX2_TARGET)
+FAST_TABLE(Avx512, 8, AVX512_TARGET)
+
+#define LIBM_MAP(NAME, LIBM) \
+    static void NAME(double *out, const double *a, size_t n) \
+    { \
+        for (size_t i = 0; i < n; i++) \
+        { \
+            out[i] = LIBM(a[i]); \
+        } \
+    }
+
+LIBM_MAP(expMapLibm, exp)
+LIBM_MAP(exp2MapLibm, exp2)
+LIBM_MAP(logMapLibm, log)
+LIBM_MAP(cbrtMapLibm, cbrt)
+
+static void powZipLibm(double *out, const double *a, size_t aStep, const double *b, size_t bStep, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = pow(a[i * aStep], b[i * bStep]);
+    }
+}
+
+const MATH_FUNCS libmMath = {
+    exp, exp2, log, cbrt, pow,
+    expMapLibm, exp2MapLibm, logMapLibm, cbrtMapLibm, powZipLibm
+};
+
+const MATH_FUNCS *fastMath(int width)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (width == 0)
+    {
+        width = __builtin_cpu_supports("avx512f") ? 8 : __builtin_cpu_supports("avx2") ? 4 : 2;
+    }
+    switch (width)
+    {
+        case 1: return &fastScalar;
+        case 2: return &fastSse2;
+        case 4: return __builtin_cpu_supports("avx2") ? &fastAvx2 : NULL;
+        case 8: return __builtin_cpu_supports("avx512f") ? &fastAvx512 : NULL;
+        default: return NULL;
+    }
+#else
+    switch (width)
+    {
+        case 0:
+        case 2: return &fastSse2;
+        case 1: return &fastScalar;
+        case 4: return &fastAvx2;
+        case 8: return &fastAvx512;
+        default: return NULL;
+    }
+#endif
+}
@@ -0,0 +1,316 @@
+#include "cilisp.h"
+
+// Constant folding and strength reduction, run on every resolved program
+// before it is evaluated or compiled.
+//
+// A function whose operands are all numbers is evaluated here, once, by
+// evalFuncNode itself, so the folded number has exactly the type and the
+// bits that eval would have produced. Calls with the wrong number of
+// operands are left alone: their warnings must still print when (and
+// only if) eval reaches them. Symbols bound to numbers become numbers,
+// cast as their binding says, and a scope whose body folds to a number
+// becomes that number. Nodes are rewritten in place, so the tree walker,
+// the VM, the JIT and --emit-c all see the smaller tree. Function bodies
+// are folded like bindings; parameters and captures are only known once
+// the function is called.
+//
+// cond, and and or instead fold once the numbers they reach decide
+// them, whatever the operands they would skip are. A vector reached as a
+// condition is left for eval, which warns of it.
+//
+// Strength reduction rewrites (pow x 2) to (mult x x) when x is a symbol:
+// a symbol is only evaluated once per scope activation, so x is not
+// computed twice. This is skipped inside let bindings, where reading x
+// twice could report a self-referencing binding twice. x * x is correctly
+// rounded, and libm's pow can differ from it in the last bit.
+// (exp2 k) for an INT k needs no rewriting; the evaluators compute it
+// with ldexp.
+
+static void foldToNumber(AST_ID node, RET_VAL value)
+{
+    ast.types[node] = NUM_NODE_TYPE;
+    NODE(node).number = value;
+}
+
+// (pow x 2) -> (mult x x), reusing the operand slots of the pow
+static void reducePow(AST_ID node, bool inBinding)
+{
+    AST_ID *ops = NODE_OPS(node);
+
+    if (inBinding || NODE(node).function.count != 2 || NODE_TYPE(ops[0]) != SYM_NODE_TYPE
+        || NODE_TYPE(ops[1]) != NUM_NODE_TYPE || NODE(ops[1]).number != retFromInt(2))
+    {
+        return;
+    }
+    NODE(node).function.func = MULT_FUNC;
+    ops[1] = ops[0];
+}
+
+static void foldSymbol(AST_ID node, AST_ID scope)
+{
+    if (NODE(node).symbol.depth < 0)
+    {
+        // undefined, already reported by resolveSymbols
+        foldToNumber(node, NAN_RET_VAL);
+        return;
+    }
+
+    for (int depth = NODE(node).symbol.depth; depth > 0; depth--)
+    {
+        scope = NODE_SCOPE(scope)->outer;
+    }
+    if (NODE_SCOPE(scope)->lambda >= 0)
+    {
+        return;
+    }
+
+    SYMBOL_TABLE_NODE *binding = SCOPE_SLOT(NODE_SCOPE(scope), NODE(node).symbol.slot);
+    if (NODE_TYPE(binding->value) != NUM_NODE_TYPE)
+    {
+        return;
+    }
+
+    RET_VAL value = NODE(binding->value).number;
+    if (binding->type != NO_TYPE)
+    {
+        value = retCast(value, binding->type);
+    }
+    foldToNumber(node, value);
+}
+
+// A cond whose condition is a number, and whose branch it picks is one,
+// is that number. An and or an or is decided by the first number it
+// reaches that is false, or true, provided every operand before it is a
+// number too, and by its last operand if they all are. Every cond, and
+// and or folds here, even one whose operands are all numbers, so that a
+// vector condition is never evaluated (and warned of) at fold time.
+static void foldDecided(AST_ID node)
+{
+    AST_ID *ops = NODE_OPS(node);
+    size_t i = 0;
+
+    switch (NODE(node).function.func)
+    {
+        case COND_FUNC:
+        {
+            if (NODE_TYPE(ops[0]) != NUM_NODE_TYPE || retIsVector(NODE(ops[0]).number))
+            {
+                return;
+            }
+            AST_ID branch = ops[retIsTrue(NODE(ops[0]).number) ? 1 : 2];
+            if (NODE_TYPE(branch) == NUM_NODE_TYPE)
+            {
+                foldToNumber(node, NODE(branch).number);
+            }
+            return;
+        }
+        case AND_FUNC:
+        case OR_FUNC:
+            for (; i < NODE(node).function.count && NODE_TYPE(ops[i]) == NUM_NODE_TYPE
+                && !retIsVector(NODE(ops[i]).number); i++)
+            {
+                bool truth = retIsTrue(NODE(ops[i]).number);
+                if (truth == (NODE(node).function.func == OR_FUNC))
+                {
+                    foldToNumber(node, retFromBool(truth));
+                    return;
+                }
+            }
+            if (i == NODE(node).function.count)
+            {
+                foldToNumber(node, retFromBool(NODE(node).function.func == AND_FUNC));
+            }
+            return;
+        default:
+            return;
+    }
+}
+
+// scope is the innermost scope enclosing node, as in resolveSymbols.
+// Bindings are folded in order before the body, so a binding can use
+// the folded value of any binding before it.
+static void foldNode(AST_ID node, AST_ID scope, bool inBinding)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (NODE_TYPE(node))
+    {
+        case SYM_NODE_TYPE:
+            foldSymbol(node, scope);
+            break;
+
+        case FUNC_NODE_TYPE:
+        {
+            bool constant = true;
+            for (size_t i = 0; i < NODE(node).function.count; i++)
+            {
+                foldNode(NODE_OPS(node)[i], scope, inBinding);
+                constant &= NODE_TYPE(NODE_OPS(node)[i]) == NUM_NODE_TYPE;
+            }
+
+            if (!callIsSilent(NODE(node).function.func, NODE(node).function.count))
+            {
+                break;
+            }
+            FUNC_TYPE func = NODE(node).function.func;
+            if (constant && func != COND_FUNC && func != AND_FUNC && func != OR_FUNC)
+            {
+                foldToNumber(node, evalFuncNode(node));
+            }
+            else if (func == POW_FUNC)
+            {
+                reducePow(node, inBinding);
+            }
+            else
+            {
+                foldDecided(node);
+            }
+            break;
+        }
+
+        case SCOPE_NODE_TYPE:
+        {
+            AST_SCOPE *current = NODE_SCOPE(node);
+            for (int slot = 0; slot < current->slotCount; slot++)
+            {
+                foldNode(SCOPE_SLOT(current, slot)->value, node, true);
+            }
+            for (int i = 0; i < current->lambdaCount; i++)
+            {
+                AST_ID params = ast.lambdas[current->firstLambda + i].params;
+                foldNode(NODE_SCOPE(params)->child, params, true);
+            }
+            foldNode(current->child, node, inBinding);
+            if (NODE_TYPE(current->child) == NUM_NODE_TYPE)
+            {
+                foldToNumber(node, NODE(current->child).number);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void foldConstants(AST_ID program)
+{
+    foldNode(program, 0, false);
+}
+
+// --dump-ast output goes wherever the program's own output goes.
+static void dumpText(char *text)
+{
+    if (options.emitC) emitCText(text);
+    else printf("%s", text);
+}
+
+static void dumpNode(AST_ID node)
+{
+    char buffer[64];
+
+    if (!node)
+    {
+        dumpText("<error>");
+        return;
+    }
+
+    switch (NODE_TYPE(node))
+    {
+        case NUM_NODE_TYPE:
+            if (retIsVector(NODE(node).number))
+            {
+                VECTOR *vector = retVectorOf(NODE(node).number);
+                dumpText("(vec");
+                for (uint32_t i = 0; i < vector->count; i++)
+                {
+                    snprintf(buffer, sizeof(buffer), " %.17g", vector->values[i]);
+                    dumpText(buffer);
+                }
+                dumpText(")");
+                break;
+            }
+            if (retIsInt64(NODE(node).number))
+            {
+                snprintf(buffer, sizeof(buffer), "%lld", (long long) retInt64Of(NODE(node).number));
+                dumpText(buffer);
+                break;
+            }
+            snprintf(buffer, sizeof(buffer), "%.17g", retValue(NODE(node).number));
+            dumpText(buffer);
+            if (retType(NODE(node).number) == DOUBLE_TYPE && strpbrk(buffer, ".en") == NULL)
+            {
+                dumpText(".0");
+            }
+            break;
+
+        case SYM_NODE_TYPE:
+            dumpText(symbolName(NODE(node).symbol.id));
+            break;
+
+        case FUNC_NODE_TYPE:
+            dumpText("(");
+            dumpText(NODE(node).function.func == CUSTOM_FUNC ? symbolName(NODE(NODE_CALLEE(node)).symbol.id)
+                                                            : funcName(NODE(node).function.func));
+            for (size_t i = 0; i < NODE(node).function.count; i++)
+            {
+                dumpText(" ");
+                dumpNode(NODE_OPS(node)[i]);
+            }
+            dumpText(")");
+            break;
+
+        case SCOPE_NODE_TYPE:
+        {
+            AST_SCOPE *scope = NODE_SCOPE(node);
+            dumpText("((let");
+            for (int slot = 0; slot < scope->slotCount; slot++)
+            {
+                SYMBOL_TABLE_NODE *binding = SCOPE_SLOT(scope, slot);
+                dumpText(" (");
+                if (binding->type == INT_TYPE) dumpText("int ");
+                else if (binding->type == DOUBLE_TYPE) dumpText("double ");
+                dumpText(symbolName(binding->id));
+                dumpText(" ");
+                dumpNode(binding->value);
+                dumpText(")");
+            }
+            for (int i = 0; i < scope->lambdaCount; i++)
+            {
+                AST_LAMBDA *lambda = &ast.lambdas[scope->firstLambda + i];
+                AST_SCOPE *params = NODE_SCOPE(lambda->params);
+                dumpText(" (");
+                if (lambda->type == INT_TYPE) dumpText("int ");
+                else if (lambda->type == DOUBLE_TYPE) dumpText("double ");
+                dumpText(symbolName(lambda->id));
+                dumpText(lambda->memo ? " memo lambda (" : " lambda (");
+                for (int slot = 0; slot < params->slotCount; slot++)
+                {
+                    if (slot > 0) dumpText(" ");
+                    dumpText(symbolName(SCOPE_SLOT(params, slot)->id));
+                }
+                dumpText(") ");
+                dumpNode(params->child);
+                dumpText(")");
+            }
+            dumpText(") ");
+            dumpNode(scope->child);
+            dumpText(")");
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+// Prints a program on one line, prefixed by label.
+void dumpAst(char *label, AST_ID program)
+{
+    dumpText(label);
+    dumpNode(program);
+    dumpText("\n");
+}
@@ -0,0 +1,308 @@
+#include "cilisp.h"
+
+// Static type inference, run after folding and pruning.
+//
+// Every value's type follows from literal types, casts and the typing
+// rules of the eval functions, so most nodes can be given the NUM_TYPE
+// they will evaluate to before anything runs. The result goes into
+// ast.numTypes; NO_TYPE there means the type is only known at run time.
+// The tree walker then computes DOUBLE calls on plain doubles, the VM
+// compiles them to untagged instructions, and a cast to the type a
+// binding already has is skipped.
+//
+// Calls that print arity warnings are left dynamic. A symbol that refers
+// to a binding still being inferred (a binding defined in terms of
+// itself) is dynamic as well, so whichever reference evaluation actually
+// reports, the types given to the rest still hold.
+//
+// Builtins work element by element on a VECTOR, so a call with a vector
+// operand is a vector, and in a program that makes vectors at all a
+// dynamic operand may be one: the calls that would otherwise always be
+// DOUBLEs, and casts, are then dynamic too.
+//
+// The comparisons give an INT unless an operand is, or may be, a vector;
+// and and or always give an INT. A cond is dynamic unless both its
+// branches have the same type. Bindings are still inferred at their
+// first reference in the order operands are written, even if that
+// reference is in a branch cond may skip: a binding's type does not
+// depend on where it is evaluated.
+//
+// A function's body is inferred once, at its first call, with its
+// parameters and captures dynamic; a call is its cast, or the type of the
+// body. A call reached again while its body is being inferred (recursion)
+// is dynamic.
+
+typedef enum {
+    INFER_PENDING,
+    INFER_RUNNING,
+    INFER_DONE
+} INFER_STATE;
+
+static struct {
+    uint8_t *done;                  // node -> inferred yet
+    size_t doneCapacity;
+    uint8_t *states;                // by index in ast.bindings
+    size_t stateCapacity;
+    uint8_t *lambdaStates;          // by index in ast.lambdas
+    size_t lambdaStateCapacity;
+    AST_ID *path;                   // scopes around the node being inferred, by level
+    size_t pathCapacity;
+
+    bool vectors;                   // the program makes vectors
+
+    size_t intCount, doubleCount, vectorCount, dynamicCount;
+} infer;
+
+#define INFER_GROW(array, capacity, size) \
+    if ((size) > (capacity)) { \
+        (capacity) = 2 * (size); \
+        if (((array) = realloc((array), (capacity) * sizeof(*(array)))) == NULL) \
+            yyerror("Memory allocation failed!"); \
+    }
+
+static NUM_TYPE inferNode(AST_ID node, int level);
+
+// A dynamic value can only be a vector if the program makes them.
+static bool maybeVector(NUM_TYPE type)
+{
+    return type == NO_TYPE && infer.vectors;
+}
+
+// The type of add, sub, mult, div, remainder and pow: a vector if any
+// operand is one, a double if any operand is one, otherwise an INT.
+static NUM_TYPE arithmeticType(NUM_TYPE a, NUM_TYPE b)
+{
+    if (a == VECTOR_TYPE || b == VECTOR_TYPE)
+    {
+        return VECTOR_TYPE;
+    }
+    if ((a == DOUBLE_TYPE || b == DOUBLE_TYPE) && !maybeVector(a) && !maybeVector(b))
+    {
+        return DOUBLE_TYPE;
+    }
+    return a == INT_TYPE && b == INT_TYPE ? INT_TYPE : NO_TYPE;
+}
+
+static NUM_TYPE inferFunction(AST_ID node, int level)
+{
+    AST_ID *ops = NODE_OPS(node);
+    size_t count = NODE(node).function.count;
+    FUNC_TYPE func = NODE(node).function.func;
+
+    if (func == COND_FUNC)
+    {
+        // either branch's type, if they agree
+        inferNode(ops[0], level);
+        NUM_TYPE then = inferNode(ops[1], level);
+        return inferNode(ops[2], level) == then ? then : NO_TYPE;
+    }
+    if (func == VEC_FUNC || func == AND_FUNC || func == OR_FUNC)
+    {
+        // the calls that may have no operands
+        for (size_t i = 0; i < count; i++)
+        {
+            inferNode(ops[i], level);
+        }
+        return func == VEC_FUNC ? VECTOR_TYPE : INT_TYPE;
+    }
+
+    NUM_TYPE type = inferNode(ops[0], level);
+    NUM_TYPE first = type;
+    for (size_t i = 1; i < count; i++)
+    {
+        NUM_TYPE next = inferNode(ops[i], level);
+        if (func == MIN_FUNC || func == MAX_FUNC)
+        {
+            // the result is one of the operands, or a vector of their elements
+            type = type == VECTOR_TYPE || next == VECTOR_TYPE ? VECTOR_TYPE : next == type ? type : NO_TYPE;
+        }
+        else
+        {
+            type = arithmeticType(type, next);
+        }
+    }
+
+    switch (func)
+    {
+        case NEG_FUNC:
+        case ABS_FUNC:
+        case EXP2_FUNC:
+            return first;
+        case LESS_FUNC:
+        case GREATER_FUNC:
+        case EQUAL_FUNC:
+            return type == VECTOR_TYPE || maybeVector(type) ? type : INT_TYPE;
+        case EXP_FUNC:
+        case LOG_FUNC:
+        case SQRT_FUNC:
+        case CBRT_FUNC:
+        case HYPOT_FUNC:
+            return type == VECTOR_TYPE || maybeVector(type) ? type : DOUBLE_TYPE;
+        default:
+            return type;
+    }
+}
+
+static NUM_TYPE inferSymbol(AST_ID node, int level)
+{
+    if (NODE(node).symbol.depth < 0)
+    {
+        return DOUBLE_TYPE;
+    }
+
+    level -= NODE(node).symbol.depth;
+    if (NODE(node).symbol.slot >= NODE_SCOPE(infer.path[level])->slotCount)
+    {
+        return NO_TYPE;
+    }
+    uint32_t binding = NODE_SCOPE(infer.path[level])->firstSlot + (uint32_t) NODE(node).symbol.slot;
+    NUM_TYPE cast = ast.bindings[binding].type;
+
+    if (infer.states[binding] == INFER_PENDING)
+    {
+        infer.states[binding] = INFER_RUNNING;
+        inferNode(ast.bindings[binding].value, level);
+        infer.states[binding] = INFER_DONE;
+    }
+    if (infer.states[binding] == INFER_RUNNING)
+    {
+        return NO_TYPE;
+    }
+    AST_ID value = ast.bindings[binding].value;
+    NUM_TYPE type = infer.states[binding] == INFER_DONE && value ? (NUM_TYPE) ast.numTypes[value] : NO_TYPE;
+    if (cast != NO_TYPE && type != VECTOR_TYPE && !maybeVector(type))
+    {
+        return cast;
+    }
+    return type;
+}
+
+static NUM_TYPE inferCall(AST_ID node, int level)
+{
+    for (size_t i = 0; i < NODE(node).function.count; i++)
+    {
+        inferNode(NODE_OPS(node)[i], level);
+    }
+
+    AST_ID callee = NODE_CALLEE(node);
+    if (NODE(callee).symbol.depth < 0)
+    {
+        return DOUBLE_TYPE;
+    }
+    uint32_t index = NODE(callee).symbol.lambda;
+    AST_LAMBDA *lambda = &ast.lambdas[index];
+    AST_SCOPE *params = NODE_SCOPE(lambda->params);
+    if (NODE(node).function.count != (size_t) params->slotCount)
+    {
+        return NO_TYPE;
+    }
+
+    if (infer.lambdaStates[index] == INFER_PENDING)
+    {
+        infer.lambdaStates[index] = INFER_RUNNING;
+        INFER_GROW(infer.path, infer.pathCapacity, (size_t) level + 2);
+        AST_ID outer = infer.path[level + 1];
+        infer.path[level + 1] = lambda->params;
+        inferNode(params->child, level + 1);
+        infer.path[level + 1] = outer;
+        infer.lambdaStates[index] = INFER_DONE;
+    }
+    NUM_TYPE type = infer.lambdaStates[index] == INFER_DONE ? (NUM_TYPE) ast.numTypes[params->child] : NO_TYPE;
+    if (lambda->type != NO_TYPE && type != VECTOR_TYPE && !maybeVector(type))
+    {
+        return lambda->type;
+    }
+    return type;
+}
+
+// The innermost scope enclosing node is infer.path[level]. A binding is
+// inferred at its first reference, from the level of its scope.
+static NUM_TYPE inferNode(AST_ID node, int level)
+{
+    if (!node)
+    {
+        return NO_TYPE;
+    }
+    if (infer.done[node])
+    {
+        return (NUM_TYPE) ast.numTypes[node];
+    }
+
+    NUM_TYPE type = NO_TYPE;
+    switch (NODE_TYPE(node))
+    {
+        case NUM_NODE_TYPE:
+            type = retType(NODE(node).number);
+            break;
+
+        case SYM_NODE_TYPE:
+            type = inferSymbol(node, level);
+            break;
+
+        case FUNC_NODE_TYPE:
+            if (callIsSilent(NODE(node).function.func, NODE(node).function.count))
+            {
+                type = inferFunction(node, level);
+            }
+            else if (NODE(node).function.func == CUSTOM_FUNC)
+            {
+                type = inferCall(node, level);
+            }
+            else
+            {
+                for (size_t i = 0; i < NODE(node).function.count; i++)
+                {
+                    inferNode(NODE_OPS(node)[i], level);
+                }
+            }
+            break;
+
+        case SCOPE_NODE_TYPE:
+        {
+            // a binding can be inferred from deeper down, so the entry
+            // this overwrites may still be in use
+            INFER_GROW(infer.path, infer.pathCapacity, (size_t) level + 2);
+            AST_ID outer = infer.path[level + 1];
+            infer.path[level + 1] = node;
+            type = inferNode(NODE_SCOPE(node)->child, level + 1);
+            infer.path[level + 1] = outer;
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    // nodes shared by hash-consing are inferred once
+    infer.done[node] = true;
+    ast.numTypes[node] = (uint8_t) type;
+
+    if (type == INT_TYPE) infer.intCount++;
+    else if (type == DOUBLE_TYPE) infer.doubleCount++;
+    else if (type == VECTOR_TYPE) infer.vectorCount++;
+    else infer.dynamicCount++;
+    return type;
+}
+
+void inferTypes(AST_ID program)
+{
+    INFER_GROW(infer.done, infer.doneCapacity, ast.count);
+    INFER_GROW(infer.states, infer.stateCapacity, ast.bindingCount + 1);
+    INFER_GROW(infer.lambdaStates, infer.lambdaStateCapacity, ast.lambdaCount + 1);
+    INFER_GROW(infer.path, infer.pathCapacity, 1);
+    memset(infer.done, 0, ast.count);
+    memset(infer.states, INFER_PENDING, ast.bindingCount);
+    memset(infer.lambdaStates, INFER_PENDING, ast.lambdaCount);
+
+    infer.vectors = astMakesVectors();
+
+    infer.intCount = infer.doubleCount = infer.vectorCount = infer.dynamicCount = 0;
+    infer.path[0] = 0;
+    inferNode(program, 0);
+
+    if (flex_bison_log_file != NULL)
+    {
+        fprintf(flex_bison_log_file, "TYPES: %zu int, %zu double, %zu vector, %zu dynamic nodes\n",
+                infer.intCount, infer.doubleCount, infer.vectorCount, infer.dynamicCount);
+    }
+}
@@ -0,0 +1,6 @@
+#!/bin/bash
+# Checks that static type inference never changes what a program prints,
+# on either engine; see check.sh.
+# Build first with "run", then: ./infercheck.sh [programs...]
+
+exec ./check.sh -r "--engine=tree --infer=off" --engine=tree --engine=vm "--engine=vm --infer=off" -- "$@"
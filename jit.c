@@ -0,0 +1,748 @@
+#include "cilisp.h"
+#include <stdint.h>
+
+// x86-64 JIT for numeric expressions.
+//
+// A resolved program is walked in evaluation order (bindings at their
+// first reference, like the lazy evaluator). The walk records the
+// program's shape (node kinds, functions, arities, symbol addresses,
+// literal and cast types) and its literal values. Programs with the same
+// shape share one compiled function that takes the literals as an array,
+// so a formula evaluated over and over with different numbers is
+// compiled once. A shape is compiled after JIT_HOT_THRESHOLD sightings,
+// or on first sight with --jit.
+//
+// Generated code is straight-line SSE2: the result of every node ends
+// up in xmm0, pending accumulators live in stack temporaries and let
+// bindings in a caller-provided array. sqrt, neg, abs, min and max are
+// done inline; exp, exp2, log, cbrt and pow are called through
+// options.math, and fmod through libm, so results match eval bit for
+// bit. less, greater and equal compare without branching, masking 1.0
+// with the compare's result. Result types are worked out at compile
+// time, which is possible because every type in the language follows
+// from literal types and casts.
+//
+// Programs that would print warnings, use cond, and or or (whose skipped
+// operands would break the straight line), call custom functions, make
+// vectors, take the min/max of mixed types, add, multiply or hypot
+// RET_WIDE_CALL or more operands or define a binding in terms of itself
+// are left to the VM.
+//
+// The evaluators keep integral INTs exact, as int64_t or bignums, which
+// doubles only match below 2^53. INT literals beyond that are left to
+// the VM, and the generated code checks every INT it computes (including
+// the running sum or product of INT operands); one that gets that big
+// raises a flag in the word before the bindings, and the program is run
+// again on the VM.
+
+#define JIT_HOT_THRESHOLD 16
+#define JIT_CACHE_SIZE 1024
+#define JIT_CACHE_PROBES 8
+
+typedef double (*JIT_FUNC)(const double *constants, double *bindings);
+
+#define JIT_EXACT_LIMIT 0x1p53
+
+typedef struct jit_scope {
+    AST_SCOPE *node;
+    int base;                   // index of the scope's first binding
+    struct jit_scope *outer;
+} JIT_SCOPE;
+
+typedef struct {
+    SLOT_STATE state;
+    NUM_TYPE type;
+} JIT_BINDING;
+
+typedef struct {
+    uint32_t *shape;
+    size_t shapeSize;
+    uint64_t hash;
+    unsigned hits;
+    bool rejected;
+    JIT_FUNC func;
+    NUM_TYPE type;
+    int bindingCount;
+} JIT_ENTRY;
+
+#define JIT_GROW(array, count, capacity, extra) \
+    if ((count) + (extra) > (capacity)) { \
+        (capacity) = 2 * ((count) + (extra)); \
+        if (((array) = realloc((array), (capacity) * sizeof(*(array)))) == NULL) \
+            yyerror("Memory allocation failed!"); \
+    }
+
+// State of one walk over a program, reused between programs.
+static struct {
+    bool emit;
+    bool rejected;
+    uint32_t *shape;
+    size_t shapeSize, shapeCapacity;
+    double *constants;
+    size_t constantCount, constantCapacity;
+    JIT_BINDING *bindings;
+    size_t bindingCount, bindingCapacity;
+    unsigned char *code;
+    size_t codeSize, codeCapacity;
+    int temps, maxTemps;
+} jit;
+
+static JIT_ENTRY cache[JIT_CACHE_SIZE];
+
+static void shapeWord(uint32_t word)
+{
+    JIT_GROW(jit.shape, jit.shapeSize, jit.shapeCapacity, 1);
+    jit.shape[jit.shapeSize++] = word;
+}
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+static void emitBytes(const unsigned char *bytes, size_t count)
+{
+    if (!jit.emit)
+    {
+        return;
+    }
+    JIT_GROW(jit.code, jit.codeSize, jit.codeCapacity, count);
+    memcpy(jit.code + jit.codeSize, bytes, count);
+    jit.codeSize += count;
+}
+
+#define EMIT(...) do { \
+        const unsigned char bytes_[] = { __VA_ARGS__ }; \
+        emitBytes(bytes_, sizeof(bytes_)); \
+    } while (0)
+
+static void emit32(int32_t value)
+{
+    emitBytes((const unsigned char *) &value, 4);
+}
+
+static void emit64(uint64_t value)
+{
+    emitBytes((const unsigned char *) &value, 8);
+}
+
+// mov rax, imm64
+static void emitMovRax(uint64_t value)
+{
+    EMIT(0x48, 0xB8);
+    emit64(value);
+}
+
+// xmm1 = bit pattern
+static void emitXmm1Bits(uint64_t bits)
+{
+    emitMovRax(bits);
+    EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC8);         // movq xmm1, rax
+}
+
+static void emitXmm0Bits(uint64_t bits)
+{
+    emitMovRax(bits);
+    EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC0);         // movq xmm0, rax
+}
+
+static uint64_t doubleBits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// call a libm function; arguments are already in xmm0 (and xmm1)
+static void emitCall(void *func)
+{
+    emitMovRax((uint64_t) (uintptr_t) func);
+    EMIT(0xFF, 0xD0);                           // call rax
+}
+
+// Stack temporaries sit below the saved rbx and r12.
+static int32_t tempOffset(int temp)
+{
+    return -24 - 8 * temp;
+}
+
+static int pushTemp(void)
+{
+    int temp = jit.temps++;
+    if (jit.temps > jit.maxTemps)
+    {
+        jit.maxTemps = jit.temps;
+    }
+    return temp;
+}
+
+static void storeTemp(int temp)
+{
+    EMIT(0xF2, 0x0F, 0x11, 0x85);               // movsd [rbp + disp32], xmm0
+    emit32(tempOffset(temp));
+}
+
+static void loadTempXmm0(int temp)
+{
+    EMIT(0xF2, 0x0F, 0x10, 0x85);               // movsd xmm0, [rbp + disp32]
+    emit32(tempOffset(temp));
+}
+
+static void loadTempXmm1(int temp)
+{
+    EMIT(0xF2, 0x0F, 0x10, 0x8D);               // movsd xmm1, [rbp + disp32]
+    emit32(tempOffset(temp));
+}
+
+static void emitConstant(double value)
+{
+    JIT_GROW(jit.constants, jit.constantCount, jit.constantCapacity, 1);
+    EMIT(0xF2, 0x0F, 0x10, 0x83);               // movsd xmm0, [rbx + disp32]
+    emit32((int32_t) (8 * jit.constantCount));
+    jit.constants[jit.constantCount++] = value;
+}
+
+// Flags an INT result in xmm0 that doubles may not hold exactly,
+// keeping xmm0.
+static void checkInt(NUM_TYPE type)
+{
+    if (type != INT_TYPE)
+    {
+        return;
+    }
+    emitXmm1Bits(0x7FFFFFFFFFFFFFFFULL);
+    EMIT(0x66, 0x0F, 0x54, 0xC8);               // andpd xmm1, xmm0
+    emitMovRax(doubleBits(JIT_EXACT_LIMIT));
+    EMIT(0x66, 0x48, 0x0F, 0x6E, 0xD0);         // movq xmm2, rax
+    EMIT(0xF2, 0x0F, 0xC2, 0xD1, 0x02);         // cmplesd xmm2, xmm1
+    EMIT(0xF2, 0x41, 0x0F, 0x10, 0x4C, 0x24, 0xF8);     // movsd xmm1, [r12 - 8]
+    EMIT(0x66, 0x0F, 0x56, 0xCA);               // orpd xmm1, xmm2
+    EMIT(0xF2, 0x41, 0x0F, 0x11, 0x4C, 0x24, 0xF8);     // movsd [r12 - 8], xmm1
+}
+
+static NUM_TYPE jitNode(AST_ID node, JIT_SCOPE *scope);
+
+static NUM_TYPE binaryType(NUM_TYPE a, NUM_TYPE b)
+{
+    return a == DOUBLE_TYPE || b == DOUBLE_TYPE ? DOUBLE_TYPE : INT_TYPE;
+}
+
+static NUM_TYPE jitUnary(FUNC_TYPE func, AST_ID *ops, size_t count, JIT_SCOPE *scope)
+{
+    if (count != 1)
+    {
+        jit.rejected = true;
+        return NO_TYPE;
+    }
+
+    NUM_TYPE type = jitNode(ops[0], scope);
+
+    switch (func)
+    {
+        case NEG_FUNC:
+            emitXmm1Bits(0x8000000000000000ULL);
+            EMIT(0x66, 0x0F, 0x57, 0xC1);       // xorpd xmm0, xmm1
+            return type;
+        case ABS_FUNC:
+            emitXmm1Bits(0x7FFFFFFFFFFFFFFFULL);
+            EMIT(0x66, 0x0F, 0x54, 0xC1);       // andpd xmm0, xmm1
+            return type;
+        case SQRT_FUNC:
+            EMIT(0xF2, 0x0F, 0x51, 0xC0);       // sqrtsd xmm0, xmm0
+            return DOUBLE_TYPE;
+        case EXP_FUNC:
+            emitCall((void *) options.math->exp);
+            return DOUBLE_TYPE;
+        case EXP2_FUNC:
+            // exp2 never produces a negative result, so the type carries through
+            emitCall((void *) options.math->exp2);
+            checkInt(type);
+            return type;
+        case LOG_FUNC:
+            emitCall((void *) options.math->log);
+            return DOUBLE_TYPE;
+        case CBRT_FUNC:
+            emitCall((void *) options.math->cbrt);
+            return DOUBLE_TYPE;
+        default:
+            jit.rejected = true;
+            return NO_TYPE;
+    }
+}
+
+static NUM_TYPE jitBinary(FUNC_TYPE func, AST_ID *ops, size_t count, JIT_SCOPE *scope)
+{
+    if (count != 2)
+    {
+        jit.rejected = true;
+        return NO_TYPE;
+    }
+
+    int temp = pushTemp();
+    NUM_TYPE first = jitNode(ops[0], scope);
+    storeTemp(temp);
+    NUM_TYPE second = jitNode(ops[1], scope);
+    EMIT(0x66, 0x0F, 0x28, 0xC8);               // movapd xmm1, xmm0
+    loadTempXmm0(temp);
+    jit.temps--;
+
+    switch (func)
+    {
+        case SUB_FUNC:
+            EMIT(0xF2, 0x0F, 0x5C, 0xC1);       // subsd xmm0, xmm1
+            break;
+        case DIV_FUNC:
+            EMIT(0xF2, 0x0F, 0x5E, 0xC1);       // divsd xmm0, xmm1
+            break;
+        case REMAINDER_FUNC:
+            emitCall((void *) fmod);
+            emitXmm1Bits(0x7FFFFFFFFFFFFFFFULL);
+            EMIT(0x66, 0x0F, 0x54, 0xC1);       // andpd xmm0, xmm1
+            break;
+        case POW_FUNC:
+            emitCall((void *) options.math->pow);
+            break;
+        case LESS_FUNC:
+        case GREATER_FUNC:
+        case EQUAL_FUNC:
+            // the compare leaves a mask of ones for true, which picks 1.0 or 0.0
+            if (func == LESS_FUNC)
+            {
+                EMIT(0xF2, 0x0F, 0xC2, 0xC1, 0x01);     // cmpltsd xmm0, xmm1
+            }
+            else if (func == GREATER_FUNC)
+            {
+                EMIT(0xF2, 0x0F, 0xC2, 0xC8, 0x01);     // cmpltsd xmm1, xmm0
+                EMIT(0x66, 0x0F, 0x28, 0xC1);           // movapd xmm0, xmm1
+            }
+            else
+            {
+                EMIT(0xF2, 0x0F, 0xC2, 0xC1, 0x00);     // cmpeqsd xmm0, xmm1
+            }
+            emitXmm1Bits(doubleBits(1.0));
+            EMIT(0x66, 0x0F, 0x54, 0xC1);               // andpd xmm0, xmm1
+            return INT_TYPE;
+        default:
+            jit.rejected = true;
+            break;
+    }
+    checkInt(binaryType(first, second));
+    return binaryType(first, second);
+}
+
+static NUM_TYPE jitVariadic(FUNC_TYPE func, AST_ID *ops, size_t count, JIT_SCOPE *scope)
+{
+    NUM_TYPE type;
+    NUM_TYPE resultType = NO_TYPE;
+    bool trackDouble = false;
+    size_t first = 0;
+
+    // wide sums and products are reduced pairwise, not in order
+    if (count == 0 || (count >= RET_WIDE_CALL && func != MIN_FUNC && func != MAX_FUNC))
+    {
+        jit.rejected = true;
+        return NO_TYPE;
+    }
+
+    int temp = pushTemp();
+
+    // the accumulator starts where the evaluator's does: 0 for add and hypot, 1 for mult,
+    // the first operand for min and max
+    if (func == ADD_FUNC || func == HYPOT_FUNC)
+    {
+        EMIT(0x66, 0x0F, 0x57, 0xC0);           // xorpd xmm0, xmm0
+        storeTemp(temp);
+    }
+    else if (func == MULT_FUNC)
+    {
+        emitXmm0Bits(doubleBits(1.0));
+        storeTemp(temp);
+    }
+    else
+    {
+        resultType = jitNode(ops[0], scope);
+        storeTemp(temp);
+        first = 1;
+    }
+
+    for (size_t i = first; i < count; i++)
+    {
+        type = jitNode(ops[i], scope);
+
+        switch (func)
+        {
+            case ADD_FUNC:
+                EMIT(0x66, 0x0F, 0x28, 0xC8);   // movapd xmm1, xmm0
+                loadTempXmm0(temp);
+                EMIT(0xF2, 0x0F, 0x58, 0xC1);   // addsd xmm0, xmm1
+                break;
+            case MULT_FUNC:
+                EMIT(0x66, 0x0F, 0x28, 0xC8);   // movapd xmm1, xmm0
+                loadTempXmm0(temp);
+                EMIT(0xF2, 0x0F, 0x59, 0xC1);   // mulsd xmm0, xmm1
+                break;
+            case HYPOT_FUNC:
+                emitXmm1Bits(doubleBits(2.0));
+                emitCall((void *) pow);
+                EMIT(0x66, 0x0F, 0x28, 0xC8);   // movapd xmm1, xmm0
+                loadTempXmm0(temp);
+                EMIT(0xF2, 0x0F, 0x58, 0xC1);   // addsd xmm0, xmm1
+                break;
+            case MIN_FUNC:
+                // minsd x, y gives x < y ? x : y, i.e. the evaluator's "if (result > x) result = x"
+                loadTempXmm1(temp);
+                EMIT(0xF2, 0x0F, 0x5D, 0xC1);   // minsd xmm0, xmm1
+                break;
+            case MAX_FUNC:
+                loadTempXmm1(temp);
+                EMIT(0xF2, 0x0F, 0x5F, 0xC1);   // maxsd xmm0, xmm1
+                break;
+            default:
+                jit.rejected = true;
+                break;
+        }
+        if ((func == ADD_FUNC || func == MULT_FUNC) && !trackDouble)
+        {
+            // the evaluators are still on int64_t
+            checkInt(type);
+        }
+        storeTemp(temp);
+
+        if (func == MIN_FUNC || func == MAX_FUNC)
+        {
+            // the result takes the winning operand's type, which is only static if they all agree
+            if (type != resultType)
+            {
+                jit.rejected = true;
+            }
+        }
+        else
+        {
+            resultType = type;
+            trackDouble |= type == DOUBLE_TYPE;
+        }
+    }
+
+    loadTempXmm0(temp);
+    jit.temps--;
+
+    if (func == HYPOT_FUNC)
+    {
+        EMIT(0xF2, 0x0F, 0x51, 0xC0);           // sqrtsd xmm0, xmm0
+        return DOUBLE_TYPE;
+    }
+    return trackDouble ? DOUBLE_TYPE : resultType;
+}
+
+static NUM_TYPE jitSymbol(AST_ID node, JIT_SCOPE *scope)
+{
+    int depth = NODE(node).symbol.depth;
+    int slot = NODE(node).symbol.slot;
+
+    shapeWord((uint32_t) depth);
+    shapeWord((uint32_t) slot);
+
+    if (depth < 0)
+    {
+        emitConstant(NAN);
+        return DOUBLE_TYPE;
+    }
+
+    for (; depth > 0; depth--)
+    {
+        scope = scope->outer;
+    }
+
+    int index = scope->base + slot;
+    JIT_BINDING *binding = &jit.bindings[index];
+
+    if (binding->state == SLOT_EVALUATING)
+    {
+        jit.rejected = true;
+        return NO_TYPE;
+    }
+
+    if (binding->state == SLOT_UNEVALUATED)
+    {
+        // first reference in evaluation order: compute the binding and keep it
+        SYMBOL_TABLE_NODE *table = SCOPE_SLOT(scope->node, slot);
+
+        binding->state = SLOT_EVALUATING;
+        shapeWord(table->type);
+        NUM_TYPE type = jitNode(table->value, scope);
+        binding = &jit.bindings[index];
+        binding->type = table->type != NO_TYPE ? table->type : type;
+        binding->state = SLOT_READY;
+
+        EMIT(0xF2, 0x41, 0x0F, 0x11, 0x84, 0x24);   // movsd [r12 + disp32], xmm0
+        emit32(8 * index);
+        return binding->type;
+    }
+
+    EMIT(0xF2, 0x41, 0x0F, 0x10, 0x84, 0x24);       // movsd xmm0, [r12 + disp32]
+    emit32(8 * index);
+    return binding->type;
+}
+
+static NUM_TYPE jitNode(AST_ID node, JIT_SCOPE *scope)
+{
+    if (jit.rejected)
+    {
+        return NO_TYPE;
+    }
+
+    shapeWord(NODE_TYPE(node));
+
+    switch (NODE_TYPE(node))
+    {
+        case NUM_NODE_TYPE:
+            if (retIsVector(NODE(node).number)
+                || (retIsInteger(NODE(node).number) && fabs(retValue(NODE(node).number)) >= JIT_EXACT_LIMIT))
+            {
+                jit.rejected = true;
+                return NO_TYPE;
+            }
+            shapeWord(retType(NODE(node).number));
+            emitConstant(retValue(NODE(node).number));
+            return retType(NODE(node).number);
+
+        case SYM_NODE_TYPE:
+            return jitSymbol(node, scope);
+
+        case SCOPE_NODE_TYPE:
+        {
+            JIT_SCOPE inner = { NODE_SCOPE(node), (int) jit.bindingCount, scope };
+            size_t count = inner.node->slotCount;
+
+            shapeWord((uint32_t) count);
+            JIT_GROW(jit.bindings, jit.bindingCount, jit.bindingCapacity, count);
+            for (size_t i = 0; i < count; i++)
+            {
+                jit.bindings[jit.bindingCount++].state = SLOT_UNEVALUATED;
+            }
+            return jitNode(inner.node->child, &inner);
+        }
+
+        case FUNC_NODE_TYPE:
+        {
+            FUNC_TYPE func = NODE(node).function.func;
+            AST_ID *ops = NODE_OPS(node);
+            size_t count = NODE(node).function.count;
+
+            shapeWord(func);
+            shapeWord((uint32_t) count);
+
+            switch (func)
+            {
+                case NEG_FUNC:
+                case ABS_FUNC:
+                case EXP_FUNC:
+                case EXP2_FUNC:
+                case LOG_FUNC:
+                case SQRT_FUNC:
+                case CBRT_FUNC:
+                    return jitUnary(func, ops, count, scope);
+                case SUB_FUNC:
+                case DIV_FUNC:
+                case REMAINDER_FUNC:
+                case POW_FUNC:
+                case LESS_FUNC:
+                case GREATER_FUNC:
+                case EQUAL_FUNC:
+                    return jitBinary(func, ops, count, scope);
+                case ADD_FUNC:
+                case MULT_FUNC:
+                case HYPOT_FUNC:
+                case MIN_FUNC:
+                case MAX_FUNC:
+                    return jitVariadic(func, ops, count, scope);
+                default:
+                    jit.rejected = true;
+                    return NO_TYPE;
+            }
+        }
+
+        default:
+            jit.rejected = true;
+            return NO_TYPE;
+    }
+}
+
+// Walks the program, recording its shape and literals and, when emit is
+// set, generating code. Returns the program's static result type.
+static NUM_TYPE jitWalk(AST_ID program, bool emit)
+{
+    jit.emit = emit;
+    jit.rejected = false;
+    jit.shapeSize = 0;
+    jit.constantCount = 0;
+    jit.bindingCount = 0;
+    jit.codeSize = 0;
+    jit.temps = 0;
+    jit.maxTemps = 0;
+
+    EMIT(0x55);                                 // push rbp
+    EMIT(0x48, 0x89, 0xE5);                     // mov rbp, rsp
+    EMIT(0x53);                                 // push rbx
+    EMIT(0x41, 0x54);                           // push r12
+    EMIT(0x48, 0x81, 0xEC);                     // sub rsp, imm32 (patched below)
+    size_t frameSizeAt = jit.codeSize;
+    emit32(0);
+    EMIT(0x48, 0x89, 0xFB);                     // mov rbx, rdi (constants)
+    EMIT(0x49, 0x89, 0xF4);                     // mov r12, rsi (bindings)
+
+    NUM_TYPE type = jitNode(program, NULL);
+
+    EMIT(0x48, 0x8D, 0x65, 0xF0);               // lea rsp, [rbp - 16]
+    EMIT(0x41, 0x5C);                           // pop r12
+    EMIT(0x5B);                                 // pop rbx
+    EMIT(0x5D);                                 // pop rbp
+    EMIT(0xC3);                                 // ret
+
+    if (emit)
+    {
+        // keep rsp 16-byte aligned at every libm call
+        int32_t frameSize = (8 * jit.maxTemps + 15) & ~15;
+        memcpy(jit.code + frameSizeAt, &frameSize, 4);
+    }
+
+    return type;
+}
+
+// Copies the generated code into its own executable mapping.
+static JIT_FUNC jitInstall(void)
+{
+    void *mem = mmap(NULL, jit.codeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+    memcpy(mem, jit.code, jit.codeSize);
+    if (mprotect(mem, jit.codeSize, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mem, jit.codeSize);
+        return NULL;
+    }
+    return (JIT_FUNC) mem;
+}
+
+static uint64_t shapeHash(void)
+{
+    // FNV-1a over the shape words
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < jit.shapeSize; i++)
+    {
+        hash = (hash ^ jit.shape[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Finds the cache entry for the current shape. A shape that has not been
+// seen takes an empty entry near its hash, or else the coldest entry that
+// has not been compiled yet. Returns NULL if every nearby entry holds code.
+static JIT_ENTRY *cacheLookup(void)
+{
+    uint64_t hash = shapeHash();
+    size_t index = hash & (JIT_CACHE_SIZE - 1);
+    JIT_ENTRY *victim = NULL;
+
+    for (size_t probe = 0; probe < JIT_CACHE_PROBES; probe++)
+    {
+        JIT_ENTRY *entry = &cache[(index + probe) & (JIT_CACHE_SIZE - 1)];
+
+        if (entry->shape == NULL)
+        {
+            victim = entry;
+            break;
+        }
+        if (entry->hash == hash && entry->shapeSize == jit.shapeSize
+            && memcmp(entry->shape, jit.shape, jit.shapeSize * sizeof(uint32_t)) == 0)
+        {
+            return entry;
+        }
+        if (entry->func == NULL && (victim == NULL || entry->hits < victim->hits))
+        {
+            victim = entry;
+        }
+    }
+
+    if (victim == NULL)
+    {
+        return NULL;
+    }
+
+    free(victim->shape);
+    memset(victim, 0, sizeof(JIT_ENTRY));
+    victim->hash = hash;
+    victim->shapeSize = jit.shapeSize;
+    if ((victim->shape = malloc(jit.shapeSize * sizeof(uint32_t))) == NULL)
+    {
+        yyerror("Memory allocation failed!");
+    }
+    memcpy(victim->shape, jit.shape, jit.shapeSize * sizeof(uint32_t));
+    return victim;
+}
+
+// Evaluates a resolved program with compiled code if its shape is hot
+// (or --jit is on). Returns false if the caller should evaluate it some
+// other way.
+bool jitEvaluate(AST_ID program, RET_VAL *result)
+{
+    if (options.jit == JIT_OFF || program == 0)
+    {
+        return false;
+    }
+
+    NUM_TYPE type = jitWalk(program, false);
+    if (jit.rejected)
+    {
+        return false;
+    }
+
+    JIT_ENTRY *entry = cacheLookup();
+    if (entry == NULL || entry->rejected)
+    {
+        return false;
+    }
+
+    if (entry->func == NULL)
+    {
+        if (++entry->hits < JIT_HOT_THRESHOLD && options.jit != JIT_ALWAYS)
+        {
+            return false;
+        }
+
+        jitWalk(program, true);
+        if ((entry->func = jitInstall()) == NULL)
+        {
+            entry->rejected = true;
+            return false;
+        }
+        entry->type = type;
+        entry->bindingCount = (int) jit.bindingCount;
+    }
+
+    // bindings[0] is the flag raised by checkInt
+    double *bindings = arenaAlloc((entry->bindingCount + 1) * sizeof(double));
+    bindings[0] = 0;
+    double value = entry->func(jit.constants, bindings + 1);
+    if (bindings[0] != 0)
+    {
+        return false;
+    }
+    *result = makeRetVal(entry->type, value);
+    return true;
+}
+
+#else
+
+// No code generator for this architecture; everything runs on the VM.
+bool jitEvaluate(AST_ID program, RET_VAL *result)
+{
+    (void) program;
+    (void) result;
+    (void) shapeWord;
+    (void) cache;
+    return false;
+}
+
+#endif
@@ -0,0 +1,8 @@
+#!/bin/bash
+# Checks the JIT against eval alone (--engine=tree with folding, pruning
+# and inference off), all printing doubles with %a, so bit for bit; see
+# check.sh.
+# Build first with "run", then: ./jitcheck.sh [programs...]
+
+exec ./check.sh -r "--print=hex --engine=tree --fold=off --prune=off --infer=off" \
+    "--print=hex --jit" "--print=hex --jit=auto" -- "$@"
@@ -0,0 +1,84 @@
+#!/bin/bash
+# Times libm against the --math=fast approximations of fastmath.c.
+# Run from the source directory: ./mathbench.sh [elements] [passes]
+# Each function maps an array of arguments in the range the evaluators
+# usually see, once through libm and once through the approximations at
+# each SIMD width the CPU has, and prints millions of results per second.
+
+ELEMENTS=${1:-4096}
+PASSES=${2:-2000}
+DRIVER=$(mktemp -d)
+
+cat > "$DRIVER/mathbench.c" <<'EOF'
+#include "cilisp.h"
+#include <time.h>
+
+static double seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static double sink;
+
+static void timeMap(const MATH_FUNCS *math, const char *name, double *out, double *x, double *y, size_t n, int passes)
+{
+    double start = seconds();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        if (!strcmp(name, "pow"))
+        {
+            math->powZip(out, x, 1, y, 1, n);
+        }
+        else
+        {
+            (!strcmp(name, "exp") ? math->expMap : !strcmp(name, "exp2") ? math->exp2Map :
+             !strcmp(name, "log") ? math->logMap : math->cbrtMap)(out, x, n);
+        }
+        sink += out[pass % n];
+    }
+    printf(" %9.1f", (double) n * passes / (seconds() - start) / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = strtoul(argv[1], NULL, 10);
+    int passes = atoi(argv[2]);
+    static const char *names[] = { "exp", "exp2", "log", "cbrt", "pow" };
+    static const double low[] = { -20, -30, 1e-3, -1e6, 1e-3 };
+    static const double high[] = { 20, 30, 1e6, 1e6, 1e3 };
+    static const int widths[] = { 1, 2, 4, 8 };
+    double *x = malloc(n * sizeof(double)), *y = malloc(n * sizeof(double)), *out = malloc(n * sizeof(double));
+
+    printf("%zu elements x %d passes, millions of results per second\n", n, passes);
+    printf("%-6s %9s %9s %9s %9s %9s\n", "", "libm", "fast x1", "fast x2", "fast x4", "fast x8");
+    for (size_t f = 0; f < sizeof names / sizeof names[0]; f++)
+    {
+        srand(1);
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] = low[f] + (high[f] - low[f]) * rand() / RAND_MAX;
+            y[i] = -4 + 8.0 * rand() / RAND_MAX;
+        }
+        printf("%-6s", names[f]);
+        timeMap(&libmMath, names[f], out, x, y, n, passes);
+        for (size_t w = 0; w < sizeof widths / sizeof widths[0]; w++)
+        {
+            if (fastMath(widths[w]) == NULL)
+            {
+                printf(" %9s", "-");
+                continue;
+            }
+            timeMap(fastMath(widths[w]), names[f], out, x, y, n, passes);
+        }
+        printf("\n");
+    }
+    return sink == 42;
+}
+EOF
+
+gcc -O2 -I. "$DRIVER/mathbench.c" fastmath.c -lm -o "$DRIVER/mathbench" && "$DRIVER/mathbench" "$ELEMENTS" "$PASSES"
+status=$?
+rm -rf "$DRIVER"
+exit $status
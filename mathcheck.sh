@@ -0,0 +1,201 @@
+#!/bin/bash
+# Checks the --math=fast approximations of fastmath.c against libm.
+# Run from the source directory: ./mathcheck.sh [samples per function]
+# For each function, random arguments over its whole range (and pow over
+# a spread of |y log x|) are evaluated against libm's long double version
+# of it, and the worst error in ulps must be within the bound documented
+# in fastmath.c; libm's own double error is shown alongside. Every SIMD
+# width the CPU has must also give the width 1 approximation's bits
+# exactly. Exits non-zero on any failure.
+
+SAMPLES=${1:-1000000}
+DRIVER=$(mktemp -d)
+
+cat > "$DRIVER/mathcheck.c" <<'EOF'
+#include "cilisp.h"
+
+static uint64_t state = 88172645463325252ULL;
+
+static uint64_t next(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * (next() >> 11) * 0x1p-53;
+}
+
+// any normal double of either sign, every exponent equally likely
+// (subnormals go to libm)
+static double anyDouble(void)
+{
+    double x;
+    uint64_t bits;
+    do
+    {
+        bits = next() & 0xffefffffffffffffULL;
+    } while ((bits & 0x7ff0000000000000ULL) == 0);
+    memcpy(&x, &bits, sizeof x);
+    return x;
+}
+
+// the error of got in ulps of the exact result want, or infinity if
+// only one of them is nan, infinite or zero
+static double ulps(double got, long double want)
+{
+    double rounded = (double) want;
+    if (isnan(rounded) || isinf(rounded) || rounded == 0 || isnan(got) || isinf(got) || got == 0)
+    {
+        return got == rounded || (isnan(got) && isnan(rounded)) ? 0 : INFINITY;
+    }
+    int exponent;
+    frexp(rounded, &exponent);
+    return (double) (fabsl(got - want) / ldexp(1, (exponent < -1021 ? -1021 : exponent) - 53));
+}
+
+typedef struct {
+    double fast, libm;      // worst errors
+    double at;              // argument of the worst fast error
+} ERRORS;
+
+static void measure(ERRORS *errors, double x, double fast, double libm, long double exact)
+{
+    double error = ulps(fast, exact);
+    if (!(error <= errors->fast))
+    {
+        errors->fast = error;
+        errors->at = x;
+    }
+    error = ulps(libm, exact);
+    errors->libm = error > errors->libm ? error : errors->libm;
+}
+
+static int failures = 0;
+
+static void report(const char *name, size_t count, ERRORS *errors, double bound)
+{
+    bool ok = errors->fast <= bound;
+    printf("%-24s %9zu samples, max %6.3f ulp (at %a), bound %g, libm %.3f %s\n",
+           name, count, errors->fast, errors->at, bound, errors->libm, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+// one argument through the width 1 map: the fast tables' one-at-a-time
+// entries are libm's for all but cbrt
+static double fast(const char *name, double x, double y)
+{
+    const MATH_FUNCS *scalar = fastMath(1);
+    double out;
+    if (!strcmp(name, "pow"))
+    {
+        scalar->powZip(&out, &x, 1, &y, 1, 1);
+    }
+    else
+    {
+        (!strcmp(name, "exp") ? scalar->expMap : !strcmp(name, "exp2") ? scalar->exp2Map :
+         !strcmp(name, "log") ? scalar->logMap : scalar->cbrtMap)(&out, &x, 1);
+    }
+    return out;
+}
+
+// the width 1 approximation and every width's map of it must agree bit for bit
+static void checkWidths(const char *name, double *x, double *y, size_t n)
+{
+    double *want = malloc(n * sizeof(double)), *got = malloc(n * sizeof(double));
+    static const int widths[] = { 1, 2, 4, 8 };
+
+    for (size_t i = 0; i < n; i++)
+    {
+        want[i] = fast(name, x[i], y ? y[i] : 0);
+    }
+    for (size_t w = 0; w < sizeof widths / sizeof widths[0]; w++)
+    {
+        const MATH_FUNCS *math = fastMath(widths[w]);
+        size_t mismatches = 0;
+        if (math == NULL)
+        {
+            printf("%-5s width %d: not on this CPU\n", name, widths[w]);
+            continue;
+        }
+        if (y)
+        {
+            math->powZip(got, x, 1, y, 1, n);
+        }
+        else
+        {
+            (!strcmp(name, "exp") ? math->expMap : !strcmp(name, "exp2") ? math->exp2Map :
+             !strcmp(name, "log") ? math->logMap : math->cbrtMap)(got, x, n);
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            mismatches += memcmp(&got[i], &want[i], sizeof(double)) != 0;
+        }
+        printf("%-5s width %d: %zu of %zu differ from scalar %s\n", name, widths[w], mismatches, n, mismatches ? "FAILED" : "ok");
+        failures += mismatches > 0;
+    }
+    free(want);
+    free(got);
+}
+
+static void checkUnary(const char *name, double (*libm)(double),
+                       long double (*exact)(long double), double (*sample)(void), size_t n, double bound)
+{
+    double *x = malloc(n * sizeof(double));
+    ERRORS errors = { 0, 0, 0 };
+    for (size_t i = 0; i < n; i++)
+    {
+        x[i] = sample();
+        measure(&errors, x[i], fast(name, x[i], 0), libm(x[i]), exact(x[i]));
+    }
+    report(name, n, &errors, bound);
+    checkWidths(name, x, NULL, n);
+    free(x);
+}
+
+static double expSample(void) { return next() & 1 ? uniform(-750, 712) : uniform(-1, 1); }
+static double exp2Sample(void) { return next() & 1 ? uniform(-1080, 1026) : uniform(-1, 1); }
+static double logSample(void) { return next() & 1 ? fabs(anyDouble()) : uniform(0.5, 2); }
+static double cbrtSample(void) { return anyDouble(); }
+
+// x spread over the exponents, y so that |y log x| is about 2^scale
+static void checkPow(size_t n, int lowScale, int highScale, double bound)
+{
+    double *x = malloc(n * sizeof(double)), *y = malloc(n * sizeof(double));
+    ERRORS errors = { 0, 0, 0 };
+    char name[64];
+    for (size_t i = 0; i < n; i++)
+    {
+        x[i] = next() & 1 ? ldexp(uniform(1, 2), (int) (next() % 200) - 100) : uniform(0.5, 2);
+        double target = ldexp(uniform(1, 2), lowScale + (int) (next() % (highScale - lowScale)));
+        y[i] = (next() & 1 ? target : -target) / fabs(log(x[i]));
+        measure(&errors, x[i], fast("pow", x[i], y[i]), pow(x[i], y[i]), powl(x[i], y[i]));
+    }
+    snprintf(name, sizeof name, "pow, |y log x| < 2^%d", highScale);
+    report(name, n, &errors, bound);
+    checkWidths("pow", x, y, n);
+    free(x);
+    free(y);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    checkUnary("exp", exp, expl, expSample, n, 1.5);
+    checkUnary("exp2", exp2, exp2l, exp2Sample, n, 1.5);
+    checkUnary("log", log, logl, logSample, n, 1);
+    checkUnary("cbrt", cbrt, cbrtl, cbrtSample, n, 0.7);
+    checkPow(n, -20, 5, 2);
+    checkPow(n, 5, 10, 32);
+    return failures > 0;
+}
+EOF
+
+gcc -O2 -I. "$DRIVER/mathcheck.c" fastmath.c -lm -o "$DRIVER/mathcheck" && "$DRIVER/mathcheck" "$SAMPLES"
+status=$?
+rm -rf "$DRIVER"
+exit $status
@@ -0,0 +1,349 @@
+#include "cilisp.h"
+
+// Dead binding elimination and scope flattening, run after folding.
+//
+// Let bindings are evaluated lazily, on first reference, so a binding
+// that evaluation can never reach is never evaluated and is dropped,
+// whatever it computes. A binding reached exactly once, without a cast,
+// is evaluated at the same moment whether it is looked up or written out
+// in place, so its expression is moved to its one use. A scope left with
+// no bindings disappears, and a scope that is the body of another one is
+// merged into it, unless the two bind the same name.
+//
+// Surviving bindings keep their slots' lazy, evaluate-once behaviour;
+// they only move to another scope or position. The pass first walks the
+// program the way evaluation would, recording the binding each symbol
+// refers to, then rebuilds the scopes and gives every symbol its new
+// (depth, slot). What was removed is logged next to the AST size, with
+// the number of nodes evaluation can reach before and after.
+//
+// Programs that bind functions are left as they are: a function's frame
+// and captures are laid out by the slots of the scopes around it.
+
+typedef struct {
+    uint32_t refs;      // uses reachable from the program
+    bool inlined;       // moved to its one use
+    AST_ID home;        // surviving scope node that holds it, 0 if none
+    uint32_t slot;      // its slot there
+} PRUNE_BINDING;
+
+typedef struct {
+    int level;          // surviving scopes enclosing it, itself included
+    uint32_t slotCount;
+    uint32_t firstSlot;
+} PRUNE_SCOPE;
+
+static struct {
+    uint32_t *targets;              // symbol node -> binding index + 1
+    size_t targetCapacity;
+    AST_ID *path;                   // scopes around the node being reached, by level
+    size_t pathCapacity;
+    PRUNE_BINDING *bindings;        // by index in ast.bindings
+    size_t bindingCapacity;
+    PRUNE_SCOPE *scopes;            // by index in ast.scopes
+    size_t scopeCapacity;
+    uint64_t *names;                // (home scope, SYMBOL_ID) pairs in use
+    size_t nameSize, nameCapacity;
+    AST_ID *survivors;
+    size_t survivorCount, survivorCapacity;
+
+    size_t removedCount, inlinedCount, mergedCount;
+    size_t nodesBefore, nodesAfter;     // counted once per use
+} prune;
+
+#define PRUNE_GROW(array, capacity, size) \
+    if ((size) > (capacity)) { \
+        (capacity) = 2 * (size); \
+        if (((array) = realloc((array), (capacity) * sizeof(*(array)))) == NULL) \
+            yyerror("Memory allocation failed!"); \
+    }
+
+// Counts uses, visiting a binding's expression at its first use, as
+// evaluation would. The innermost scope enclosing node is
+// prune.path[level], and the scope a symbol refers to is depth levels
+// up; a binding's expression is walked from the level of its scope.
+static void reach(AST_ID node, int level)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    prune.nodesBefore++;
+    switch (NODE_TYPE(node))
+    {
+        case SYM_NODE_TYPE:
+        {
+            if (NODE(node).symbol.depth < 0)
+            {
+                return;
+            }
+            level -= NODE(node).symbol.depth;
+            uint32_t binding = NODE_SCOPE(prune.path[level])->firstSlot + (uint32_t) NODE(node).symbol.slot;
+            prune.targets[node] = binding + 1;
+            if (prune.bindings[binding].refs++ == 0)
+            {
+                reach(ast.bindings[binding].value, level);
+            }
+            break;
+        }
+
+        case FUNC_NODE_TYPE:
+            for (size_t i = 0; i < NODE(node).function.count; i++)
+            {
+                reach(NODE_OPS(node)[i], level);
+            }
+            break;
+
+        case SCOPE_NODE_TYPE:
+        {
+            // a binding's expression can be reached from deeper down, so
+            // the entry this overwrites may still be in use
+            PRUNE_GROW(prune.path, prune.pathCapacity, (size_t) level + 2);
+            AST_ID outer = prune.path[level + 1];
+            prune.path[level + 1] = node;
+            reach(NODE_SCOPE(node)->child, level + 1);
+            prune.path[level + 1] = outer;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static size_t nameBucket(uint64_t key)
+{
+    size_t bucket = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+    bucket &= prune.nameSize - 1;
+    while (prune.names[bucket] != 0 && prune.names[bucket] != key)
+    {
+        bucket = (bucket + 1) & (prune.nameSize - 1);
+    }
+    return bucket;
+}
+
+static bool nameTaken(AST_ID home, SYMBOL_ID id)
+{
+    return prune.names[nameBucket(((uint64_t) home << 32) | id)] != 0;
+}
+
+// Gives a surviving binding the next slot of home.
+static void place(uint32_t binding, AST_ID home)
+{
+    PRUNE_SCOPE *scope = &prune.scopes[NODE(home).scope];
+    prune.bindings[binding].home = home;
+    prune.bindings[binding].slot = scope->slotCount++;
+
+    uint64_t key = ((uint64_t) home << 32) | ast.bindings[binding].id;
+    prune.names[nameBucket(key)] = key;
+}
+
+// Returns what replaces node. home is the innermost surviving scope at
+// node's new position and level its level (0 and 0 at the top). atBody
+// is set if node is home's body. Nodes moved out of a binding may be
+// shared with the bindings next to it, so moved ones are copied before
+// they are changed.
+static AST_ID rewrite(AST_ID node, AST_ID home, int level, bool atBody, bool moved)
+{
+    if (!node)
+    {
+        return node;
+    }
+
+    switch (NODE_TYPE(node))
+    {
+        case SYM_NODE_TYPE:
+        {
+            if (NODE(node).symbol.depth < 0)
+            {
+                prune.nodesAfter++;
+                return node;
+            }
+            uint32_t binding = prune.targets[node] - 1;
+            if (prune.bindings[binding].inlined)
+            {
+                return rewrite(ast.bindings[binding].value, home, level, atBody, true);
+            }
+            prune.nodesAfter++;
+            if (moved)
+            {
+                node = copyNode(node);
+            }
+            AST_ID target = prune.bindings[binding].home;
+            NODE(node).symbol.depth = level - prune.scopes[NODE(target).scope].level;
+            NODE(node).symbol.slot = (int) prune.bindings[binding].slot;
+            return node;
+        }
+
+        case FUNC_NODE_TYPE:
+            prune.nodesAfter++;
+            if (moved)
+            {
+                node = copyNode(node);
+            }
+            for (size_t i = 0; i < NODE(node).function.count; i++)
+            {
+                AST_ID op = rewrite(NODE_OPS(node)[i], home, level, false, moved);
+                NODE_OPS(node)[i] = op;
+            }
+            return node;
+
+        case SCOPE_NODE_TYPE:
+        {
+            AST_SCOPE *scope = NODE_SCOPE(node);
+            uint32_t survivors = 0;
+            bool clash = false;
+
+            for (int slot = 0; slot < scope->slotCount; slot++)
+            {
+                uint32_t binding = scope->firstSlot + (uint32_t) slot;
+                if (prune.bindings[binding].refs == 0)
+                {
+                    prune.removedCount++;
+                }
+                else if (prune.bindings[binding].inlined)
+                {
+                    prune.inlinedCount++;
+                }
+                else
+                {
+                    survivors++;
+                    clash |= home != 0 && nameTaken(home, ast.bindings[binding].id);
+                }
+            }
+
+            bool keep = survivors > 0 && !(atBody && home != 0 && !clash);
+            if (keep)
+            {
+                prune.nodesAfter++;
+                PRUNE_GROW(prune.survivors, prune.survivorCapacity, prune.survivorCount + 1);
+                prune.survivors[prune.survivorCount++] = node;
+                prune.scopes[NODE(node).scope].level = ++level;
+                prune.scopes[NODE(node).scope].slotCount = 0;
+                scope->outer = home;
+                home = node;
+            }
+            else
+            {
+                prune.mergedCount++;
+            }
+
+            for (int slot = 0; slot < scope->slotCount; slot++)
+            {
+                uint32_t binding = scope->firstSlot + (uint32_t) slot;
+                if (prune.bindings[binding].refs > 0 && !prune.bindings[binding].inlined)
+                {
+                    place(binding, home);
+                }
+            }
+            for (int slot = 0; slot < scope->slotCount; slot++)
+            {
+                uint32_t binding = scope->firstSlot + (uint32_t) slot;
+                if (prune.bindings[binding].home != 0)
+                {
+                    AST_ID value = rewrite(ast.bindings[binding].value, home, level, false, false);
+                    ast.bindings[binding].value = value;
+                }
+            }
+
+            AST_ID child = rewrite(scope->child, home, level, true, false);
+            if (!keep)
+            {
+                return child;
+            }
+            scope->child = child;
+            return node;
+        }
+
+        default:
+            prune.nodesAfter++;
+            return node;
+    }
+}
+
+// Lays out the bindings of every surviving scope in new ranges of
+// ast.bindings. Wide scopes lose their index; it is only needed to
+// resolve symbols, which has been done.
+static void relocateBindings(size_t bindingCount)
+{
+    for (size_t i = 0; i < prune.survivorCount; i++)
+    {
+        PRUNE_SCOPE *scope = &prune.scopes[NODE(prune.survivors[i]).scope];
+        scope->firstSlot = (uint32_t) ast.bindingCount;
+        ast.bindingCount += scope->slotCount;
+    }
+    if (ast.bindingCount > ast.bindingCapacity)
+    {
+        ast.bindingCapacity = 2 * ast.bindingCount;
+        if ((ast.bindings = realloc(ast.bindings, ast.bindingCapacity * sizeof(SYMBOL_TABLE_NODE))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+
+    for (size_t binding = 0; binding < bindingCount; binding++)
+    {
+        AST_ID home = prune.bindings[binding].home;
+        if (home != 0)
+        {
+            PRUNE_SCOPE *scope = &prune.scopes[NODE(home).scope];
+            ast.bindings[scope->firstSlot + prune.bindings[binding].slot] = ast.bindings[binding];
+        }
+    }
+
+    for (size_t i = 0; i < prune.survivorCount; i++)
+    {
+        AST_SCOPE *scope = NODE_SCOPE(prune.survivors[i]);
+        scope->firstSlot = prune.scopes[NODE(prune.survivors[i]).scope].firstSlot;
+        scope->slotCount = (int) prune.scopes[NODE(prune.survivors[i]).scope].slotCount;
+        scope->index = NULL;
+        scope->indexSize = 0;
+    }
+}
+
+AST_ID pruneScopes(AST_ID program)
+{
+    if (ast.scopeCount == 0 || ast.lambdaCount > 0)
+    {
+        return program;
+    }
+
+    size_t bindingCount = ast.bindingCount;
+    PRUNE_GROW(prune.targets, prune.targetCapacity, ast.count);
+    PRUNE_GROW(prune.bindings, prune.bindingCapacity, bindingCount);
+    PRUNE_GROW(prune.scopes, prune.scopeCapacity, ast.scopeCount);
+    memset(prune.bindings, 0, bindingCount * sizeof(PRUNE_BINDING));
+
+    prune.nameSize = 16;
+    while (prune.nameSize < 2 * bindingCount)
+    {
+        prune.nameSize *= 2;
+    }
+    PRUNE_GROW(prune.names, prune.nameCapacity, prune.nameSize);
+    memset(prune.names, 0, prune.nameSize * sizeof(uint64_t));
+
+    prune.survivorCount = 0;
+    prune.removedCount = prune.inlinedCount = prune.mergedCount = 0;
+    prune.nodesBefore = prune.nodesAfter = 0;
+
+    PRUNE_GROW(prune.path, prune.pathCapacity, 1);
+    prune.path[0] = 0;
+    reach(program, 0);
+    for (size_t binding = 0; binding < bindingCount; binding++)
+    {
+        prune.bindings[binding].inlined = prune.bindings[binding].refs == 1
+                                         && ast.bindings[binding].type == NO_TYPE
+                                         && ast.bindings[binding].value != 0;
+    }
+
+    program = rewrite(program, 0, 0, false, false);
+    relocateBindings(bindingCount);
+
+    if (flex_bison_log_file != NULL)
+    {
+        fprintf(flex_bison_log_file, "PRUNE: %zu bindings removed, %zu inlined, %zu scopes merged, %zu -> %zu nodes\n",
+                prune.removedCount, prune.inlinedCount, prune.mergedCount, prune.nodesBefore, prune.nodesAfter);
+    }
+    return program;
+}
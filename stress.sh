@@ -0,0 +1,65 @@
+#!/bin/bash
+# Parses and evaluates one generated expression under a time and memory
+# budget. The wide shape, (add 1 2 ... N), checks that long operand lists
+# neither blow the parser stack nor the heap; the deep one,
+# (neg (neg ... (neg 1))) nested N deep, checks that deep nesting
+# overflows neither the parser stack nor the C stack.
+# Build first with "run", then:
+# ./stress.sh [wide|deep] [size] [seconds] [KB of address space] [engines...]
+
+SHAPE=${1:-wide}
+case "$SHAPE" in
+    wide)
+        N=${2:-10000000}
+        MEMORY_BUDGET=${4:-2000000}
+        ENGINES="--engine=tree --engine=vm"
+        ;;
+    deep)
+        N=${2:-1000000}
+        MEMORY_BUDGET=${4:-4000000}
+        ENGINES="--engine=tree --engine=vm --fold=off"
+        ;;
+    *)
+        echo "usage: $0 [wide|deep] [size] [seconds] [KB of address space] [engines...]" >&2
+        exit 2
+        ;;
+esac
+SECONDS_BUDGET=${3:-60}
+shift $(($# < 4 ? $# : 4))
+ENGINES=${*:-$ENGINES}
+INPUT=$(mktemp)
+
+if [ "$SHAPE" = wide ]; then
+    awk -v n="$N" 'BEGIN {
+        printf "(add"
+        for (i = 1; i <= n; i++) printf " %d", i
+        printf ")\nquit\n"
+    }' > "$INPUT"
+    EXPECTED="Integer : $(awk -v n="$N" 'BEGIN { printf "%.0f", n * (n + 1) / 2 }')"
+    echo "$N operands, $(wc -c < "$INPUT") bytes"
+else
+    awk -v n="$N" 'BEGIN {
+        for (i = 0; i < n; i++) printf "(neg "
+        printf "1"
+        for (i = 0; i < n; i++) printf ")"
+        printf "\nquit\n"
+    }' > "$INPUT"
+    EXPECTED="Integer : $((N % 2 ? -1 : 1))"
+    echo "$N deep, $(wc -c < "$INPUT") bytes"
+fi
+
+status=0
+for engine in $ENGINES; do
+    echo "$engine"
+    if (ulimit -v "$MEMORY_BUDGET"; time timeout "$SECONDS_BUDGET" ./cilisp $engine "$INPUT" > "$INPUT.out"); then
+        if grep -q "$EXPECTED$" "$INPUT.out"; then
+            echo "ok"
+            continue
+        fi
+    fi
+    echo "FAILED: expected $EXPECTED"
+    status=1
+done
+
+rm -f "$INPUT" "$INPUT.out"
+exit $status
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Times one formula over many values, as scalar expressions and as vectors.
+# Build first with "run", then: ./vecbench.sh [elements] [engines...]
+# The scalar program evaluates the formula once per pair of random
+# values; the vector program binds them all as two vecs and evaluates
+# it once, element by element. Both print every result.
+
+ELEMENTS=${1:-100000}
+shift 1 2>/dev/null
+ENGINES=${*:-"--engine=tree --engine=vm"}
+SCALAR=$(mktemp)
+VECTOR=$(mktemp)
+
+awk -v elements="$ELEMENTS" -v scalar="$SCALAR" -v vector="$VECTOR" 'BEGIN {
+    srand(1)
+    printf "((let (a (vec" > vector
+    for (i = 0; i < elements; i++) {
+        a = sprintf("%.3f", rand() * 200 - 100)
+        b = sprintf("%.3f", rand() * 200 - 100)
+        printf "(hypot (mult %s 2.5) (sub %s 1.5) (min %s %s))\n", a, b, a, b > scalar
+        printf " %s", a > vector
+        as = as " " b
+    }
+    printf ")) (b (vec%s))) (hypot (mult a 2.5) (sub b 1.5) (min a b)))\n", as > vector
+    print "quit" > scalar
+    print "quit" > vector
+}'
+
+echo "$ELEMENTS elements"
+for engine in $ENGINES; do
+    echo "$engine scalar"
+    time (./cilisp $engine < "$SCALAR" > /dev/null)
+    echo "$engine vector"
+    time (./cilisp $engine < "$VECTOR" > /dev/null)
+done
+
+rm -f "$SCALAR" "$VECTOR"
@@ -0,0 +1,463 @@
+#include "cilisp.h"
+
+// Packed double vectors.
+//
+// (vec ...) makes a VECTOR of its operands' values as doubles, splicing
+// in the elements of operands that are vectors themselves. Every builtin
+// but cond, and and or then works on vectors element by element: a
+// scalar operand counts as that value in every element, and two vectors
+// of different lengths give a vector as long as the longer one, nan where
+// the shorter one has no element. less, greater and equal give 1 or 0 in
+// each element. add, mult, hypot, min and max fold their operands left to
+// right as they do on scalars, from the first vector on into one result
+// vector they update in place. A vector is no condition: cond, and and or
+// warn of one and take it as false.
+//
+// add, sub, mult, div, min, max, hypot, neg, abs and sqrt run through
+// SIMD kernels, picked once per process: 4 doubles at a time with AVX2
+// when the CPU has it, otherwise 2 at a time with SSE2, which every
+// x86-64 has. The kernels round exactly as the scalar code does, except
+// that hypot squares with a multiply where eval calls pow(x, 2), which
+// can differ in the last bit. exp, exp2, log, cbrt and pow go through
+// options.math (see fastmath.c), and remainder calls libm per element.
+// Elsewhere the kernels are plain loops.
+//
+// The same dispatch serves the wide calls of add, mult, hypot, min and
+// max (see RET_WIDE_CALL), which reduce an array of doubles. Sums and
+// products run in REDUCE_LANES lanes whatever the register width, lane
+// j taking x[j], x[j + 8], ... in order, and the lanes are combined in
+// a fixed tree, so AVX2, SSE2 and plain loops give the same bits. Arrays
+// longer than REDUCE_BLOCK are split in halves and reduced pairwise,
+// which keeps the rounding error growing with log n rather than n. min
+// and max find the least (greatest) value, which any order gives, and
+// then the first element equal to it, as the sequential loop would.
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef void (*VEC_ZIP)(double *out, const double *a, size_t aStep, const double *b, size_t bStep, size_t n);
+typedef void (*VEC_MAP)(double *out, const double *a, size_t n);
+typedef double (*VEC_REDUCE)(const double *x, size_t n, double init);
+
+typedef struct {
+    VEC_ZIP add, sub, mult, div, min, max, hypot;
+    VEC_MAP neg, abs, sqrt;
+    VEC_REDUCE sum, product, squares, least, greatest;
+} VEC_KERNELS;
+
+#define REDUCE_LANES 8
+#define REDUCE_BLOCK 256
+
+#define ADD2(a, b) ((a) + (b))
+#define MULT2(a, b) ((a) * (b))
+#define MIN2(a, b) ((b) < (a) ? (b) : (a))
+#define MAX2(a, b) ((a) < (b) ? (b) : (a))
+#define LANE_TREE(F) F(F(F(lane[0], lane[1]), F(lane[2], lane[3])), F(F(lane[4], lane[5]), F(lane[6], lane[7])))
+
+// The elements left over by a reduction's registers go to their lanes
+// one by one; STEP combines lane value l with element y.
+#define REDUCE_TAIL(STEP, F) \
+        for (; i < n; i++) \
+        { \
+            double l = lane[i % REDUCE_LANES], y = x[i]; \
+            lane[i % REDUCE_LANES] = (STEP); \
+        } \
+        return LANE_TREE(F);
+
+#define LOOP_REDUCE(NAME, STEP, F) \
+    static double NAME(const double *x, size_t n, double init) \
+    { \
+        double lane[REDUCE_LANES]; \
+        size_t i = 0; \
+        for (int k = 0; k < REDUCE_LANES; k++) lane[k] = init; \
+        REDUCE_TAIL(STEP, F) \
+    }
+
+// out[i] = SCALAR of x = a[i] and y = b[i]; an operand with a step of 0
+// is a single value, used for every element.
+#define SCALAR_ZIP(NAME, SCALAR) \
+    static void NAME(double *out, const double *a, size_t aStep, const double *b, size_t bStep, size_t n) \
+    { \
+        for (size_t i = 0; i < n; i++) \
+        { \
+            double x = a[i * aStep], y = b[i * bStep]; \
+            out[i] = (SCALAR); \
+        } \
+    }
+
+#define SCALAR_MAP(NAME, SCALAR) \
+    static void NAME(double *out, const double *a, size_t n) \
+    { \
+        for (size_t i = 0; i < n; i++) \
+        { \
+            double x = a[i]; \
+            out[i] = (SCALAR); \
+        } \
+    }
+
+SCALAR_ZIP(remainderZip, fabs(fmod(x, y)))
+SCALAR_ZIP(lessZip, x < y)
+SCALAR_ZIP(greaterZip, x > y)
+SCALAR_ZIP(equalZip, x == y)
+
+#if defined(__x86_64__)
+
+// The same with a register of doubles at a time, P being _mm or _mm256;
+// OP combines va and vb, and SCALAR does the elements left over. A
+// broadcast operand is loaded once, and its branch is taken every time
+// or never.
+#define SIMD_ZIP(NAME, TARGET, P, VEC, OP, SCALAR) \
+    TARGET static void NAME(double *out, const double *a, size_t aStep, const double *b, size_t bStep, size_t n) \
+    { \
+        size_t width = sizeof(VEC) / sizeof(double), i = 0; \
+        VEC va = P##_set1_pd(a[0]), vb = P##_set1_pd(b[0]); \
+        for (; i + width <= n; i += width) \
+        { \
+            if (aStep) va = P##_loadu_pd(a + i); \
+            if (bStep) vb = P##_loadu_pd(b + i); \
+            P##_storeu_pd(out + i, (OP)); \
+        } \
+        for (; i < n; i++) \
+        { \
+            double x = a[i * aStep], y = b[i * bStep]; \
+            out[i] = (SCALAR); \
+        } \
+    }
+
+#define SIMD_MAP(NAME, TARGET, P, VEC, OP, SCALAR) \
+    TARGET static void NAME(double *out, const double *a, size_t n) \
+    { \
+        size_t width = sizeof(VEC) / sizeof(double), i = 0; \
+        VEC sign = P##_set1_pd(-0.0); \
+        (void) sign; \
+        for (; i + width <= n; i += width) \
+        { \
+            VEC va = P##_loadu_pd(a + i); \
+            P##_storeu_pd(out + i, (OP)); \
+        } \
+        for (; i < n; i++) \
+        { \
+            double x = a[i]; \
+            out[i] = (SCALAR); \
+        } \
+    }
+
+// min and max keep the accumulator a unless b is less (greater), as
+// applyCall's min and max do; minpd and maxpd return their second operand
+// when either is a nan.
+#define SSE2_TARGET
+SIMD_ZIP(addSse2, SSE2_TARGET, _mm, __m128d, _mm_add_pd(va, vb), x + y)
+SIMD_ZIP(subSse2, SSE2_TARGET, _mm, __m128d, _mm_sub_pd(va, vb), x - y)
+SIMD_ZIP(multSse2, SSE2_TARGET, _mm, __m128d, _mm_mul_pd(va, vb), x * y)
+SIMD_ZIP(divSse2, SSE2_TARGET, _mm, __m128d, _mm_div_pd(va, vb), x / y)
+SIMD_ZIP(minSse2, SSE2_TARGET, _mm, __m128d, _mm_min_pd(vb, va), y < x ? y : x)
+SIMD_ZIP(maxSse2, SSE2_TARGET, _mm, __m128d, _mm_max_pd(vb, va), x < y ? y : x)
+SIMD_ZIP(hypotSse2, SSE2_TARGET, _mm, __m128d, _mm_add_pd(va, _mm_mul_pd(vb, vb)), x + y * y)
+SIMD_MAP(negSse2, SSE2_TARGET, _mm, __m128d, _mm_xor_pd(va, sign), -x)
+SIMD_MAP(absSse2, SSE2_TARGET, _mm, __m128d, _mm_andnot_pd(sign, va), fabs(x))
+SIMD_MAP(sqrtSse2, SSE2_TARGET, _mm, __m128d, _mm_sqrt_pd(va), sqrt(x))
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+SIMD_ZIP(addAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_add_pd(va, vb), x + y)
+SIMD_ZIP(subAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_sub_pd(va, vb), x - y)
+SIMD_ZIP(multAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_mul_pd(va, vb), x * y)
+SIMD_ZIP(divAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_div_pd(va, vb), x / y)
+SIMD_ZIP(minAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_min_pd(vb, va), y < x ? y : x)
+SIMD_ZIP(maxAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_max_pd(vb, va), x < y ? y : x)
+SIMD_ZIP(hypotAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_add_pd(va, _mm256_mul_pd(vb, vb)), x + y * y)
+SIMD_MAP(negAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_xor_pd(va, sign), -x)
+SIMD_MAP(absAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_andnot_pd(sign, va), fabs(x))
+SIMD_MAP(sqrtAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_sqrt_pd(va), sqrt(x))
+
+// REDUCE_LANES lanes in as many registers as it takes; OP combines
+// register acc with the elements v.
+#define SIMD_REDUCE(NAME, TARGET, P, VEC, OP, STEP, F) \
+    TARGET static double NAME(const double *x, size_t n, double init) \
+    { \
+        enum { WIDTH = sizeof(VEC) / sizeof(double), REGISTERS = REDUCE_LANES / WIDTH }; \
+        double lane[REDUCE_LANES]; \
+        VEC accs[REGISTERS]; \
+        size_t i = 0; \
+        for (int k = 0; k < REGISTERS; k++) accs[k] = P##_set1_pd(init); \
+        for (; i + REDUCE_LANES <= n; i += REDUCE_LANES) \
+        { \
+            for (int k = 0; k < REGISTERS; k++) \
+            { \
+                VEC acc = accs[k], v = P##_loadu_pd(x + i + k * WIDTH); \
+                accs[k] = (OP); \
+            } \
+        } \
+        for (int k = 0; k < REGISTERS; k++) P##_storeu_pd(lane + k * WIDTH, accs[k]); \
+        REDUCE_TAIL(STEP, F) \
+    }
+
+SIMD_REDUCE(sumSse2, SSE2_TARGET, _mm, __m128d, _mm_add_pd(acc, v), l + y, ADD2)
+SIMD_REDUCE(productSse2, SSE2_TARGET, _mm, __m128d, _mm_mul_pd(acc, v), l * y, MULT2)
+SIMD_REDUCE(squaresSse2, SSE2_TARGET, _mm, __m128d, _mm_add_pd(acc, _mm_mul_pd(v, v)), l + y * y, ADD2)
+SIMD_REDUCE(leastSse2, SSE2_TARGET, _mm, __m128d, _mm_min_pd(v, acc), y < l ? y : l, MIN2)
+SIMD_REDUCE(greatestSse2, SSE2_TARGET, _mm, __m128d, _mm_max_pd(v, acc), l < y ? y : l, MAX2)
+
+SIMD_REDUCE(sumAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_add_pd(acc, v), l + y, ADD2)
+SIMD_REDUCE(productAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_mul_pd(acc, v), l * y, MULT2)
+SIMD_REDUCE(squaresAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_add_pd(acc, _mm256_mul_pd(v, v)), l + y * y, ADD2)
+SIMD_REDUCE(leastAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_min_pd(v, acc), y < l ? y : l, MIN2)
+SIMD_REDUCE(greatestAvx2, AVX2_TARGET, _mm256, __m256d, _mm256_max_pd(v, acc), l < y ? y : l, MAX2)
+
+static const VEC_KERNELS sse2Kernels = {
+    addSse2, subSse2, multSse2, divSse2, minSse2, maxSse2, hypotSse2,
+    negSse2, absSse2, sqrtSse2,
+    sumSse2, productSse2, squaresSse2, leastSse2, greatestSse2
+};
+
+static const VEC_KERNELS avx2Kernels = {
+    addAvx2, subAvx2, multAvx2, divAvx2, minAvx2, maxAvx2, hypotAvx2,
+    negAvx2, absAvx2, sqrtAvx2,
+    sumAvx2, productAvx2, squaresAvx2, leastAvx2, greatestAvx2
+};
+
+static const VEC_KERNELS *vecKernels(void)
+{
+    static const VEC_KERNELS *kernels = NULL;
+    if (kernels == NULL)
+    {
+        __builtin_cpu_init();
+        kernels = __builtin_cpu_supports("avx2") ? &avx2Kernels : &sse2Kernels;
+    }
+    return kernels;
+}
+
+#else
+
+SCALAR_ZIP(addLoop, x + y)
+SCALAR_ZIP(subLoop, x - y)
+SCALAR_ZIP(multLoop, x * y)
+SCALAR_ZIP(divLoop, x / y)
+SCALAR_ZIP(minLoop, y < x ? y : x)
+SCALAR_ZIP(maxLoop, x < y ? y : x)
+SCALAR_ZIP(hypotLoop, x + y * y)
+SCALAR_MAP(negLoop, -x)
+SCALAR_MAP(absLoop, fabs(x))
+SCALAR_MAP(sqrtLoop, sqrt(x))
+LOOP_REDUCE(sumLoop, l + y, ADD2)
+LOOP_REDUCE(productLoop, l * y, MULT2)
+LOOP_REDUCE(squaresLoop, l + y * y, ADD2)
+LOOP_REDUCE(leastLoop, y < l ? y : l, MIN2)
+LOOP_REDUCE(greatestLoop, l < y ? y : l, MAX2)
+
+static const VEC_KERNELS loopKernels = {
+    addLoop, subLoop, multLoop, divLoop, minLoop, maxLoop, hypotLoop,
+    negLoop, absLoop, sqrtLoop,
+    sumLoop, productLoop, squaresLoop, leastLoop, greatestLoop
+};
+
+static const VEC_KERNELS *vecKernels(void)
+{
+    return &loopKernels;
+}
+
+#endif
+
+static VECTOR *vecAlloc(size_t count)
+{
+    // the values follow the header, at the arena's alignment
+    VECTOR *vector = arenaAlloc(sizeof(VECTOR) + count * sizeof(double));
+    vector->count = (uint32_t) count;
+    vector->values = (double *) (vector + 1);
+    return vector;
+}
+
+static RET_VAL vecBox(VECTOR *vector)
+{
+    return RET_VEC_TAG | ((uint64_t) (uintptr_t) vector & RET_PAYLOAD);
+}
+
+RET_VAL vecMake(RET_VAL *vals, size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        total += retIsVector(vals[i]) ? retVectorOf(vals[i])->count : 1;
+    }
+    if (total > UINT32_MAX)
+    {
+        yyerror("vec of more than %u elements", UINT32_MAX);
+    }
+
+    VECTOR *vector = vecAlloc(total);
+    double *out = vector->values;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (retIsVector(vals[i]))
+        {
+            VECTOR *inner = retVectorOf(vals[i]);
+            memcpy(out, inner->values, inner->count * sizeof(double));
+            out += inner->count;
+        }
+        else
+        {
+            *out++ = retValue(vals[i]);
+        }
+    }
+    return vecBox(vector);
+}
+
+RET_VAL vecMap(FUNC_TYPE func, RET_VAL a, bool owned)
+{
+    const VEC_KERNELS *kernels = vecKernels();
+    VECTOR *in = retVectorOf(a);
+    VECTOR *out = owned ? in : vecAlloc(in->count);
+    VEC_MAP map;
+
+    switch (func)
+    {
+        case NEG_FUNC: map = kernels->neg; break;
+        case ABS_FUNC: map = kernels->abs; break;
+        case SQRT_FUNC: map = kernels->sqrt; break;
+        case EXP_FUNC: map = options.math->expMap; break;
+        case EXP2_FUNC: map = options.math->exp2Map; break;
+        case LOG_FUNC: map = options.math->logMap; break;
+        case CBRT_FUNC: map = options.math->cbrtMap; break;
+        default: return NAN_RET_VAL;
+    }
+    map(out->values, in->values, in->count);
+    return vecBox(out);
+}
+
+// An operand as an array to step through: a vector's elements, or a
+// scalar as one value with a step of 0.
+typedef struct {
+    const double *values;
+    size_t step;
+    size_t count;       // elements, SIZE_MAX for a scalar
+    double scalar;
+} VEC_OPERAND;
+
+static void vecOperand(RET_VAL val, VEC_OPERAND *operand)
+{
+    if (retIsVector(val))
+    {
+        operand->values = retVectorOf(val)->values;
+        operand->step = 1;
+        operand->count = retVectorOf(val)->count;
+    }
+    else
+    {
+        operand->scalar = retValue(val);
+        operand->values = &operand->scalar;
+        operand->step = 0;
+        operand->count = SIZE_MAX;
+    }
+}
+
+RET_VAL vecZip(FUNC_TYPE func, RET_VAL a, RET_VAL b, bool owned)
+{
+    const VEC_KERNELS *kernels = vecKernels();
+    VEC_OPERAND x, y;
+    VEC_ZIP zip;
+
+    vecOperand(a, &x);
+    vecOperand(b, &y);
+    size_t common = x.count < y.count ? x.count : y.count;
+    size_t total = x.count == SIZE_MAX ? y.count : y.count == SIZE_MAX || x.count > y.count ? x.count : y.count;
+
+    switch (func)
+    {
+        case ADD_FUNC: zip = kernels->add; break;
+        case SUB_FUNC: zip = kernels->sub; break;
+        case MULT_FUNC: zip = kernels->mult; break;
+        case DIV_FUNC: zip = kernels->div; break;
+        case MIN_FUNC: zip = kernels->min; break;
+        case MAX_FUNC: zip = kernels->max; break;
+        case HYPOT_FUNC: zip = kernels->hypot; break;
+        case REMAINDER_FUNC: zip = remainderZip; break;
+        case POW_FUNC: zip = options.math->powZip; break;
+        case LESS_FUNC: zip = lessZip; break;
+        case GREATER_FUNC: zip = greaterZip; break;
+        case EQUAL_FUNC: zip = equalZip; break;
+        default: return NAN_RET_VAL;
+    }
+
+    VECTOR *out = owned && x.count == total ? retVectorOf(a) : vecAlloc(total);
+    if (common > 0)
+    {
+        zip(out->values, x.values, x.step, y.values, y.step, common);
+    }
+    for (size_t i = common; i < total; i++)
+    {
+        out->values[i] = NAN;
+    }
+    return vecBox(out);
+}
+
+RET_VAL vecFold(FUNC_TYPE func, RET_VAL acc, RET_VAL *vals, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        acc = vecZip(func, acc, vals[i], i > 0);
+    }
+    return func == HYPOT_FUNC ? vecMap(SQRT_FUNC, acc, true) : acc;
+}
+
+static double pairwise(VEC_REDUCE reduce, bool product, const double *x, size_t n)
+{
+    if (n <= REDUCE_BLOCK)
+    {
+        return reduce(x, n, product ? 1.0 : -0.0);
+    }
+    size_t half = n / 2;
+    double low = pairwise(reduce, product, x, half);
+    double high = pairwise(reduce, product, x + half, n - half);
+    return product ? low * high : low + high;
+}
+
+double vecSum(const double *values, size_t count)
+{
+    return pairwise(vecKernels()->sum, false, values, count);
+}
+
+double vecProduct(const double *values, size_t count)
+{
+    return pairwise(vecKernels()->product, true, values, count);
+}
+
+double vecSumSquares(const double *values, size_t count)
+{
+    return pairwise(vecKernels()->squares, false, values, count);
+}
+
+// The first element equal to value; a nan first element wins, as it
+// never compares less than anything.
+static size_t firstEqual(const double *values, size_t count, double value)
+{
+    for (size_t i = 0; value == value && i < count; i++)
+    {
+        if (values[i] == value)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+size_t vecMinIndex(const double *values, size_t count)
+{
+    return firstEqual(values, count, vecKernels()->least(values + 1, count - 1, values[0]));
+}
+
+size_t vecMaxIndex(const double *values, size_t count)
+{
+    return firstEqual(values, count, vecKernels()->greatest(values + 1, count - 1, values[0]));
+}
+
+void vecPrint(RET_VAL val)
+{
+    VECTOR *vector = retVectorOf(val);
+    printf("(");
+    for (uint32_t i = 0; i < vector->count; i++)
+    {
+        printf(i == 0 ? "" : " ");
+        printf(options.hexDoubles ? "%a" : "%lf", vector->values[i]);
+    }
+    printf(")");
+}
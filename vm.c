@@ -0,0 +1,1476 @@
+#include "cilisp.h"
+#include <stdint.h>
+
+// Bytecode compiler and stack VM.
+//
+// A resolved program is compiled into one flat array of 32-bit words:
+// an opcode followed by its operands. The top-level expression is the
+// first block; every let binding becomes its own block (a thunk) that
+// LOAD runs the first time the binding is referenced in an activation,
+// so bindings keep the lazy, evaluate-once semantics of the tree evaluator.
+//
+// Arity is checked once, at compile time. Warnings the tree evaluator
+// would print are compiled into WARN instructions at the same point in
+// evaluation order, and operands the tree evaluator would skip are not
+// compiled at all. Subtractions, divisions, sums and products that
+// inferTypes found to be DOUBLEs on DOUBLE operands get instructions of
+// their own, which skip the tag checks. Vectors are left to the
+// kernels in vector.c, like bignums to bignum.c.
+//
+// A call shared by resolveSymbols is compiled where it is first used, and
+// KEEPs its value in its memo slot; later uses RECALL it. All the uses of
+// a shared call are in the body of one scope, so in one block, and none
+// of them is in an operand cond, and or or may skip, so the first use
+// always runs first.
+//
+// cond, and and or jump over the operands they skip. less, greater and
+// equal compare without branching on the result; on operands inferTypes
+// found to be DOUBLEs, they skip the tag checks too.
+//
+// A let-bound function's body is a block of its own too, compiled the
+// first time a call to it is. CALL lays out a frame of the arguments and
+// the captures; a call that ends a function's body, of a function bound
+// outside that body and cast alike, is a TAILCALL, which takes over the
+// caller's frame. Thunks and calls push where to return to and jump to
+// their block, which RET pops, so neither grows the C stack. Bodies hold
+// no shared calls, as resolveSymbols treats them like bindings.
+
+typedef enum {
+    OP_CONST,       // k            push constants[k]
+    OP_LOAD,        // depth slot   push a binding, running its thunk on first use
+    OP_NEG,
+    OP_ABS,
+    OP_EXP,
+    OP_EXP2,
+    OP_LOG,
+    OP_SQRT,
+    OP_CBRT,
+    OP_SUB,
+    OP_DIV,
+    OP_REMAINDER,
+    OP_POW,
+    OP_LESS,        //              push 1 or 0
+    OP_GREATER,
+    OP_EQUAL,
+    OP_ADD,         // n            fold the top n values
+    OP_MULT,        // n
+    OP_HYPOT,       // n
+    OP_MIN,         // n
+    OP_MAX,         // n
+    OP_VEC,         // n            make a vector of the top n values
+    OP_SUB_DOUBLE,  //              the same, for operands inferTypes found to be DOUBLEs
+    OP_DIV_DOUBLE,
+    OP_ADD_DOUBLE,  // n
+    OP_MULT_DOUBLE, // n
+    OP_LESS_DOUBLE,
+    OP_GREATER_DOUBLE,
+    OP_EQUAL_DOUBLE,
+    OP_KEEP,        // k            copy the top value to memo slot k
+    OP_RECALL,      // k            push memo slot k
+    OP_WARN,        // m            print messages[m]
+    OP_CONDITION,   // m            print messages[m] and take the top value as 0 if it is a vector
+    OP_JUMP,        // pc           go on at pc
+    OP_JUMP_FALSE,  // pc           pop a condition, and go on at pc unless it holds
+    OP_JUMP_TRUE,   // pc           pop a condition, and go on at pc if it holds
+    OP_ENTER,       // s            push an activation of scopes[s]
+    OP_LEAVE,
+    OP_CALL,        // f depth slot call ast.lambdas[f] on the top arguments, through the closure in (depth, slot)
+    OP_TAILCALL,    // f depth slot the same, in the frame of the function whose body it ends
+    OP_RET
+} OPCODE;
+
+typedef struct {
+    int pc;
+    int maxStack;
+    NUM_TYPE cast;
+    SYMBOL_ID id;
+    AST_ID value;       // bound expression, until the thunk is compiled
+} VM_THUNK;
+
+typedef struct {
+    int pc;
+    int maxStack;
+    int paramCount;
+    NUM_TYPE cast;
+    bool queued;        // to be compiled, or compiled
+    bool memo;          // keeps its results (see resultCacheLookup)
+} VM_BODY;
+
+typedef struct {
+    int slotCount;
+    int firstThunk;
+    int lambdaCount;
+} VM_SCOPE;
+
+typedef struct {
+    int scope;          // index in program.scopes, or -1 - f for a call of ast.lambdas[f]
+    int outer;
+    size_t base;
+} VM_FRAME;
+
+// Where RET goes back to from a thunk or a function body
+typedef struct {
+    int pc;
+    int fp;
+    size_t slot;        // the binding slot a thunk fills, VM_CALL_RETURN for a call
+    NUM_TYPE cast;
+    size_t warnings;    // warningCount at the call
+} VM_RETURN;
+
+#define VM_CALL_RETURN SIZE_MAX
+#define VM_MEMO_RETURN (SIZE_MAX - 1)  // a call of a memo function, which keeps its result
+
+#define VM_GROW(array, count, capacity, extra) \
+    if ((count) + (extra) > (capacity)) { \
+        (capacity) = 2 * ((count) + (extra)); \
+        if (((array) = realloc((array), (capacity) * sizeof(*(array)))) == NULL) \
+            yyerror("Memory allocation failed!"); \
+    }
+
+// Compiled program; the buffers are reused from one program to the next.
+static struct {
+    int32_t *code;
+    size_t codeSize, codeCapacity;
+    RET_VAL *constants;
+    size_t constantCount, constantCapacity;
+    char **messages;
+    size_t messageCount, messageCapacity;
+    VM_SCOPE *scopes;
+    size_t scopeCount, scopeCapacity;
+    VM_THUNK *thunks;
+    size_t thunkCount, thunkCapacity;
+    VM_BODY *bodies;                    // by index in ast.lambdas
+    size_t bodyCapacity;
+    uint32_t *bodyQueue;                // functions in the order they are compiled
+    size_t bodyQueueCount, bodyQueueCapacity;
+    bool *memoKept;                     // memo slots already compiled
+    size_t memoCapacity;
+    int mainMaxStack;
+    bool vectors;                       // the program makes vectors
+
+    // stack depth bookkeeping for the block being compiled
+    int depth;
+    int maxDepth;
+} program;
+
+// Run-time state, also reused between programs.
+static struct {
+    RET_VAL *stack;
+    size_t stackCapacity;
+    VM_FRAME *frames;
+    size_t frameCount, frameCapacity;
+    BINDING_SLOT *slots;
+    size_t slotCount, slotCapacity;
+    VM_RETURN *returns;
+    size_t returnCount, returnCapacity;
+    RET_VAL *memo;
+    size_t memoCapacity;
+} vm;
+
+static void emit(int32_t word)
+{
+    VM_GROW(program.code, program.codeSize, program.codeCapacity, 1);
+    program.code[program.codeSize++] = word;
+}
+
+// Tracks how an instruction moves the stack pointer.
+static void stackEffect(int delta)
+{
+    program.depth += delta;
+    if (program.depth > program.maxDepth)
+    {
+        program.maxDepth = program.depth;
+    }
+}
+
+static void emitConst(RET_VAL val)
+{
+    VM_GROW(program.constants, program.constantCount, program.constantCapacity, 1);
+    program.constants[program.constantCount] = val;
+    emit(OP_CONST);
+    emit((int32_t) program.constantCount++);
+    stackEffect(1);
+}
+
+static int32_t addMessage(char *format, char *name)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), format, name);
+
+    VM_GROW(program.messages, program.messageCount, program.messageCapacity, 1);
+    program.messages[program.messageCount] = arenaStrdup(buffer);
+    return (int32_t) program.messageCount++;
+}
+
+static void emitMessage(char *format, char *name)
+{
+    emit(OP_WARN);
+    emit(addMessage(format, name));
+}
+
+static void emitWarning(char *format, FUNC_TYPE func)
+{
+    emitMessage(format, funcName(func));
+}
+
+static void compileNode(AST_ID node);
+static void compileCall(AST_ID node, int up, NUM_TYPE cast);
+static void compileLazy(AST_ID node, int up, NUM_TYPE cast);
+
+static void compileUnary(OPCODE op, FUNC_TYPE func, AST_ID *ops, size_t count)
+{
+    if (count == 0)
+    {
+        emitWarning("%s called with no operands, NAN returned", func);
+        emitConst(NAN_RET_VAL);
+        return;
+    }
+    if (count > 1)
+    {
+        emitWarning("%s called with extra operands", func);
+    }
+    compileNode(ops[0]);
+    emit(op);
+}
+
+static void compileBinary(OPCODE op, FUNC_TYPE func, AST_ID *ops, size_t count)
+{
+    if (count == 0)
+    {
+        emitWarning("%s called with no operands, 0 returned", func);
+        emitConst(ZERO_RET_VAL);
+        return;
+    }
+    if (count == 1)
+    {
+        emitWarning("%s called with 1 operand, NAN returned", func);
+        emitConst(NAN_RET_VAL);
+        return;
+    }
+    compileNode(ops[0]);
+    compileNode(ops[1]);
+    if (count > 2)
+    {
+        emitWarning("%s called with too many operands, ignoring extra", func);
+    }
+    emit(op);
+    stackEffect(-1);
+}
+
+// Pushes every operand, for an instruction that folds the top count values.
+static void compileList(OPCODE op, AST_ID *ops, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        compileNode(ops[i]);
+    }
+    emit(op);
+    emit((int32_t) count);
+    stackEffect(1 - (int) count);
+}
+
+static void compileVariadic(OPCODE op, FUNC_TYPE func, AST_ID *ops, size_t count)
+{
+    if (count == 0)
+    {
+        emitWarning("%s called with no operands, 0 returned", func);
+        emitConst(ZERO_RET_VAL);
+        return;
+    }
+    compileList(op, ops, count);
+}
+
+// A call of a let-bound function, whose body is queued to be compiled.
+// up is how many let scopes the call is inside of in the body it ends,
+// whose function casts as cast; -1 if it ends none.
+static void compileCall(AST_ID node, int up, NUM_TYPE cast)
+{
+    AST_ID callee = NODE_CALLEE(node);
+    size_t count = NODE(node).function.count;
+
+    if (NODE(callee).symbol.depth < 0)
+    {
+        emitConst(NAN_RET_VAL);
+        return;
+    }
+    uint32_t index = NODE(callee).symbol.lambda;
+    AST_LAMBDA *lambda = &ast.lambdas[index];
+    size_t params = (size_t) NODE_SCOPE(lambda->params)->slotCount;
+    if (count < params)
+    {
+        emitMessage("%s called with too few operands, NAN returned", symbolName(lambda->id));
+        emitConst(NAN_RET_VAL);
+        return;
+    }
+    for (size_t i = 0; i < params; i++)
+    {
+        compileNode(NODE_OPS(node)[i]);
+    }
+    if (count > params)
+    {
+        emitMessage("%s called with too many operands, ignoring extra", symbolName(lambda->id));
+    }
+
+    VM_BODY *body = &program.bodies[index];
+    if (!body->queued)
+    {
+        body->queued = true;
+        body->paramCount = (int) params;
+        body->cast = lambda->type;
+        body->memo = lambda->memo;
+        program.bodyQueue[program.bodyQueueCount++] = index;
+    }
+
+    // a closure up scopes out is in the caller's own frame, so the callee
+    // was bound outside the caller's body; a memo function keeps its
+    // result as it returns, so it is never tail called
+    emit(up >= 0 && NODE(callee).symbol.depth == up && lambda->type == cast && !lambda->memo ? OP_TAILCALL : OP_CALL);
+    emit((int32_t) index);
+    emit(NODE(callee).symbol.depth);
+    emit(NODE(callee).symbol.slot);
+    stackEffect(1 - (int) params);
+}
+
+static void compileFunction(AST_ID node)
+{
+    FUNC_TYPE func = NODE(node).function.func;
+    AST_ID *ops = NODE_OPS(node);
+    size_t count = NODE(node).function.count;
+
+    // a DOUBLE call has the right arity, and a DOUBLE operand is stored
+    // as its own bits; a comparison is an INT, whatever it compares
+    bool doubles = count > 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        doubles &= ast.numTypes[ops[i]] == DOUBLE_TYPE;
+    }
+    if (doubles && count < RET_WIDE_CALL)
+    {
+        switch (func)
+        {
+            case LESS_FUNC: compileBinary(OP_LESS_DOUBLE, func, ops, count); return;
+            case GREATER_FUNC: compileBinary(OP_GREATER_DOUBLE, func, ops, count); return;
+            case EQUAL_FUNC: compileBinary(OP_EQUAL_DOUBLE, func, ops, count); return;
+            default: break;
+        }
+    }
+    if (doubles && count < RET_WIDE_CALL && ast.numTypes[node] == DOUBLE_TYPE)
+    {
+        switch (func)
+        {
+            case SUB_FUNC: compileBinary(OP_SUB_DOUBLE, func, ops, count); return;
+            case DIV_FUNC: compileBinary(OP_DIV_DOUBLE, func, ops, count); return;
+            case ADD_FUNC: compileVariadic(OP_ADD_DOUBLE, func, ops, count); return;
+            case MULT_FUNC: compileVariadic(OP_MULT_DOUBLE, func, ops, count); return;
+            default: break;
+        }
+    }
+
+    switch (func)
+    {
+        case NEG_FUNC: compileUnary(OP_NEG, func, ops, count); break;
+        case ABS_FUNC: compileUnary(OP_ABS, func, ops, count); break;
+        case EXP_FUNC: compileUnary(OP_EXP, func, ops, count); break;
+        case EXP2_FUNC: compileUnary(OP_EXP2, func, ops, count); break;
+        case LOG_FUNC: compileUnary(OP_LOG, func, ops, count); break;
+        case SQRT_FUNC: compileUnary(OP_SQRT, func, ops, count); break;
+        case CBRT_FUNC: compileUnary(OP_CBRT, func, ops, count); break;
+        case SUB_FUNC: compileBinary(OP_SUB, func, ops, count); break;
+        case DIV_FUNC: compileBinary(OP_DIV, func, ops, count); break;
+        case REMAINDER_FUNC: compileBinary(OP_REMAINDER, func, ops, count); break;
+        case POW_FUNC: compileBinary(OP_POW, func, ops, count); break;
+        case LESS_FUNC: compileBinary(OP_LESS, func, ops, count); break;
+        case GREATER_FUNC: compileBinary(OP_GREATER, func, ops, count); break;
+        case EQUAL_FUNC: compileBinary(OP_EQUAL, func, ops, count); break;
+        case COND_FUNC:
+        case AND_FUNC:
+        case OR_FUNC: compileLazy(node, -1, NO_TYPE); break;
+        case ADD_FUNC: compileVariadic(OP_ADD, func, ops, count); break;
+        case MULT_FUNC: compileVariadic(OP_MULT, func, ops, count); break;
+        case HYPOT_FUNC: compileVariadic(OP_HYPOT, func, ops, count); break;
+        case MIN_FUNC: compileVariadic(OP_MIN, func, ops, count); break;
+        case MAX_FUNC: compileVariadic(OP_MAX, func, ops, count); break;
+        case VEC_FUNC: compileList(OP_VEC, ops, count); break;
+        case CUSTOM_FUNC: compileCall(node, -1, NO_TYPE); break;
+        default: emitConst(NAN_RET_VAL); break;
+    }
+}
+
+// Registers a scope's bindings as thunks; their code is compiled after
+// the current block is finished.
+static int compileScopeInfo(AST_SCOPE *scope)
+{
+    int count = scope->slotCount;
+
+    VM_GROW(program.scopes, program.scopeCount, program.scopeCapacity, 1);
+    VM_GROW(program.thunks, program.thunkCount, program.thunkCapacity, (size_t) count);
+
+    program.scopes[program.scopeCount].slotCount = count;
+    program.scopes[program.scopeCount].firstThunk = (int) program.thunkCount;
+    program.scopes[program.scopeCount].lambdaCount = scope->lambdaCount;
+
+    for (int slot = 0; slot < count; slot++)
+    {
+        VM_THUNK *thunk = &program.thunks[program.thunkCount++];
+        thunk->pc = -1;
+        thunk->maxStack = 0;
+        thunk->cast = SCOPE_SLOT(scope, slot)->type;
+        if (thunk->cast == ast.numTypes[SCOPE_SLOT(scope, slot)->value])
+        {
+            thunk->cast = NO_TYPE;
+        }
+        thunk->id = SCOPE_SLOT(scope, slot)->id;
+        thunk->value = SCOPE_SLOT(scope, slot)->value;
+    }
+
+    return (int) program.scopeCount++;
+}
+
+static void compileNode(AST_ID node)
+{
+    switch (NODE_TYPE(node))
+    {
+        case NUM_NODE_TYPE:
+            emitConst(NODE(node).number);
+            break;
+        case SYM_NODE_TYPE:
+            if (NODE(node).symbol.depth < 0)
+            {
+                emitConst(NAN_RET_VAL);
+                break;
+            }
+            emit(OP_LOAD);
+            emit(NODE(node).symbol.depth);
+            emit(NODE(node).symbol.slot);
+            stackEffect(1);
+            break;
+        case FUNC_NODE_TYPE:
+        {
+            uint32_t memo = NODE(node).function.memo;
+            if (memo == 0)
+            {
+                compileFunction(node);
+            }
+            else if (program.memoKept[memo - 1])
+            {
+                emit(OP_RECALL);
+                emit((int32_t) memo - 1);
+                stackEffect(1);
+            }
+            else
+            {
+                compileFunction(node);
+                emit(OP_KEEP);
+                emit((int32_t) memo - 1);
+                program.memoKept[memo - 1] = true;
+            }
+            break;
+        }
+        case SCOPE_NODE_TYPE:
+            emit(OP_ENTER);
+            emit(compileScopeInfo(NODE_SCOPE(node)));
+            compileNode(NODE_SCOPE(node)->child);
+            emit(OP_LEAVE);
+            break;
+        default:
+            emitConst(NAN_RET_VAL);
+            break;
+    }
+}
+
+// Compiles one block ending in RET, returning its maximum stack depth.
+static int compileBlock(AST_ID node)
+{
+    program.depth = 0;
+    program.maxDepth = 0;
+    compileNode(node);
+    emit(OP_RET);
+    return program.maxDepth;
+}
+
+// Compiles the end of a function's body, where a call may be a tail
+// call; up counts the let scopes entered since the body began. The
+// branches of a cond there end the body too. A memo function's body
+// makes no tail calls, as its result is kept on RET.
+static void compileTail(AST_ID node, int up, NUM_TYPE cast)
+{
+    if (NODE_TYPE(node) == SCOPE_NODE_TYPE)
+    {
+        emit(OP_ENTER);
+        emit(compileScopeInfo(NODE_SCOPE(node)));
+        compileTail(NODE_SCOPE(node)->child, up + 1, cast);
+        emit(OP_LEAVE);
+    }
+    else if (NODE_TYPE(node) == FUNC_NODE_TYPE && NODE(node).function.func == CUSTOM_FUNC)
+    {
+        compileCall(node, up, cast);
+    }
+    else if (NODE_TYPE(node) == FUNC_NODE_TYPE && NODE(node).function.func == COND_FUNC)
+    {
+        compileLazy(node, up, cast);
+    }
+    else
+    {
+        compileNode(node);
+    }
+}
+
+// Emits a jump to be patched once its target is known, chained onto
+// the jumps pending before it through the operand. Returns the chain.
+static int32_t emitJump(OPCODE op, int32_t pending)
+{
+    emit(op);
+    emit(pending);
+    return (int32_t) program.codeSize - 1;
+}
+
+// Points a chain of jumps at the next instruction.
+static void patchJumps(int32_t pending)
+{
+    while (pending >= 0)
+    {
+        int32_t next = program.code[pending];
+        program.code[pending] = (int32_t) program.codeSize;
+        pending = next;
+    }
+}
+
+// A condition of cond, and or or. In a program that makes vectors, one
+// that may be a vector is checked, to warn of it and take it as false.
+static void compileCondition(AST_ID node, FUNC_TYPE func)
+{
+    compileNode(node);
+    if (program.vectors && ast.numTypes[node] != INT_TYPE && ast.numTypes[node] != DOUBLE_TYPE)
+    {
+        emit(OP_CONDITION);
+        emit(addMessage("%s given a vector as a condition, taken as false", funcName(func)));
+    }
+}
+
+// cond, and and or, which only evaluate the operands they need: cond
+// one of its branches, which end a function's body if the cond does
+// (up and cast are as for compileCall, up -1 if not), and and or their
+// operands up to the first one that decides them.
+static void compileLazy(AST_ID node, int up, NUM_TYPE cast)
+{
+    FUNC_TYPE func = NODE(node).function.func;
+    AST_ID *ops = NODE_OPS(node);
+    size_t count = NODE(node).function.count;
+    int32_t otherwise = -1, decided = -1, end = -1;
+
+    if (func == COND_FUNC)
+    {
+        if (count < 3)
+        {
+            emitWarning("%s called with too few operands, NAN returned", func);
+            emitConst(NAN_RET_VAL);
+            return;
+        }
+        compileCondition(ops[0], func);
+        if (count > 3)
+        {
+            emitWarning("%s called with too many operands, ignoring extra", func);
+        }
+        otherwise = emitJump(OP_JUMP_FALSE, otherwise);
+        stackEffect(-1);
+        for (size_t i = 1; i <= 2; i++)
+        {
+            if (up >= 0)
+            {
+                compileTail(ops[i], up, cast);
+            }
+            else
+            {
+                compileNode(ops[i]);
+            }
+            if (i == 1)
+            {
+                end = emitJump(OP_JUMP, end);
+                patchJumps(otherwise);
+                stackEffect(-1);
+            }
+        }
+        patchJumps(end);
+        return;
+    }
+
+    // every operand but the last may decide the result; the last one's
+    // truth is the result
+    for (size_t i = 0; i < count; i++)
+    {
+        compileCondition(ops[i], func);
+        decided = emitJump(func == AND_FUNC ? OP_JUMP_FALSE : OP_JUMP_TRUE, decided);
+        stackEffect(-1);
+    }
+    emitConst(retFromBool(func == AND_FUNC));
+    if (count > 0)
+    {
+        end = emitJump(OP_JUMP, end);
+        patchJumps(decided);
+        stackEffect(-1);
+        emitConst(retFromBool(func == OR_FUNC));
+        patchJumps(end);
+    }
+}
+
+static void compileBody(uint32_t index)
+{
+    AST_LAMBDA *lambda = &ast.lambdas[index];
+    program.bodies[index].pc = (int) program.codeSize;
+    program.depth = 0;
+    program.maxDepth = 0;
+    if (lambda->memo)
+    {
+        compileNode(NODE_SCOPE(lambda->params)->child);
+    }
+    else
+    {
+        compileTail(NODE_SCOPE(lambda->params)->child, 0, lambda->type);
+    }
+    emit(OP_RET);
+    program.bodies[index].maxStack = program.maxDepth;
+}
+
+// Compiles a resolved program. Always succeeds for the node types the
+// tree evaluator knows about; returns false if the caller should fall
+// back to eval.
+bool vmCompile(AST_ID node)
+{
+    program.codeSize = 0;
+    program.constantCount = 0;
+    program.messageCount = 0;
+    program.scopeCount = 0;
+    program.thunkCount = 0;
+
+    if (node == 0)
+    {
+        return false;
+    }
+
+    VM_GROW(program.memoKept, 0, program.memoCapacity, ast.memoCount);
+    memset(program.memoKept, 0, ast.memoCount * sizeof(bool));
+    VM_GROW(program.bodies, 0, program.bodyCapacity, ast.lambdaCount);
+    VM_GROW(program.bodyQueue, 0, program.bodyQueueCapacity, ast.lambdaCount);
+    for (size_t i = 0; i < ast.lambdaCount; i++)
+    {
+        program.bodies[i].queued = false;
+    }
+    program.bodyQueueCount = 0;
+    program.vectors = astMakesVectors();
+
+    program.mainMaxStack = compileBlock(node);
+
+    // thunk and function blocks may register more scopes, thunks and
+    // functions as they go
+    size_t thunk = 0, body = 0;
+    while (thunk < program.thunkCount || body < program.bodyQueueCount)
+    {
+        if (thunk == program.thunkCount)
+        {
+            compileBody(program.bodyQueue[body++]);
+            continue;
+        }
+        int pc = (int) program.codeSize;
+        int maxStack = compileBlock(program.thunks[thunk].value);
+        program.thunks[thunk].pc = pc;
+        program.thunks[thunk].maxStack = maxStack;
+        thunk++;
+    }
+
+    return true;
+}
+
+static void vmReserveStack(size_t size)
+{
+    if (size > vm.stackCapacity)
+    {
+        vm.stackCapacity = 2 * size;
+        if ((vm.stack = realloc(vm.stack, vm.stackCapacity * sizeof(RET_VAL))) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+}
+
+static int vmOuterFrame(int frame, int depth)
+{
+    for (; depth > 0; depth--)
+    {
+        frame = vm.frames[frame].outer;
+    }
+    return frame;
+}
+
+// Lays out the frame of a call of ast.lambdas[index] through env, its
+// closure: the arguments, then the captures, as startFunction does for
+// eval. A tail call passes the frame it takes over; -1 pushes a new one.
+static int vmFrame(uint32_t index, int env, int frame, RET_VAL *args)
+{
+    AST_LAMBDA *lambda = &ast.lambdas[index];
+    size_t count = (size_t) NODE_SCOPE(lambda->params)->slotCount;
+    bool reusing = frame >= 0;
+    bool sameCaptures = false;
+
+    if (reusing)
+    {
+        sameCaptures = vm.frames[frame].scope == -1 - (int) index && vm.frames[frame].outer == env;
+        vm.frameCount = (size_t) frame + 1;
+        vm.slotCount = vm.frames[frame].base;
+    }
+    else
+    {
+        VM_GROW(vm.frames, vm.frameCount, vm.frameCapacity, 1);
+        frame = (int) vm.frameCount++;
+        vm.frames[frame].base = vm.slotCount;
+    }
+    vm.frames[frame].scope = -1 - (int) index;
+    vm.frames[frame].outer = env;
+
+    VM_GROW(vm.slots, vm.slotCount, vm.slotCapacity, count + lambda->captureCount);
+    BINDING_SLOT *slots = vm.slots + vm.slotCount;
+    size_t limit = vm.slotCount + count + lambda->captureCount;
+    if (reusing)
+    {
+        tailArguments(slots, vm.slotCount, args, count, limit);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            slots[i].value = args[i];
+            slots[i].state = SLOT_READY;
+        }
+        callEnter(limit);
+    }
+    for (uint32_t i = 0; i < lambda->captureCount && !sameCaptures; i++)
+    {
+        AST_CAPTURE *capture = &lambda->captures[i];
+        int source = vmOuterFrame(env, capture->depth);
+        BINDING_SLOT *slot = &vm.slots[vm.frames[source].base + capture->slot];
+        if (slot->state == SLOT_READY || slot->state == SLOT_FORWARDED)
+        {
+            slots[count + i] = *slot;
+        }
+        else
+        {
+            slots[count + i].state = SLOT_FORWARDED;
+            slots[count + i].value = (uint64_t) source << 32 | (uint32_t) capture->slot;
+        }
+    }
+    vm.slotCount = limit;
+    return frame;
+}
+
+// Runs the block at pc in activation fp, using the value stack from
+// index base up. The block's maxStack must already be reserved.
+static RET_VAL vmRun(int pc, int fp, size_t base)
+{
+    const int32_t *code = program.code;
+    size_t bottom = vm.returnCount;
+    RET_VAL *sp = vm.stack + base;
+    RET_VAL num;
+    NUM_TYPE type;
+    double value;
+    int count;
+
+#if defined(__GNUC__)
+    static void *labels[] = {
+        [OP_CONST] = &&op_CONST,
+        [OP_LOAD] = &&op_LOAD,
+        [OP_NEG] = &&op_NEG,
+        [OP_ABS] = &&op_ABS,
+        [OP_EXP] = &&op_EXP,
+        [OP_EXP2] = &&op_EXP2,
+        [OP_LOG] = &&op_LOG,
+        [OP_SQRT] = &&op_SQRT,
+        [OP_CBRT] = &&op_CBRT,
+        [OP_SUB] = &&op_SUB,
+        [OP_DIV] = &&op_DIV,
+        [OP_REMAINDER] = &&op_REMAINDER,
+        [OP_POW] = &&op_POW,
+        [OP_LESS] = &&op_LESS,
+        [OP_GREATER] = &&op_GREATER,
+        [OP_EQUAL] = &&op_EQUAL,
+        [OP_ADD] = &&op_ADD,
+        [OP_MULT] = &&op_MULT,
+        [OP_HYPOT] = &&op_HYPOT,
+        [OP_MIN] = &&op_MIN,
+        [OP_MAX] = &&op_MAX,
+        [OP_VEC] = &&op_VEC,
+        [OP_SUB_DOUBLE] = &&op_SUB_DOUBLE,
+        [OP_DIV_DOUBLE] = &&op_DIV_DOUBLE,
+        [OP_ADD_DOUBLE] = &&op_ADD_DOUBLE,
+        [OP_MULT_DOUBLE] = &&op_MULT_DOUBLE,
+        [OP_LESS_DOUBLE] = &&op_LESS_DOUBLE,
+        [OP_GREATER_DOUBLE] = &&op_GREATER_DOUBLE,
+        [OP_EQUAL_DOUBLE] = &&op_EQUAL_DOUBLE,
+        [OP_KEEP] = &&op_KEEP,
+        [OP_RECALL] = &&op_RECALL,
+        [OP_WARN] = &&op_WARN,
+        [OP_CONDITION] = &&op_CONDITION,
+        [OP_JUMP] = &&op_JUMP,
+        [OP_JUMP_FALSE] = &&op_JUMP_FALSE,
+        [OP_JUMP_TRUE] = &&op_JUMP_TRUE,
+        [OP_ENTER] = &&op_ENTER,
+        [OP_LEAVE] = &&op_LEAVE,
+        [OP_CALL] = &&op_CALL,
+        [OP_TAILCALL] = &&op_TAILCALL,
+        [OP_RET] = &&op_RET
+    };
+    #define DISPATCH() goto *labels[code[pc++]]
+    #define TARGET(op) op_##op
+    DISPATCH();
+#else
+    #define DISPATCH() goto dispatch
+    #define TARGET(op) case OP_##op
+dispatch:
+    switch (code[pc++])
+    {
+#endif
+
+    TARGET(CONST):
+        *sp++ = program.constants[code[pc++]];
+        DISPATCH();
+
+    TARGET(LOAD):
+    {
+        int frame = vmOuterFrame(fp, code[pc]);
+        int slot = code[pc + 1];
+        size_t index = vm.frames[frame].base + slot;
+        pc += 2;
+
+        if (vm.slots[index].state == SLOT_FORWARDED)
+        {
+            frame = (int) (vm.slots[index].value >> 32);
+            slot = (int) (uint32_t) vm.slots[index].value;
+            index = vm.frames[frame].base + slot;
+        }
+        if (vm.slots[index].state != SLOT_READY)
+        {
+            VM_THUNK *thunk = &program.thunks[program.scopes[vm.frames[frame].scope].firstThunk + slot];
+            if (vm.slots[index].state == SLOT_EVALUATING)
+            {
+                warning("symbol %s is defined in terms of itself, nan returned", symbolName(thunk->id));
+                *sp++ = NAN_RET_VAL;
+                DISPATCH();
+            }
+
+            // the thunk may grow the value stack, so hold on to an offset
+            size_t offset = sp - vm.stack;
+            VM_GROW(vm.returns, vm.returnCount, vm.returnCapacity, 1);
+            vm.returns[vm.returnCount++] = (VM_RETURN) { pc, fp, index, thunk->cast, warningCount };
+            vm.slots[index].state = SLOT_EVALUATING;
+            vmReserveStack(offset + thunk->maxStack);
+            sp = vm.stack + offset;
+            pc = thunk->pc;
+            fp = frame;
+            DISPATCH();
+        }
+        *sp++ = vm.slots[index].value;
+        DISPATCH();
+    }
+
+    TARGET(NEG):
+        if (retIsInt(sp[-1]) && sp[-1] != ZERO_RET_VAL)
+        {
+            sp[-1] = retFromInt(-retIntOf(sp[-1]));
+            DISPATCH();
+        }
+        sp[-1] = retNeg(sp[-1]);
+        DISPATCH();
+
+    TARGET(ABS):
+        sp[-1] = retAbs(sp[-1]);
+        DISPATCH();
+
+    TARGET(EXP):
+        if (retIsVector(sp[-1]))
+        {
+            sp[-1] = vecMap(EXP_FUNC, sp[-1], false);
+            DISPATCH();
+        }
+        sp[-1] = retDouble(options.math->exp(retValue(sp[-1])));
+        DISPATCH();
+
+    TARGET(EXP2):
+        if (retIsVector(sp[-1]))
+        {
+            sp[-1] = vecMap(EXP2_FUNC, sp[-1], false);
+            DISPATCH();
+        }
+        type = retType(sp[-1]);
+        value = retIsInt(sp[-1]) ? ldexp(1, (int) fmax(fmin(retIntOf(sp[-1]), 2000), -2000)) : options.math->exp2(retValue(sp[-1]));
+        if (value < 0)
+        {
+            type = DOUBLE_TYPE;
+        }
+        sp[-1] = makeRetVal(type, value);
+        DISPATCH();
+
+    TARGET(LOG):
+        if (retIsVector(sp[-1]))
+        {
+            sp[-1] = vecMap(LOG_FUNC, sp[-1], false);
+            DISPATCH();
+        }
+        sp[-1] = retDouble(options.math->log(retValue(sp[-1])));
+        DISPATCH();
+
+    TARGET(SQRT):
+        if (retIsVector(sp[-1]))
+        {
+            sp[-1] = vecMap(SQRT_FUNC, sp[-1], false);
+            DISPATCH();
+        }
+        sp[-1] = retDouble(sqrt(retValue(sp[-1])));
+        DISPATCH();
+
+    TARGET(CBRT):
+        if (retIsVector(sp[-1]))
+        {
+            sp[-1] = vecMap(CBRT_FUNC, sp[-1], false);
+            DISPATCH();
+        }
+        sp[-1] = retDouble(options.math->cbrt(retValue(sp[-1])));
+        DISPATCH();
+
+    TARGET(SUB):
+        sp--;
+        if (retIsInt(sp[-1]) && retIsInt(sp[0]))
+        {
+            sp[-1] = retFromInt(retIntOf(sp[-1]) - retIntOf(sp[0]));
+            DISPATCH();
+        }
+        if (retIsPlain(sp[-1]) && retIsPlain(sp[0]))
+        {
+            sp[-1] = retDouble(retPlainOf(sp[-1]) - retPlainOf(sp[0]));
+            DISPATCH();
+        }
+        sp[-1] = retSub(sp[-1], sp[0]);
+        DISPATCH();
+
+    TARGET(DIV):
+        sp--;
+        if (retIsInt(sp[-1]) && retIsInt(sp[0]) && sp[0] != ZERO_RET_VAL)
+        {
+            // as retDiv: exact quotients stay INTs, others become fractions
+            int64_t dividend = retIntOf(sp[-1]), divisor = retIntOf(sp[0]);
+            if (dividend % divisor == 0 && (dividend != 0 || divisor > 0))
+            {
+                sp[-1] = retFromInt(dividend / divisor);
+                DISPATCH();
+            }
+            if (retFitsFraction(dividend, divisor))
+            {
+                sp[-1] = retFraction(dividend, divisor);
+                DISPATCH();
+            }
+        }
+        if (retIsPlain(sp[-1]) && retIsPlain(sp[0]) && !(retIsInt(sp[-1]) && retIsInt(sp[0])))
+        {
+            sp[-1] = retDouble(retPlainOf(sp[-1]) / retPlainOf(sp[0]));
+            DISPATCH();
+        }
+        sp[-1] = retDiv(sp[-1], sp[0]);
+        DISPATCH();
+
+    TARGET(REMAINDER):
+        sp--;
+        sp[-1] = retRemainder(sp[-1], sp[0]);
+        DISPATCH();
+
+    TARGET(POW):
+        sp--;
+        sp[-1] = retPow(sp[-1], sp[0]);
+        DISPATCH();
+
+    TARGET(LESS):
+        sp--;
+        if (retIsVector(sp[-1]) || retIsVector(sp[0]))
+        {
+            sp[-1] = vecZip(LESS_FUNC, sp[-1], sp[0], false);
+            DISPATCH();
+        }
+        sp[-1] = retFromBool(retLess(sp[-1], sp[0]));
+        DISPATCH();
+
+    TARGET(GREATER):
+        sp--;
+        if (retIsVector(sp[-1]) || retIsVector(sp[0]))
+        {
+            sp[-1] = vecZip(GREATER_FUNC, sp[-1], sp[0], false);
+            DISPATCH();
+        }
+        sp[-1] = retFromBool(retLess(sp[0], sp[-1]));
+        DISPATCH();
+
+    TARGET(EQUAL):
+        sp--;
+        if (retIsVector(sp[-1]) || retIsVector(sp[0]))
+        {
+            sp[-1] = vecZip(EQUAL_FUNC, sp[-1], sp[0], false);
+            DISPATCH();
+        }
+        sp[-1] = retFromBool(retEqual(sp[-1], sp[0]));
+        DISPATCH();
+
+    // add and mult take the last operand's type unless any operand is a double.
+    // Pairs of tagged INTs, and other pairs that retIsPlain, by far the
+    // common case, are done straight, and runs of up to RET_EXACT_TERMS
+    // tagged INTs are added up as int64_t without branching. Otherwise both stay on int64_t until a
+    // step would overflow, as in applyCall. Wide calls go to
+    // the shared pairwise reductions, like wide hypot, min and max.
+    TARGET(ADD):
+    {
+        bool trackDouble = false;
+        count = code[pc++];
+        sp -= count;
+        if (count == 2 && retIsInt(sp[0]) && retIsInt(sp[1]))
+        {
+            sp[0] = retFromInt(retIntOf(sp[0]) + retIntOf(sp[1]));
+            sp++;
+            DISPATCH();
+        }
+        if (count == 2 && retIsPlain(sp[0]) && retIsPlain(sp[1]))
+        {
+            // the sum starts from +0, as in applyCall: (add -0.0 -0.0) is 0
+            sp[0] = retDouble(0.0 + retPlainOf(sp[0]) + retPlainOf(sp[1]));
+            sp++;
+            DISPATCH();
+        }
+        if (count <= RET_EXACT_TERMS)
+        {
+            bool allInts = true;
+            int64_t sum = 0;
+            for (int i = 0; i < count; i++)
+            {
+                allInts &= retIsInt(sp[i]);
+                sum += retIntOf(sp[i]);
+            }
+            if (allInts)
+            {
+                *sp++ = retFromInt(sum);
+                DISPATCH();
+            }
+        }
+        if (count >= RET_WIDE_CALL)
+        {
+            *sp = retSum(sp, count);
+            sp++;
+            DISPATCH();
+        }
+        int64_t sum = 0;
+        int i = 0;
+        while (i < count && retAddInt(&sum, sp[i]))
+        {
+            i++;
+        }
+        if (i == count)
+        {
+            *sp++ = retFromInt(sum);
+            DISPATCH();
+        }
+        value = (double) sum;
+        if (retIsInteger(sp[i]))
+        {
+            // the sum overflowed int64
+            BIGNUM big;
+            bigAccStart(&big, sum);
+            while (i < count && retIsInteger(sp[i]))
+            {
+                bigAccAdd(&big, sp[i++]);
+            }
+            if (i == count)
+            {
+                *sp++ = bigAccFinish(&big);
+                DISPATCH();
+            }
+            value = bigAccDouble(&big);
+        }
+        for (; i < count && !retIsVector(sp[i]); i++)
+        {
+            trackDouble |= retIsDouble(sp[i]);
+            value += retValue(sp[i]);
+        }
+        if (i < count)
+        {
+            *sp = vecFold(ADD_FUNC, retDouble(value), sp + i, count - i);
+            sp++;
+            DISPATCH();
+        }
+        type = trackDouble ? DOUBLE_TYPE : retType(sp[count - 1]);
+        *sp++ = makeRetVal(type, value);
+        DISPATCH();
+    }
+
+    TARGET(MULT):
+    {
+        bool trackDouble = false;
+        int64_t product = 1;
+        int i = 0;
+        count = code[pc++];
+        sp -= count;
+        // pair is left wrapped on overflow; product stays 1 for the general path
+        int64_t pair;
+        if (count == 2 && retIsInt(sp[0]) && retIsInt(sp[1]) && sp[0] != ZERO_RET_VAL && sp[1] != ZERO_RET_VAL
+            && !__builtin_mul_overflow(retIntOf(sp[0]), retIntOf(sp[1]), &pair))
+        {
+            sp[0] = retFromInt(pair);
+            sp++;
+            DISPATCH();
+        }
+        if (count == 2 && retIsPlain(sp[0]) && retIsPlain(sp[1]) && !(retIsInt(sp[0]) && retIsInt(sp[1])))
+        {
+            sp[0] = retDouble(retPlainOf(sp[0]) * retPlainOf(sp[1]));
+            sp++;
+            DISPATCH();
+        }
+        if (count >= RET_WIDE_CALL)
+        {
+            *sp = retProduct(sp, count);
+            sp++;
+            DISPATCH();
+        }
+        while (i < count && retMultInt(&product, sp[i]))
+        {
+            i++;
+        }
+        if (i == count)
+        {
+            *sp++ = retFromInt(product);
+            DISPATCH();
+        }
+        value = (double) product;
+        if (retIsInteger(sp[i]) && sp[i] != ZERO_RET_VAL)
+        {
+            // the product overflowed int64
+            BIGNUM big;
+            bigAccStart(&big, product);
+            while (i < count && retIsInteger(sp[i]) && sp[i] != ZERO_RET_VAL && bigAccMult(&big, sp[i]))
+            {
+                i++;
+            }
+            if (i == count)
+            {
+                *sp++ = bigAccFinish(&big);
+                DISPATCH();
+            }
+            value = bigAccDouble(&big);
+        }
+        for (; i < count && !retIsVector(sp[i]); i++)
+        {
+            trackDouble |= retIsDouble(sp[i]);
+            value = value * retValue(sp[i]);
+        }
+        if (i < count)
+        {
+            *sp = vecFold(MULT_FUNC, retDouble(value), sp + i, count - i);
+            sp++;
+            DISPATCH();
+        }
+        type = trackDouble ? DOUBLE_TYPE : retType(sp[count - 1]);
+        *sp++ = makeRetVal(type, value);
+        DISPATCH();
+    }
+
+    TARGET(HYPOT):
+    {
+        int i = 0;
+        count = code[pc++];
+        sp -= count;
+        if (count >= RET_WIDE_CALL)
+        {
+            *sp = retHypot(sp, count);
+            sp++;
+            DISPATCH();
+        }
+        value = 0;
+        for (; i < count && !retIsVector(sp[i]); i++)
+        {
+            value += pow(retValue(sp[i]), 2);
+        }
+        *sp = i < count ? vecFold(HYPOT_FUNC, retDouble(value), sp + i, count - i) : retDouble(sqrt(value));
+        sp++;
+        DISPATCH();
+    }
+
+    TARGET(MIN):
+        count = code[pc++];
+        sp -= count;
+        if (count >= RET_WIDE_CALL)
+        {
+            *sp = retMin(sp, count);
+            sp++;
+            DISPATCH();
+        }
+        if (count == 2 && retIsPlain(sp[0]) && retIsPlain(sp[1]))
+        {
+            *sp = retPlainOf(sp[1]) < retPlainOf(sp[0]) ? sp[1] : sp[0];
+            sp++;
+            DISPATCH();
+        }
+        num = sp[0];
+        for (int i = 1; i < count; i++)
+        {
+            if (retIsVector(sp[i]) || retIsVector(num))
+            {
+                num = vecFold(MIN_FUNC, num, sp + i, count - i);
+                break;
+            }
+            if (retLess(sp[i], num))
+            {
+                num = sp[i];
+            }
+        }
+        *sp++ = num;
+        DISPATCH();
+
+    TARGET(MAX):
+        count = code[pc++];
+        sp -= count;
+        if (count >= RET_WIDE_CALL)
+        {
+            *sp = retMax(sp, count);
+            sp++;
+            DISPATCH();
+        }
+        if (count == 2 && retIsPlain(sp[0]) && retIsPlain(sp[1]))
+        {
+            *sp = retPlainOf(sp[0]) < retPlainOf(sp[1]) ? sp[1] : sp[0];
+            sp++;
+            DISPATCH();
+        }
+        num = sp[0];
+        for (int i = 1; i < count; i++)
+        {
+            if (retIsVector(sp[i]) || retIsVector(num))
+            {
+                num = vecFold(MAX_FUNC, num, sp + i, count - i);
+                break;
+            }
+            if (retLess(num, sp[i]))
+            {
+                num = sp[i];
+            }
+        }
+        *sp++ = num;
+        DISPATCH();
+
+    TARGET(VEC):
+        count = code[pc++];
+        sp -= count;
+        *sp = vecMake(sp, count);
+        sp++;
+        DISPATCH();
+
+    TARGET(SUB_DOUBLE):
+        sp--;
+        sp[-1] = retDouble(retDoubleOf(sp[-1]) - retDoubleOf(sp[0]));
+        DISPATCH();
+
+    TARGET(DIV_DOUBLE):
+        sp--;
+        sp[-1] = retDouble(retDoubleOf(sp[-1]) / retDoubleOf(sp[0]));
+        DISPATCH();
+
+    TARGET(ADD_DOUBLE):
+        count = code[pc++];
+        sp -= count;
+        value = 0;
+        for (int i = 0; i < count; i++)
+        {
+            value += retDoubleOf(sp[i]);
+        }
+        *sp++ = retDouble(value);
+        DISPATCH();
+
+    TARGET(MULT_DOUBLE):
+        count = code[pc++];
+        sp -= count;
+        value = 1;
+        for (int i = 0; i < count; i++)
+        {
+            value = value * retDoubleOf(sp[i]);
+        }
+        *sp++ = retDouble(value);
+        DISPATCH();
+
+    TARGET(LESS_DOUBLE):
+        sp--;
+        sp[-1] = retFromBool(retDoubleOf(sp[-1]) < retDoubleOf(sp[0]));
+        DISPATCH();
+
+    TARGET(GREATER_DOUBLE):
+        sp--;
+        sp[-1] = retFromBool(retDoubleOf(sp[-1]) > retDoubleOf(sp[0]));
+        DISPATCH();
+
+    TARGET(EQUAL_DOUBLE):
+        sp--;
+        sp[-1] = retFromBool(retDoubleOf(sp[-1]) == retDoubleOf(sp[0]));
+        DISPATCH();
+
+    TARGET(KEEP):
+        vm.memo[code[pc++]] = sp[-1];
+        slotKept(0);
+        DISPATCH();
+
+    TARGET(RECALL):
+        *sp++ = vm.memo[code[pc++]];
+        DISPATCH();
+
+    TARGET(WARN):
+        warning("%s", program.messages[code[pc++]]);
+        DISPATCH();
+
+    TARGET(CONDITION):
+        if (retIsVector(sp[-1]))
+        {
+            warning("%s", program.messages[code[pc]]);
+            sp[-1] = ZERO_RET_VAL;
+        }
+        pc++;
+        DISPATCH();
+
+    TARGET(JUMP):
+        pc = code[pc];
+        DISPATCH();
+
+    TARGET(JUMP_FALSE):
+        sp--;
+        pc = retIsTrue(*sp) ? pc + 1 : code[pc];
+        DISPATCH();
+
+    TARGET(JUMP_TRUE):
+        sp--;
+        pc = retIsTrue(*sp) ? code[pc] : pc + 1;
+        DISPATCH();
+
+    TARGET(ENTER):
+    {
+        VM_SCOPE *scope = &program.scopes[code[pc++]];
+
+        VM_GROW(vm.frames, vm.frameCount, vm.frameCapacity, 1);
+        VM_GROW(vm.slots, vm.slotCount, vm.slotCapacity, (size_t) (scope->slotCount + scope->lambdaCount));
+
+        VM_FRAME *frame = &vm.frames[vm.frameCount];
+        frame->scope = (int) (scope - program.scopes);
+        frame->outer = fp;
+        frame->base = vm.slotCount;
+        for (int i = 0; i < scope->slotCount; i++)
+        {
+            vm.slots[vm.slotCount++].state = SLOT_UNEVALUATED;
+        }
+        // the closures of the functions bound here
+        for (int i = 0; i < scope->lambdaCount; i++)
+        {
+            vm.slots[vm.slotCount].value = vm.frameCount;
+            vm.slots[vm.slotCount++].state = SLOT_READY;
+        }
+        fp = (int) vm.frameCount++;
+        DISPATCH();
+    }
+
+    TARGET(LEAVE):
+        vm.slotCount = vm.frames[fp].base;
+        vm.frameCount--;
+        fp = vm.frames[fp].outer;
+        DISPATCH();
+
+    TARGET(CALL):
+    {
+        VM_BODY *body = &program.bodies[code[pc]];
+        int frame = vmOuterFrame(fp, code[pc + 1]);
+        int env = (int) vm.slots[vm.frames[frame].base + code[pc + 2]].value;
+        sp -= body->paramCount;
+        if (body->memo && resultCacheLookup((uint32_t) code[pc], sp, &num))
+        {
+            *sp++ = num;
+            pc += 3;
+            DISPATCH();
+        }
+
+        size_t offset = sp - vm.stack;
+        VM_GROW(vm.returns, vm.returnCount, vm.returnCapacity, 1);
+        vm.returns[vm.returnCount++] = (VM_RETURN) { pc + 3, fp, body->memo ? VM_MEMO_RETURN : VM_CALL_RETURN, body->cast, warningCount };
+        fp = vmFrame((uint32_t) code[pc], env, -1, sp);
+        pc = body->pc;
+        vmReserveStack(offset + body->maxStack);
+        sp = vm.stack + offset;
+        DISPATCH();
+    }
+
+    // the closure is a capture, in the frame of the calling function
+    // itself, and nothing is left on the stack above the arguments
+    TARGET(TAILCALL):
+    {
+        VM_BODY *body = &program.bodies[code[pc]];
+        int frame = vmOuterFrame(fp, code[pc + 1]);
+        int env = (int) vm.slots[vm.frames[frame].base + code[pc + 2]].value;
+        sp -= body->paramCount;
+
+        size_t offset = sp - vm.stack;
+        fp = vmFrame((uint32_t) code[pc], env, frame, sp);
+        pc = body->pc;
+        vmReserveStack(offset + body->maxStack);
+        sp = vm.stack + offset;
+        DISPATCH();
+    }
+
+    TARGET(RET):
+    {
+        if (vm.returnCount == bottom)
+        {
+            return sp[-1];
+        }
+        VM_RETURN *back = &vm.returns[--vm.returnCount];
+        num = sp[-1];
+        if (back->cast != NO_TYPE)
+        {
+            num = retCast(num, back->cast);
+        }
+        bool call = back->slot == VM_CALL_RETURN || back->slot == VM_MEMO_RETURN;
+        if (call)
+        {
+            num = cellRelease(num);
+        }
+        if (back->slot == VM_MEMO_RETURN && back->warnings == warningCount)
+        {
+            resultCacheStore((uint32_t) (-1 - vm.frames[fp].scope), &vm.slots[vm.frames[fp].base], num);
+        }
+        if (call)
+        {
+            vm.slotCount = vm.frames[fp].base;
+            vm.frameCount = (size_t) fp;
+            callLeave();
+        }
+        else
+        {
+            vm.slots[back->slot].value = num;
+            vm.slots[back->slot].state = SLOT_READY;
+            slotKept(back->slot);
+        }
+        sp[-1] = num;
+        pc = back->pc;
+        fp = back->fp;
+        DISPATCH();
+    }
+
+#if !defined(__GNUC__)
+    }
+#endif
+    #undef DISPATCH
+    #undef TARGET
+
+    return NAN_RET_VAL;
+}
+
+RET_VAL vmExecute(void)
+{
+    vm.frameCount = 0;
+    vm.slotCount = 0;
+    vm.returnCount = 0;
+    VM_GROW(vm.memo, 0, vm.memoCapacity, ast.memoCount);
+    vmReserveStack(program.mainMaxStack);
+    return vmRun(0, -1, 0);
+}
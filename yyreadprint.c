@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cilisp.h"
 
 #define INITIAL_BUFFER_SIZE 128
+#define BULK_BLOCK_SIZE (1 << 20)
 
 // Because getline is inconsistent across compilers
 // and Bison needs extra terminators after the line...
@@ -73,6 +79,13 @@ size_t yyreadline(char **lineptr, size_t *n, FILE *stream, size_t n_terminate)
     return (p - bufptr);
 }
 
+// Echoed input goes to stdout, or into the generated program with --emit-c.
+static void yyecho(char *text)
+{
+    if (options.emitC) emitCText(text);
+    else printf("%s", text);
+}
+
 void yyprintline(char *line, size_t len, size_t n_extra_terminates)
 {
     size_t lastIndex = len - 1 - n_extra_terminates;
@@ -82,12 +95,206 @@ void yyprintline(char *line, size_t len, size_t n_extra_terminates)
     if (lastChar == EOF)
     {
         line[lastIndex] = '\0';
-        if (lastIndex == 0) printf("%sEOF\n", line);
-        else printf("%s\n", line);
+        yyecho(line);
+        yyecho(lastIndex == 0 ? "EOF\n" : "\n");
         line[lastIndex] = EOF;
     }
     else
     {
-        printf("%s", line);
+        yyecho(line);
+    }
+}
+
+// Bulk input for script files, redirected files and pipes.
+// Regular files are mmap'd privately so lines can be scanned in place;
+// anything else (pipes, sockets) is read in large blocks. Either way
+// each line is handed to flex straight out of the input buffer: the two
+// bytes after the line are swapped for the NUL terminators flex needs
+// and put back before the next line is handed out.
+// Only the final line of a mapped file (which has no room after it for
+// the terminators) is copied, into a small reusable tail buffer.
+bool yybulkopen(YY_BULK_READER *reader, FILE *stream)
+{
+    struct stat st;
+
+    if (reader == NULL || stream == NULL)
+    {
+        return false;
+    }
+    memset(reader, 0, sizeof(YY_BULK_READER));
+    reader->fd = fileno(stream);
+
+    if (fstat(reader->fd, &st) != 0)
+    {
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode))
+    {
+        reader->size = (size_t) st.st_size;
+        reader->eof = true;
+        if (reader->size == 0)
+        {
+            return true;
+        }
+        reader->base = mmap(NULL, reader->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, reader->fd, 0);
+        if (reader->base == MAP_FAILED)
+        {
+            reader->base = NULL;
+            return false;
+        }
+        madvise(reader->base, reader->size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+    {
+        reader->capacity = BULK_BLOCK_SIZE;
+        if ((reader->base = malloc(reader->capacity)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+        return true;
+    }
+
+    // terminals and the like stay on yyreadline
+    return false;
+}
+
+// Puts back the input bytes that were hidden under the current line's terminators.
+static void yybulkrestore(YY_BULK_READER *reader)
+{
+    if (reader->savedAt != NULL)
+    {
+        reader->savedAt[0] = reader->saved[0];
+        reader->savedAt[1] = reader->saved[1];
+        reader->savedAt = NULL;
+    }
+}
+
+// Pulls another block from a pipe, keeping the unread part of the buffer.
+// Always leaves at least 3 spare bytes (EOF marker plus two terminators).
+static void yybulkfill(YY_BULK_READER *reader)
+{
+    size_t unread = reader->size - reader->pos;
+    ssize_t got;
+
+    if (reader->pos > 0)
+    {
+        memmove(reader->base, reader->base + reader->pos, unread);
+        reader->size = unread;
+        reader->pos = 0;
     }
-}
\ No newline at end of file
+
+    if (reader->capacity - reader->size < BULK_BLOCK_SIZE / 2)
+    {
+        reader->capacity *= 2;
+        if ((reader->base = realloc(reader->base, reader->capacity)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+
+    do
+    {
+        got = read(reader->fd, reader->base + reader->size, reader->capacity - reader->size - 3);
+    } while (got < 0 && errno == EINTR);
+
+    if (got <= 0)
+    {
+        reader->eof = true;
+    }
+    else
+    {
+        reader->size += got;
+    }
+}
+
+// Copies a line into the tail buffer, growing it if needed.
+static char *yybulktail(YY_BULK_READER *reader, char *line, size_t len)
+{
+    if (reader->tailSize < len + 3)
+    {
+        reader->tailSize = len + 3 > INITIAL_BUFFER_SIZE ? len + 3 : INITIAL_BUFFER_SIZE;
+        if ((reader->tail = realloc(reader->tail, reader->tailSize)) == NULL)
+        {
+            yyerror("Memory allocation failed!");
+        }
+    }
+    if (len > 0)
+    {
+        memcpy(reader->tail, line, len);
+    }
+    return reader->tail;
+}
+
+// Same contract as yyreadline: returns the next line, ending in '\n' or EOF,
+// followed by n_terminate NUL bytes, and its length including the terminators.
+// The returned line stays valid until the next call and must not be freed.
+size_t yybulkline(YY_BULK_READER *reader, char **lineptr, size_t n_terminate)
+{
+    char *line;
+    char *newline;
+    size_t len;
+
+    yybulkrestore(reader);
+
+    if (n_terminate != 2)
+    {
+        return (size_t) -1;
+    }
+
+    while (true)
+    {
+        if (reader->pos == reader->size)
+        {
+            newline = NULL;
+        }
+        else
+        {
+            newline = memchr(reader->base + reader->pos, '\n', reader->size - reader->pos);
+        }
+        if (newline != NULL || reader->eof)
+        {
+            break;
+        }
+        yybulkfill(reader);
+    }
+
+    line = reader->base == NULL ? NULL : reader->base + reader->pos;
+    if (newline != NULL)
+    {
+        len = newline - line + 1;
+    }
+    else
+    {
+        len = reader->size - reader->pos;
+    }
+    reader->pos += len;
+
+    if (newline == NULL || (reader->capacity == 0 && reader->pos + 2 > reader->size))
+    {
+        // last line: no input after it to borrow, so it gets its own copy
+        // (pipe buffers always keep spare room and can be written in place)
+        if (reader->capacity == 0)
+        {
+            line = yybulktail(reader, line, len);
+        }
+        if (newline == NULL)
+        {
+            line[len++] = (char) EOF;
+        }
+    }
+    else
+    {
+        reader->savedAt = line + len;
+        reader->saved[0] = line[len];
+        reader->saved[1] = line[len + 1];
+    }
+
+    line[len] = '\0';
+    line[len + 1] = '\0';
+
+    *lineptr = line;
+    return len + n_terminate;
+}